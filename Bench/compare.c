@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "../JSON Parser/JSON.h"
+#include "../Util/results.h"
+
+// Compares two commits' runs in the results store (Util/results.h): for
+// every metric both have, the median of each side's runs, the change
+// between them and a 95% confidence interval of that change, bootstrapped
+// from the runs. A change for the worse beyond the threshold whose interval
+// leaves out zero is a regression; so is any change to a node count.
+// Exits with 1 if there is one, so a script can stop on it. Without
+// MIN_RUNS_FOR_INTERVAL runs on each side a timing can't be told from
+// noise, so it's only reported, never counted.
+//
+// A commit is named by a prefix of its hash, with a + after it for the
+// dirty runs made on it. By default head is the last commit run in the
+// store and base the last one before it, on this machine.
+//
+// Usage: Bench/compare [-f results] [-m machine | -a] [-t threshold %]
+//                      [-s tool] [base [head]]
+
+#define DEFAULT_THRESHOLD 2.0
+#define BOOTSTRAP_ROUNDS 2000
+#define MIN_RUNS_FOR_INTERVAL 3
+
+#define XSTR(x) #x
+#define STR(x) XSTR(x)
+
+typedef struct Series {
+	char *tool;
+	char *metric;
+	double *values[2]; // base, head
+	size_t count[2];
+} Series;
+
+typedef struct Store {
+	char **commits; // as named above, in the order first run
+	size_t commitCount;
+	Series *series;
+	size_t seriesCount;
+} Store;
+
+enum direction {HIGHER_BETTER, LOWER_BETTER, MUST_NOT_CHANGE};
+
+static enum direction metricDirection(char const *name) {
+	size_t len = strlen(name);
+
+	if (len >= 5 && !strcmp(name + len - 5, "nodes"))
+		return MUST_NOT_CHANGE;
+	if ((len >= 3 && !strcmp(name + len - 3, "nps")) || (len >= 2 && !strcmp(name + len - 2, "/s")))
+		return HIGHER_BETTER;
+	return LOWER_BETTER;
+}
+
+static int compareDoubles(void const *a, void const *b) {
+	double x = *(double const *) a, y = *(double const *) b;
+	return (x > y) - (x < y);
+}
+
+// Sorts values
+static double median(double *values, size_t count) {
+	qsort(values, count, sizeof *values, compareDoubles);
+	return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+// xorshift64*, seeded the same every run so the intervals are reproducible
+static uint64_t nextRandom(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 2685821657736338717ULL;
+}
+
+// 95% interval of the change of the median from base to head, resampling
+// both sides with replacement. Relative, or absolute for a base of zero.
+static void bootstrapInterval(Series const *s, char relative, double *low, double *high) {
+	double *changes = malloc(BOOTSTRAP_ROUNDS * sizeof *changes);
+	size_t most = s->count[0] > s->count[1] ? s->count[0] : s->count[1];
+	double *sample = malloc(most * sizeof *sample);
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	size_t rounds = 0;
+
+	for (size_t r = 0; r < BOOTSTRAP_ROUNDS; r++) {
+		double medians[2];
+
+		for (int side = 0; side < 2; side++) {
+			for (size_t i = 0; i < s->count[side]; i++)
+				sample[i] = s->values[side][nextRandom(&state) % s->count[side]];
+			medians[side] = median(sample, s->count[side]);
+		}
+
+		if (!relative)
+			changes[rounds++] = medians[1] - medians[0];
+		else if (medians[0])
+			changes[rounds++] = (medians[1] - medians[0]) / fabs(medians[0]);
+	}
+
+	qsort(changes, rounds, sizeof *changes, compareDoubles);
+	*low = rounds ? changes[(size_t) (rounds * 0.025)] : 0;
+	*high = rounds ? changes[(size_t) (rounds * 0.975)] : 0;
+
+	free(sample);
+	free(changes);
+}
+
+static int commitIndex(Store const *store, char const *name) {
+	for (size_t i = 0; i < store->commitCount; i++)
+		if (!strcmp(store->commits[i], name))
+			return i;
+	return -1;
+}
+
+// The commit name matches, or -1 if none or several do
+static int findCommit(Store const *store, char const *prefix) {
+	size_t len = strlen(prefix);
+	char dirty = len && prefix[len - 1] == '+';
+	int found = -1;
+
+	for (size_t i = 0; i < store->commitCount; i++) {
+		char const *name = store->commits[i];
+		size_t nameLen = strlen(name);
+
+		if ((name[nameLen - 1] == '+') != dirty || strncmp(name, prefix, len - dirty))
+			continue;
+		if (found != -1)
+			return -1;
+		found = i;
+	}
+
+	return found;
+}
+
+static Series *findSeries(Store *store, char const *tool, char const *metric) {
+	for (size_t i = 0; i < store->seriesCount; i++)
+		if (!strcmp(store->series[i].tool, tool) && !strcmp(store->series[i].metric, metric))
+			return store->series + i;
+
+	store->series = realloc(store->series, (store->seriesCount + 1) * sizeof *store->series);
+	Series *s = store->series + store->seriesCount++;
+	memset(s, 0, sizeof *s);
+	s->tool = strdup(tool);
+	s->metric = strdup(metric);
+
+	return s;
+}
+
+static void addValue(Series *s, int side, double value) {
+	s->values[side] = realloc(s->values[side], (s->count[side] + 1) * sizeof *s->values[side]);
+	s->values[side][s->count[side]++] = value;
+}
+
+// Reads the store twice: first for the commits on the machine, then, once
+// base and head are known, for their metrics
+static int readStore(Store *store, char const *path, char const *machine, char const *tool, char const *const *names) {
+	FILE *fp = fopen(path, "r");
+	JSONDocument doc;
+	char *line = NULL, name[80];
+	size_t cap = 0;
+
+	if (!fp)
+		return 0;
+
+	initJSONDocument(&doc);
+	while (getline(&line, &cap, fp) > 0) {
+		JSON *json = parseJSONDocument(&doc, line);
+		if (!json)
+			continue;
+
+		JSONContent commit = JSONGetValueForKey("commit", json), dirty = JSONGetValueForKey("dirty", json), runMachine = JSONGetValueForKey("machine", json);
+		JSONContent runTool = JSONGetValueForKey("tool", json), metrics = JSONGetValueForKey("metrics", json);
+		if (commit.type != STRING || runMachine.type != STRING || runTool.type != STRING || metrics.type != OBJECT)
+			continue;
+		if ((machine && strcmp(runMachine.str, machine)) || (tool && strcmp(runTool.str, tool)))
+			continue;
+
+		snprintf(name, sizeof name, "%s%s", commit.str, dirty.type == TRUEORFALSE && dirty.trueorfalse ? "+" : "");
+
+		if (!names) {
+			if (commitIndex(store, name) == -1) {
+				store->commits = realloc(store->commits, (store->commitCount + 1) * sizeof *store->commits);
+				store->commits[store->commitCount++] = strdup(name);
+			}
+			continue;
+		}
+
+		for (int side = 0; side < 2; side++)
+			if (!strcmp(name, names[side]))
+				for (unsigned int i = 0; i < metrics.json->length; i++)
+					if (metrics.json->contents[i].type == NUMBER)
+						addValue(findSeries(store, runTool.str, metrics.json->contents[i].name), side, metrics.json->contents[i].number);
+	}
+
+	freeJSONDocument(&doc);
+	free(line);
+	fclose(fp);
+
+	return 1;
+}
+
+// 1 for a regression, -1 for a change there weren't runs enough to judge
+static int compareSeries(Series *s, double threshold) {
+	enum direction direction = metricDirection(s->metric);
+	double base = median(s->values[0], s->count[0]), head = median(s->values[1], s->count[1]);
+	// From zero, any change is an infinite one, and the interval is of the difference
+	double change = base ? (head - base) / fabs(base) : head > 0 ? INFINITY : head < 0 ? -INFINITY : 0, low = 0, high = 0;
+	char haveInterval = s->count[0] >= MIN_RUNS_FOR_INTERVAL && s->count[1] >= MIN_RUNS_FOR_INTERVAL;
+	char const *verdict = "";
+	int regressed = 0;
+
+	if (haveInterval)
+		bootstrapInterval(s, base != 0, &low, &high);
+
+	if (direction == MUST_NOT_CHANGE) {
+		if (base != head) {
+			verdict = "CHANGED";
+			regressed = 1;
+		}
+	} else if (!haveInterval) {
+		if (fabs(change) > threshold / 100) {
+			verdict = "need >=" STR(MIN_RUNS_FOR_INTERVAL) " runs";
+			regressed = -1;
+		}
+	} else {
+		double better = direction == HIGHER_BETTER ? change : -change;
+		char significant = low > 0 || high < 0; // the interval leaves out no change
+
+		if (better < -threshold / 100 && significant) {
+			verdict = "REGRESSION";
+			regressed = 1;
+		} else if (better > threshold / 100 && significant)
+			verdict = "improved";
+		else if (fabs(change) > threshold / 100)
+			verdict = "noise";
+	}
+
+	printf("%-24.24s %-26.26s %14.6g %3zu %14.6g %3zu %+8.2f%% ", s->tool, s->metric, base, s->count[0], head, s->count[1], change * 100);
+	if (haveInterval && base)
+		printf("[%+7.2f%%, %+7.2f%%] ", low * 100, high * 100);
+	else if (haveInterval)
+		printf("[%+8.3g, %+8.3g] ", low, high);
+	else
+		printf("%20s ", "-");
+	printf("%s\n", verdict);
+
+	return regressed;
+}
+
+static void usage(char const *name) {
+	fprintf(stderr, "Usage: %s [-f results] [-m machine | -a] [-t threshold %%] [-s tool] [base [head]]\n", name);
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	char const *path = benchResultsPath(), *machine = NULL, *tool = NULL;
+	char thisMachine[256], all = 0;
+	double threshold = DEFAULT_THRESHOLD;
+	int opt, sides[2], regressions = 0, unjudged = 0, compared = 0;
+	Store store = {0};
+
+	while ((opt = getopt(argc, argv, "f:m:at:s:")) != -1)
+		switch (opt) {
+			case 'f': path = optarg; break;
+			case 'm': machine = optarg; break;
+			case 'a': all = 1; break;
+			case 't': threshold = atof(optarg); break;
+			case 's': tool = optarg; break;
+			default: usage(argv[0]);
+		}
+
+	if (!path || argc - optind > 2 || !(threshold >= 0))
+		usage(argv[0]);
+
+	if (!machine && !all) {
+		benchMachine(thisMachine, sizeof thisMachine);
+		machine = thisMachine;
+	}
+
+	if (!readStore(&store, path, machine, tool, NULL)) {
+		fprintf(stderr, "Cannot read %s\n", path);
+		return 2;
+	}
+
+	if (argc - optind >= 1)
+		sides[0] = findCommit(&store, argv[optind]);
+	else
+		sides[0] = store.commitCount >= 2 ? (int) store.commitCount - 2 : -1;
+	if (argc - optind == 2)
+		sides[1] = findCommit(&store, argv[optind + 1]);
+	else
+		sides[1] = argc - optind == 1 ? (int) store.commitCount - 1 : store.commitCount >= 2 ? (int) store.commitCount - 1 : -1;
+
+	if (sides[0] == -1 || sides[1] == -1 || sides[0] == sides[1]) {
+		fprintf(stderr, "Need two different commits with runs%s%s; there are %zu:\n", machine ? " on " : "", machine ? machine : "", store.commitCount);
+		for (size_t i = 0; i < store.commitCount; i++)
+			fprintf(stderr, "  %s\n", store.commits[i]);
+		return 2;
+	}
+
+	char const *names[2] = {store.commits[sides[0]], store.commits[sides[1]]};
+	readStore(&store, path, machine, tool, names);
+
+	printf("base %s\nhead %s\n", names[0], names[1]);
+	printf("%-24s %-26s %14s %3s %14s %3s %9s %20s\n", "tool", "metric", "base", "n", "head", "n", "change", "95% interval");
+
+	for (size_t i = 0; i < store.seriesCount; i++)
+		if (store.series[i].count[0] && store.series[i].count[1]) {
+			int verdict = compareSeries(store.series + i, threshold);
+			regressions += verdict == 1;
+			unjudged += verdict == -1;
+			compared++;
+		}
+
+	if (!compared)
+		printf("No metric was run on both\n");
+	else
+		printf("%d regression%s beyond %.1f%%%s\n", regressions, regressions == 1 ? "" : "s", threshold, unjudged ? ", and changes that need more runs to judge" : "");
+
+	return regressions > 0;
+}
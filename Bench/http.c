@@ -0,0 +1,253 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../Util/histogram.h"
+#include "../Util/results.h"
+
+// Closed-loop HTTP/1.1 load generator for Web/server. Every thread keeps its
+// share of the connections busy from its own epoll loop: each connection
+// has up to pipeline requests in flight on a kept-alive socket and sends
+// the next one as soon as an answer comes back. Prints requests/s and the
+// latency of every answer in microseconds, and keeps them in the store of
+// Util/results.h for Bench/compare.
+//
+// Usage: Bench/http [-a address] [-p port] [-c connections] [-t threads]
+//                   [-d seconds] [-P pipeline] [-u path]
+
+#define DEFAULT_ADDRESS "127.0.0.1"
+#define DEFAULT_PORT 8080
+#define MAX_PIPELINE 64
+#define IN_SIZE (1 << 16)
+#define MAX_EVENTS 256
+
+typedef struct Options {
+	struct sockaddr_in addr;
+	unsigned int connections;
+	unsigned int threads;
+	unsigned int seconds;
+	unsigned int pipeline;
+	char request[512];
+	size_t requestLen;
+} Options;
+
+typedef struct Connection {
+	int fd;
+	char in[IN_SIZE];
+	size_t inLen;
+	uint64_t sentAt[MAX_PIPELINE]; // ring of requests in flight, oldest first
+	unsigned int first, inFlight;
+} Connection;
+
+typedef struct Worker {
+	Options const *options;
+	pthread_t thread;
+	unsigned int connections;
+	uint64_t requests;
+	uint64_t errors; // non-200 answers and dropped connections
+	Histogram latency;
+} Worker;
+
+static int openConnection(Worker *worker, int epfd, Connection *conn) {
+	int one = 1;
+
+	conn->inLen = conn->first = conn->inFlight = 0;
+	if ((conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+		return 0;
+
+	setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+	if (connect(conn->fd, (struct sockaddr const *) &worker->options->addr, sizeof worker->options->addr) == -1) {
+		close(conn->fd);
+		return 0;
+	}
+
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = conn};
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, conn->fd, &ev) != -1;
+}
+
+// Requests are tiny, so a blocking send never waits long
+static int sendRequests(Worker *worker, Connection *conn) {
+	Options const *options = worker->options;
+
+	while (conn->inFlight < options->pipeline) {
+		if (send(conn->fd, options->request, options->requestLen, MSG_NOSIGNAL) != (ssize_t) options->requestLen)
+			return 0;
+		conn->sentAt[(conn->first + conn->inFlight++) % MAX_PIPELINE] = monotonicNs();
+	}
+
+	return 1;
+}
+
+// Takes the complete answers off the front of the buffer. Returns 0 if one
+// is malformed.
+static int readAnswers(Worker *worker, Connection *conn) {
+	char *pos = conn->in, *end = conn->in + conn->inLen;
+
+	while (conn->inFlight) {
+		char *headEnd = memmem(pos, end - pos, "\r\n\r\n", 4);
+		if (!headEnd)
+			break;
+
+		char *length = memmem(pos, headEnd - pos, "Content-Length:", 15);
+		if (!length || end - pos < 12)
+			return 0;
+
+		size_t total = headEnd + 4 - pos + strtoul(length + 15, NULL, 10);
+		if ((size_t) (end - pos) < total)
+			break;
+
+		if (memcmp(pos + 9, "200", 3))
+			worker->errors++;
+
+		recordHistogram(&worker->latency, (monotonicNs() - conn->sentAt[conn->first]) / 1000);
+		conn->first = (conn->first + 1) % MAX_PIPELINE;
+		conn->inFlight--;
+		worker->requests++;
+		pos += total;
+	}
+
+	conn->inLen = end - pos;
+	memmove(conn->in, pos, conn->inLen);
+
+	return conn->inLen < IN_SIZE;
+}
+
+static void *runWorker(void *workerPtr) {
+	Worker *worker = workerPtr;
+	Connection *conns = calloc(worker->connections, sizeof *conns);
+	struct epoll_event events[MAX_EVENTS];
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (!conns || epfd == -1) {
+		perror("Cannot start worker");
+		exit(1);
+	}
+
+	for (unsigned int i = 0; i < worker->connections; i++)
+		if (!openConnection(worker, epfd, conns + i) || !sendRequests(worker, conns + i)) {
+			perror("Cannot connect");
+			exit(1);
+		}
+
+	uint64_t stop = monotonicNs() + (uint64_t) worker->options->seconds * 1000000000;
+
+	while (monotonicNs() < stop) {
+		int n = epoll_wait(epfd, events, MAX_EVENTS, 100);
+
+		for (int i = 0; i < n; i++) {
+			Connection *conn = events[i].data.ptr;
+			ssize_t got = recv(conn->fd, conn->in + conn->inLen, IN_SIZE - conn->inLen, MSG_DONTWAIT);
+
+			if (got == -1 && (errno == EAGAIN || errno == EINTR))
+				continue;
+
+			if (got <= 0 || (conn->inLen += got, !readAnswers(worker, conn)) || !sendRequests(worker, conn)) {
+				// The server hung up or misbehaved; whatever was in flight is lost
+				worker->errors += conn->inFlight ? conn->inFlight : 1;
+				close(conn->fd);
+				if (!openConnection(worker, epfd, conn) || !sendRequests(worker, conn)) {
+					perror("Cannot reconnect");
+					exit(1);
+				}
+			}
+		}
+	}
+
+	for (unsigned int i = 0; i < worker->connections; i++)
+		close(conns[i].fd);
+	close(epfd);
+	free(conns);
+
+	return NULL;
+}
+
+static void usage(char const *name) {
+	fprintf(stderr, "Usage: %s [-a address] [-p port] [-c connections] [-t threads] [-d seconds] [-P pipeline] [-u path]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	Options options = {.connections = 64, .threads = 1, .seconds = 5, .pipeline = 1};
+	char const *address = DEFAULT_ADDRESS, *path = "/";
+	unsigned int port = DEFAULT_PORT;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "a:p:c:t:d:P:u:")) != -1)
+		switch (opt) {
+			case 'a': address = optarg; break;
+			case 'p': port = atoi(optarg); break;
+			case 'c': options.connections = atoi(optarg); break;
+			case 't': options.threads = atoi(optarg); break;
+			case 'd': options.seconds = atoi(optarg); break;
+			case 'P': options.pipeline = atoi(optarg); break;
+			case 'u': path = optarg; break;
+			default: usage(argv[0]);
+		}
+
+	if (!options.threads || options.connections < options.threads || !options.pipeline || options.pipeline > MAX_PIPELINE || !options.seconds)
+		usage(argv[0]);
+
+	options.addr.sin_family = AF_INET;
+	options.addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, address, &options.addr.sin_addr) != 1)
+		usage(argv[0]);
+
+	options.requestLen = snprintf(options.request, sizeof options.request, "GET %s HTTP/1.1\r\nHost: %s:%u\r\n\r\n", path, address, port);
+	if (options.requestLen >= sizeof options.request)
+		usage(argv[0]);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	Worker *workers = calloc(options.threads, sizeof *workers);
+	for (unsigned int i = 0; i < options.threads; i++) {
+		workers[i].options = &options;
+		workers[i].connections = options.connections / options.threads + (i < options.connections % options.threads);
+		initHistogram(&workers[i].latency);
+		if (pthread_create(&workers[i].thread, NULL, runWorker, workers + i)) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	Histogram latency;
+	uint64_t requests = 0, errors = 0;
+
+	initHistogram(&latency);
+	for (unsigned int i = 0; i < options.threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		requests += workers[i].requests;
+		errors += workers[i].errors;
+		mergeHistogram(&latency, &workers[i].latency);
+	}
+
+	printf("%u connections, %u threads, pipeline %u, %us: %llu requests, %.0f requests/s, %llu errors\n", options.connections, options.threads, options.pipeline, options.seconds,
+		(unsigned long long) requests, (double) requests / options.seconds, (unsigned long long) errors);
+	printHistogram(stdout, "latency us", &latency);
+
+	BenchMetric metrics[] = {
+		{"requests/s", (double) requests / options.seconds},
+		{"latency p50 us", histogramPercentile(&latency, 50)},
+		{"latency p99 us", histogramPercentile(&latency, 99)},
+		{"errors", errors},
+	};
+	char tool[256];
+
+	snprintf(tool, sizeof tool, "http %s c%u t%u P%u", path, options.connections, options.threads, options.pipeline);
+	if (!recordBenchResults(tool, metrics, sizeof metrics / sizeof *metrics))
+		fprintf(stderr, "Cannot record the results in %s\n", benchResultsPath());
+
+	free(workers);
+
+	return 0;
+}
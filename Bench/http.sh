@@ -0,0 +1,22 @@
+#!/bin/sh
+# Requests/s of Web/server for every worker count from 1 to max (the number
+# of cores by default), driven by Bench/http. Build both first with
+# `make Bot bench-http`; the remaining arguments go to Bench/http.
+#
+# Usage: Bench/http.sh [max workers] [Bench/http options]
+
+MAX=${1:-$(nproc)}
+[ $# -gt 0 ] && shift
+PORT=${PORT:-18080}
+
+for WORKERS in $(seq 1 "$MAX"); do
+	WORKERS=$WORKERS PORT=$PORT LOG_LEVEL=warn Web/server &
+	SERVER=$!
+	sleep 0.5
+
+	printf 'workers %s: ' "$WORKERS"
+	Bench/http -p "$PORT" "$@"
+
+	kill "$SERVER"
+	wait "$SERVER" 2>/dev/null || true
+done
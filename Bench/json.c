@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Every allocation made by the parsers goes through these counters
+static size_t allocations;
+
+static void *countedMalloc(size_t size) {
+	allocations++;
+	return malloc(size);
+}
+
+static void *countedRealloc(void *ptr, size_t size) {
+	allocations++;
+	return realloc(ptr, size);
+}
+
+#define malloc(size) countedMalloc(size)
+#define realloc(ptr, size) countedRealloc(ptr, size)
+
+#include "../JSON Parser/JSON.h"
+#include "../Lichess/events.h"
+
+#undef malloc
+#undef realloc
+
+// Parse throughput and allocations per document of parseJSON, the arena
+// backed parseJSONDocument and the gameFull/gameState decoder, on recorded
+// lichess events (one per line, Bench/corpus/lichess.ndjson by default) and
+// on synthetic large documents.
+//
+// Usage: Bench/json [corpus.ndjson]
+
+#define DEFAULT_CORPUS "Bench/corpus/lichess.ndjson"
+#define MIN_SECONDS 0.5
+
+typedef struct Corpus {
+	char **docs;
+	size_t *lens;
+	size_t count;
+	size_t bytes;
+} Corpus;
+
+static void addDocument(Corpus *corpus, char *doc, size_t len) {
+	corpus->docs = realloc(corpus->docs, (corpus->count + 1) * sizeof *corpus->docs);
+	corpus->lens = realloc(corpus->lens, (corpus->count + 1) * sizeof *corpus->lens);
+	corpus->docs[corpus->count] = doc;
+	corpus->lens[corpus->count++] = len;
+	corpus->bytes += len;
+}
+
+static int loadCorpus(Corpus *corpus, char const *path) {
+	FILE *fp = fopen(path, "r");
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+
+	if (!fp)
+		return 0;
+
+	while ((len = getline(&line, &cap, fp)) > 0) {
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = 0;
+		if (len)
+			addDocument(corpus, strcpy(malloc(len + 1), line), len);
+	}
+
+	free(line);
+	fclose(fp);
+
+	return 1;
+}
+
+static void freeCorpus(Corpus *corpus) {
+	for (size_t i = 0; i < corpus->count; i++)
+		free(corpus->docs[i]);
+	free(corpus->docs);
+	free(corpus->lens);
+}
+
+// One object with thousands of members of every type
+static char *syntheticWide(unsigned int members) {
+	size_t cap = members * 64 + 16, len = 0;
+	char *doc = malloc(cap);
+
+	len += sprintf(doc + len, "{");
+	for (unsigned int i = 0; i < members; i++)
+		switch (i % 5) {
+			case 0: len += sprintf(doc + len, "%s\"key%u\":\"value number %u\"", i ? "," : "", i, i); break;
+			case 1: len += sprintf(doc + len, ",\"key%u\":%u.%u", i, i * 7, i % 100); break;
+			case 2: len += sprintf(doc + len, ",\"key%u\":%s", i, i % 2 ? "true" : "false"); break;
+			case 3: len += sprintf(doc + len, ",\"key%u\":null", i); break;
+			case 4: len += sprintf(doc + len, ",\"key%u\":{\"id\":\"user%u\",\"rating\":%u}", i, i, 1500 + i % 700); break;
+		}
+	sprintf(doc + len, "}");
+
+	return doc;
+}
+
+// Nested arrays and objects, as in a large API listing
+static char *syntheticNested(unsigned int items) {
+	size_t cap = items * 160 + 32, len = 0;
+	char *doc = malloc(cap);
+
+	len += sprintf(doc + len, "{\"games\":[");
+	for (unsigned int i = 0; i < items; i++)
+		len += sprintf(doc + len, "%s{\"id\":\"g%07u\",\"players\":[{\"id\":\"a%u\",\"rating\":%u},{\"id\":\"b%u\",\"rating\":%u}],\"clock\":[%u,%u,%u],\"rated\":%s}", i ? "," : "", i, i, 1200 + i % 900, i, 1300 + i % 800, i, i * 2, i * 3, i % 2 ? "true" : "false");
+	sprintf(doc + len, "]}");
+
+	return doc;
+}
+
+// A gameState late in a very long game
+static char *syntheticLongGame(unsigned int plies) {
+	static char const *cycle[] = {"g1f3", "g8f6", "f3g1", "f6g8"};
+	size_t len = 0;
+	char *doc = malloc(plies * 5 + 256);
+
+	len += sprintf(doc + len, "{\"type\":\"gameState\",\"moves\":\"");
+	for (unsigned int i = 0; i < plies; i++)
+		len += sprintf(doc + len, i ? " %s" : "%s", cycle[i % 4]);
+	sprintf(doc + len, "\",\"wtime\":61000,\"btime\":59000,\"winc\":1000,\"binc\":1000,\"status\":\"started\"}");
+
+	return doc;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+enum parser {PARSE_JSON, PARSE_JSON_DOCUMENT, DECODE_GAME_EVENT};
+static char const *parserNames[] = {"parseJSON", "parseJSONDocument", "decodeGameEvent"};
+
+static void run(char const *name, Corpus const *corpus, enum parser parser) {
+	JSONDocument doc;
+	volatile size_t sink = 0;
+	size_t rounds = 0;
+	double start = now(), elapsed;
+
+	initJSONDocument(&doc);
+	allocations = 0;
+
+	do {
+		for (size_t i = 0; i < corpus->count; i++)
+			switch (parser) {
+				case PARSE_JSON: {
+					JSON *json = NULL;
+					parseJSON(corpus->docs[i], &json);
+					sink += json->length;
+					freeJSON(json);
+				} break;
+				case PARSE_JSON_DOCUMENT: {
+					JSON *json = parseJSONDocument(&doc, corpus->docs[i]);
+					sink += json ? json->length : 0;
+				} break;
+				case DECODE_GAME_EVENT: {
+					GameEvent ev;
+					sink += decodeGameEvent(corpus->docs[i], corpus->lens[i], &ev);
+				} break;
+			}
+		rounds++;
+	} while ((elapsed = now() - start) < MIN_SECONDS);
+
+	printf("%-16s %-18s %9.1f MB/s %10.0f ns/doc %8.2f allocs/doc\n", name, parserNames[parser], corpus->bytes * rounds / elapsed / 1e6, elapsed / (rounds * corpus->count) * 1e9, (double) allocations / (rounds * corpus->count));
+
+	freeJSONDocument(&doc);
+}
+
+int main(int argc, char **argv) {
+	char const *path = argc > 1 ? argv[1] : DEFAULT_CORPUS;
+	Corpus events = {0}, wide = {0}, nested = {0}, longGame = {0};
+	char *doc;
+
+	if (!loadCorpus(&events, path) || !events.count) {
+		fprintf(stderr, "Cannot read corpus %s\n", path);
+		return -1;
+	}
+
+	doc = syntheticWide(20000);
+	addDocument(&wide, doc, strlen(doc));
+	doc = syntheticNested(5000);
+	addDocument(&nested, doc, strlen(doc));
+	doc = syntheticLongGame(600);
+	addDocument(&longGame, doc, strlen(doc));
+
+	printf("corpus: %zu events, %zu bytes; wide: %zu bytes; nested: %zu bytes; long game: %zu bytes\n", events.count, events.bytes, wide.bytes, nested.bytes, longGame.bytes);
+
+	for (enum parser p = PARSE_JSON; p <= DECODE_GAME_EVENT; p++)
+		run("lichess events", &events, p);
+	for (enum parser p = PARSE_JSON; p <= PARSE_JSON_DOCUMENT; p++)
+		run("synthetic wide", &wide, p);
+	for (enum parser p = PARSE_JSON; p <= PARSE_JSON_DOCUMENT; p++)
+		run("synthetic nested", &nested, p);
+	for (enum parser p = PARSE_JSON; p <= DECODE_GAME_EVENT; p++)
+		run("long game", &longGame, p);
+
+	freeCorpus(&events);
+	freeCorpus(&wide);
+	freeCorpus(&nested);
+	freeCorpus(&longGame);
+
+	return 0;
+}
@@ -0,0 +1,887 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include "../Chess/basics.h"
+#include "../Util/histogram.h"
+
+// Plays two UCI engines (say two builds of Uci) against each other to tell
+// whether one is stronger. Games run concurrently, each slot on its own
+// thread with a process of each engine. A pair of games is played from
+// every opening, one with each colour. Openings come shuffled from an EPD
+// file (a FEN per line), a PGN file (the moves of every game), or, without
+// either, a few random plies from the start. The engines play on a clock.
+// The runner adjudicates the games itself with Chess/basics.h: mate,
+// stalemate, the fifty-move rule, threefold repetition, bare kings or a
+// lone minor piece, and a ply limit. An illegal move, a flag fall or a
+// crash loses.
+//
+// After every game it updates the first engine's Elo and the sequential
+// probability ratio test of elo0 against elo1. It stops as soon as the test
+// accepts either, or when it runs out of games. The test approximates the
+// trinomial (win/draw/loss) log-likelihood ratio with a normal one, as
+// fishtest's does.
+//
+// Usage: Bench/match [-c concurrency] [-t seconds+increment] [-o openings]
+//                    [-r random plies] [-g max games] [-e elo0,elo1]
+//                    [-a alpha,beta] [-p max plies] [-s seed] engine1 engine2
+//
+// Engines are shell commands, e.g. Bench/match ./Uci ../baseline/Uci.
+
+#define DEFAULT_TC_MS 10000
+#define DEFAULT_INC_MS 100
+#define DEFAULT_RANDOM_PLIES 8
+#define DEFAULT_MAX_GAMES 20000
+#define DEFAULT_MAX_PLIES 400
+#define TIME_MARGIN_MS 100 // late answers this close to a flag fall are let off
+#define START_TIMEOUT_MS 10000
+#define ENGINE_LINE 65536
+#define MAX_FEN 128
+#define MAX_SLOTS 256
+#define LLR_PRIOR_GAMES 0.5 // of each outcome
+
+typedef struct Engine {
+	char const *command;
+	pid_t pid; // 0 while not running
+	int in, out; // its stdin and stdout
+	char buf[ENGINE_LINE];
+	size_t len;
+} Engine;
+
+typedef struct Opening {
+	char fen[MAX_FEN];
+	char *moves; // UCI, space separated, from fen
+} Opening;
+
+typedef struct Position {
+	uint64_t board[4];
+	uint64_t prevBoard[4];
+	char brkrwrkr00;
+	char whiteToMove;
+	unsigned int halfmoves; // since the last capture or pawn move
+} Position;
+
+enum outcome {WIN, DRAW, LOSS}; // for the first engine
+enum ending {MATE, STALEMATE, FIFTY_MOVES, REPETITION, MATERIAL, PLY_LIMIT, ON_TIME, ILLEGAL_MOVE, CRASH, ENDING_COUNT};
+static char const *endingNames[ENDING_COUNT] = {"mate", "stalemate", "fifty moves", "repetition", "material", "ply limit", "time", "illegal move", "crash"};
+
+typedef struct Options {
+	char const *engines[2];
+	unsigned int concurrency;
+	long timeMs, incrementMs;
+	unsigned int maxGames;
+	unsigned int maxPlies;
+	double elo0, elo1, alpha, beta;
+} Options;
+
+typedef struct Match {
+	Options const *options;
+	Opening *openings;
+	size_t openingCount;
+
+	pthread_mutex_t lock;
+	unsigned int started; // games handed out
+	unsigned int results[3]; // by outcome
+	unsigned int endings[ENDING_COUNT];
+	char done; // the test decided or the games ran out
+	char const *failed; // an engine that would not restart, which ends the match
+} Match;
+
+typedef struct Slot {
+	Match *match;
+	pthread_t thread;
+	Engine engines[2];
+} Slot;
+
+// --- engines --------------------------------------------------------------
+
+static void stopEngine(Engine *engine) {
+	if (!engine->pid)
+		return;
+
+	if (write(engine->in, "quit\n", 5) < 0) {} // it may be gone already
+	close(engine->in);
+	close(engine->out);
+
+	// A moment to quit on its own before it's killed
+	for (int i = 0; i < 50 && !waitpid(engine->pid, NULL, WNOHANG); i++)
+		usleep(2000);
+	if (!kill(engine->pid, SIGKILL))
+		waitpid(engine->pid, NULL, 0);
+
+	engine->pid = 0;
+}
+
+static int sendEngine(Engine *engine, char const *fmt, ...) __attribute__((format(printf, 2, 3)));
+static int sendEngine(Engine *engine, char const *fmt, ...) {
+	char line[ENGINE_LINE];
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(line, sizeof line - 1, fmt, args);
+	va_end(args);
+	if (len < 0 || len >= (int) sizeof line - 1)
+		return 0;
+	line[len++] = '\n';
+
+	for (int sent = 0, n; sent < len; sent += n)
+		if ((n = write(engine->in, line + sent, len - sent)) <= 0)
+			return 0;
+
+	return 1;
+}
+
+// The next line the engine prints, within timeoutMs (-1 for no limit).
+// Returns 1 with the line in out, 0 on timeout and -1 if the engine is gone.
+static int readEngine(Engine *engine, char *out, size_t size, long timeoutMs) {
+	uint64_t deadline = timeoutMs >= 0 ? monotonicNs() + (uint64_t) timeoutMs * 1000000 : 0;
+
+	while (1) {
+		char *end = memchr(engine->buf, '\n', engine->len);
+
+		if (end) {
+			size_t len = end - engine->buf;
+			size_t copy = len < size - 1 ? len : size - 1;
+
+			memcpy(out, engine->buf, copy);
+			out[copy] = 0;
+			if (copy && out[copy - 1] == '\r')
+				out[copy - 1] = 0;
+			engine->len -= len + 1;
+			memmove(engine->buf, end + 1, engine->len);
+			return 1;
+		}
+
+		// A line longer than the buffer is of no use to us
+		if (engine->len == sizeof engine->buf)
+			engine->len = 0;
+
+		int wait = -1;
+		if (deadline) {
+			uint64_t now = monotonicNs();
+			if (now >= deadline)
+				return 0;
+			wait = (deadline - now + 999999) / 1000000;
+		}
+
+		struct pollfd in = {.fd = engine->out, .events = POLLIN};
+		int ready = poll(&in, 1, wait);
+		if (ready < 0 && errno != EINTR)
+			return -1;
+		if (ready <= 0)
+			continue;
+
+		ssize_t got = read(engine->out, engine->buf + engine->len, sizeof engine->buf - engine->len);
+		if (got <= 0)
+			return -1;
+		engine->len += got;
+	}
+}
+
+// Reads until a line starting with prefix; 0 on timeout or if the engine is gone
+static int awaitEngine(Engine *engine, char const *prefix, char *line, size_t size, long timeoutMs) {
+	uint64_t deadline = monotonicNs() + (uint64_t) timeoutMs * 1000000;
+
+	while (1) {
+		uint64_t now = monotonicNs();
+		if (now >= deadline || readEngine(engine, line, size, (deadline - now) / 1000000) != 1)
+			return 0;
+		if (!strncmp(line, prefix, strlen(prefix)))
+			return 1;
+	}
+}
+
+static int startEngine(Engine *engine) {
+	int toEngine[2], fromEngine[2];
+	char line[ENGINE_LINE];
+
+	if (pipe2(toEngine, O_CLOEXEC))
+		return 0;
+	if (pipe2(fromEngine, O_CLOEXEC)) {
+		close(toEngine[0]);
+		close(toEngine[1]);
+		return 0;
+	}
+
+	if (!(engine->pid = fork())) {
+		dup2(toEngine[0], STDIN_FILENO);
+		dup2(fromEngine[1], STDOUT_FILENO);
+		execl("/bin/sh", "sh", "-c", engine->command, (char *) NULL);
+		_exit(127);
+	}
+
+	close(toEngine[0]);
+	close(fromEngine[1]);
+	engine->in = toEngine[1];
+	engine->out = fromEngine[0];
+	engine->len = 0;
+
+	if (engine->pid < 0) {
+		close(engine->in);
+		close(engine->out);
+		engine->pid = 0;
+		return 0;
+	}
+
+	if (!sendEngine(engine, "uci") || !awaitEngine(engine, "uciok", line, sizeof line, START_TIMEOUT_MS)) {
+		stopEngine(engine);
+		return 0;
+	}
+
+	return 1;
+}
+
+// Running and ready for a new game, restarted if it has to be
+static int readyEngine(Engine *engine) {
+	char line[ENGINE_LINE];
+
+	for (int attempt = 0; attempt < 2; attempt++) {
+		if (!engine->pid && !startEngine(engine))
+			continue;
+		if (sendEngine(engine, "ucinewgame") && sendEngine(engine, "isready") && awaitEngine(engine, "readyok", line, sizeof line, START_TIMEOUT_MS))
+			return 1;
+		stopEngine(engine);
+	}
+
+	return 0;
+}
+
+// --- positions ------------------------------------------------------------
+
+static char setPosition(Position *pos, char const *fen) {
+	char const *clock = fen;
+
+	if (!setBoardFromFen(pos->board, pos->prevBoard, &pos->brkrwrkr00, &pos->whiteToMove, fen, strlen(fen)))
+		return 0;
+
+	// The halfmove clock is the fifth field
+	for (int field = 0; field < 4 && clock; field++)
+		if ((clock = strchr(clock, ' ')))
+			clock++;
+	pos->halfmoves = clock ? atoi(clock) : 0;
+
+	return 1;
+}
+
+static void playMove(Position *pos, char const *move) {
+	unsigned char from = accessBoardAt(pos->board, move[0]), to = accessBoardAt(pos->board, move[1]);
+
+	pos->halfmoves = (from | 1) == PAWN_W || to ? 0 : pos->halfmoves + 1;
+	memcpy(pos->prevBoard, pos->board, sizeof pos->board);
+	makeForcedMove(pos->board, &pos->brkrwrkr00, move);
+	pos->whiteToMove = !pos->whiteToMove;
+}
+
+// The legal move uci names, or NULL; free it
+static char *findUciMove(Position const *pos, char const *uci) {
+	char *moves = NULL, *found = NULL;
+	unsigned long len = validMoves(pos->board, pos->prevBoard, pos->brkrwrkr00, pos->whiteToMove, &moves);
+
+	for (unsigned long i = 0; i < len && !found; i += 3) {
+		char *name = indicesToUci(moves + i);
+		if (!strcmp(name, uci))
+			found = memcpy(malloc(3), moves + i, 3);
+		free(name);
+	}
+
+	free(moves);
+	return found;
+}
+
+// The legal move a SAN names (as PGN movetext has them), or NULL; free it
+static char *findSanMove(Position const *pos, char const *san) {
+	char text[16], *moves = NULL, *found = NULL;
+	size_t len = strcspn(san, "+#!?");
+	unsigned char piece = PAWN_W, promotion = 0;
+	int fromFile = -1, fromRank = -1, to;
+
+	if (len < 2 || len >= sizeof text)
+		return NULL;
+	memcpy(text, san, len);
+	text[len] = 0;
+
+	if (!strcmp(text, "O-O") || !strcmp(text, "0-0") || !strcmp(text, "O-O-O") || !strcmp(text, "0-0-0")) {
+		char castle[5] = {'e', pos->whiteToMove ? '1' : '8', len == 3 ? 'g' : 'c', pos->whiteToMove ? '1' : '8', 0};
+		return findUciMove(pos, castle);
+	}
+
+	if (len > 2 && text[len - 2] == '=') {
+		promotion = notationToWhitePiece(text[len - 1]);
+		text[len -= 2] = 0;
+	} else if (len > 2 && strchr("QRBN", text[len - 1])) {
+		promotion = notationToWhitePiece(text[len - 1]);
+		text[--len] = 0;
+	}
+
+	if (len < 2 || text[len - 2] < 'a' || text[len - 2] > 'h' || text[len - 1] < '1' || text[len - 1] > '8')
+		return NULL;
+	to = chessPosToIndex(text + len - 2);
+
+	char const *p = text;
+	if (strchr("KQRBN", *p))
+		piece = notationToWhitePiece(*p++);
+	for (; p < text + len - 2; p++)
+		if (*p >= 'a' && *p <= 'h')
+			fromFile = *p - 'a';
+		else if (*p >= '1' && *p <= '8')
+			fromRank = 8 - (*p - '0');
+		else if (*p != 'x')
+			return NULL;
+
+	unsigned long count = validMoves(pos->board, pos->prevBoard, pos->brkrwrkr00, pos->whiteToMove, &moves);
+	for (unsigned long i = 0; i < count; i += 3) {
+		char const *m = moves + i;
+
+		if (m[1] != to || (accessBoardAt(pos->board, m[0]) | 1) != piece || (unsigned char) (m[2] | (m[2] ? 1 : 0)) != promotion)
+			continue;
+		if ((fromFile != -1 && m[0] % 8 != fromFile) || (fromRank != -1 && m[0] / 8 != fromRank))
+			continue;
+
+		// Ambiguous
+		if (found) {
+			free(found);
+			found = NULL;
+			break;
+		}
+		found = memcpy(malloc(3), m, 3);
+	}
+
+	free(moves);
+	return found;
+}
+
+static char insufficientMaterial(uint64_t const *board) {
+	int minors = 0;
+
+	for (unsigned char i = 0; i < 64; i++)
+		switch (accessBoardAt(board, i) | 1) {
+			case BLANK | 1: case KING_W: break;
+			case KNIGHT_W: case BISHOP_W: minors++; break;
+			default: return 0;
+		}
+
+	return minors <= 1;
+}
+
+// --- openings -------------------------------------------------------------
+
+static void addOpening(Match *match, char const *fen, char const *moves) {
+	Opening *opening;
+
+	match->openings = realloc(match->openings, (match->openingCount + 1) * sizeof *match->openings);
+	opening = match->openings + match->openingCount++;
+	snprintf(opening->fen, sizeof opening->fen, "%s", fen);
+	opening->moves = strdup(moves);
+}
+
+static char const startFen[] = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+// Appends the uci of move to moves, a malloc'd string
+static void appendMove(char **moves, size_t *len, char const *move) {
+	char *uci = indicesToUci(move);
+
+	*moves = realloc(*moves, *len + 7);
+	*len += sprintf(*moves + *len, *len ? " %s" : "%s", uci);
+	free(uci);
+}
+
+// The movetext of one game, from its [FEN] or the start
+static void addPgnGame(Match *match, char const *fen, char *text) {
+	Position pos;
+	char *moves = calloc(1, 1), *save;
+	size_t len = 0;
+
+	if (!setPosition(&pos, fen)) {
+		free(moves);
+		return;
+	}
+
+	for (char *token = strtok_r(text, " \t\r\n", &save); token; token = strtok_r(NULL, " \t\r\n", &save)) {
+		char *move;
+
+		// Move numbers, results and annotations
+		while (*token >= '0' && *token <= '9' && strchr(token, '.'))
+			token = strchr(token, '.') + 1;
+		while (*token == '.')
+			token++;
+		if (!*token || *token == '$' || !strcmp(token, "*") || !strcmp(token, "1-0") || !strcmp(token, "0-1") || !strcmp(token, "1/2-1/2"))
+			continue;
+
+		if (!(move = findSanMove(&pos, token)))
+			break;
+		appendMove(&moves, &len, move);
+		playMove(&pos, move);
+		free(move);
+	}
+
+	addOpening(match, fen, moves);
+	free(moves);
+}
+
+// Comments and variations out, in place
+static void stripPgnComments(char *text) {
+	int depth = 0;
+	char comment = 0;
+
+	for (char *p = text; *p; p++) {
+		char c = *p;
+
+		if (comment)
+			comment = c != '}';
+		else if (c == '{')
+			comment = 1;
+		else if (c == '(')
+			depth++;
+		else if (c == ')' && depth)
+			depth--;
+		else if (!depth)
+			continue;
+		*p = ' ';
+	}
+}
+
+static int loadOpenings(Match *match, char const *path) {
+	FILE *fp = fopen(path, "r");
+	char *line = NULL, *text = NULL, fen[MAX_FEN];
+	size_t cap = 0, textLen = 0;
+	ssize_t len;
+	char pgn = 0;
+
+	if (!fp)
+		return 0;
+
+	strcpy(fen, startFen);
+	while ((len = getline(&line, &cap, fp)) > 0) {
+		line[strcspn(line, "\r\n")] = 0;
+
+		if (*line == '[') {
+			pgn = 1;
+			// Tags start the next game, so the one before is complete
+			if (textLen) {
+				stripPgnComments(text);
+				addPgnGame(match, fen, text);
+				textLen = 0;
+				strcpy(fen, startFen);
+			}
+			if (!strncmp(line, "[FEN \"", 6))
+				snprintf(fen, sizeof fen, "%.*s", (int) strcspn(line + 6, "\""), line + 6);
+		} else if (pgn) {
+			text = realloc(text, textLen + strlen(line) + 2);
+			textLen += sprintf(text + textLen, "%s ", line);
+		} else if (*line) {
+			// EPD: placement, side, castling and en passant, then operations
+			char epd[MAX_FEN];
+			char const *p = line;
+			for (int field = 0; field < 4 && p; field++)
+				if ((p = strchr(p, ' ')))
+					p++;
+			snprintf(epd, sizeof epd, "%.*s 0 1", (int) (p ? p - 1 - line : (long) strlen(line)), line);
+			addOpening(match, epd, "");
+		}
+	}
+
+	if (textLen) {
+		stripPgnComments(text);
+		addPgnGame(match, fen, text);
+	}
+
+	free(text);
+	free(line);
+	fclose(fp);
+
+	return match->openingCount > 0;
+}
+
+static void randomOpenings(Match *match, unsigned int count, unsigned int plies, unsigned int *seed) {
+	for (unsigned int i = 0; i < count; i++) {
+		Position pos;
+		char *moves = calloc(1, 1);
+		size_t len = 0;
+
+		setPosition(&pos, startFen);
+		for (unsigned int ply = 0; ply < plies; ply++) {
+			char *legal = NULL;
+			unsigned long n = validMoves(pos.board, pos.prevBoard, pos.brkrwrkr00, pos.whiteToMove, &legal) / 3;
+
+			if (!n) {
+				free(legal);
+				break;
+			}
+			char const *move = legal + rand_r(seed) % n * 3;
+			appendMove(&moves, &len, move);
+			playMove(&pos, move);
+			free(legal);
+		}
+
+		addOpening(match, startFen, moves);
+		free(moves);
+	}
+}
+
+// --- games ----------------------------------------------------------------
+
+typedef struct History {
+	uint64_t (*keys)[5]; // board and the rest, for every position of the game
+	size_t count, cap;
+} History;
+
+static unsigned int repetitions(History *history, Position const *pos) {
+	uint64_t key[5];
+	unsigned int seen = 0;
+
+	memcpy(key, pos->board, 4 * sizeof *key);
+	key[4] = (uint64_t) pos->whiteToMove << 8 | (unsigned char) pos->brkrwrkr00;
+
+	for (size_t i = 0; i < history->count; i++)
+		seen += !memcmp(history->keys[i], key, sizeof key);
+
+	if (history->count == history->cap) {
+		history->cap = history->cap ? 2 * history->cap : 128;
+		history->keys = realloc(history->keys, history->cap * sizeof *history->keys);
+	}
+	memcpy(history->keys[history->count++], key, sizeof key);
+
+	return seen + 1;
+}
+
+// Plays one game; engines[white] has white. Returns the outcome for
+// engines[0] and sets ending.
+static enum outcome playGame(Slot *slot, Opening const *opening, int white, enum ending *ending) {
+	Options const *options = slot->match->options;
+	Position pos;
+	History history = {0};
+	size_t movesLen = strlen(opening->moves), movesCap = movesLen + 1024;
+	char *moves = malloc(movesCap), *line = malloc(ENGINE_LINE), *save;
+	long clocks[2] = {options->timeMs, options->timeMs}; // by colour: black, white
+	enum outcome outcome = DRAW;
+	int loser = -1; // engine index
+
+	strcpy(moves, opening->moves);
+	setPosition(&pos, opening->fen);
+	char *replay = strdup(opening->moves);
+	for (char *uci = strtok_r(replay, " ", &save); uci; uci = strtok_r(NULL, " ", &save)) {
+		char *move = findUciMove(&pos, uci);
+		if (!move)
+			break;
+		playMove(&pos, move);
+		free(move);
+	}
+	free(replay);
+
+	for (unsigned int ply = 0;; ply++) {
+		char *legal = NULL;
+		unsigned long count = validMoves(pos.board, pos.prevBoard, pos.brkrwrkr00, pos.whiteToMove, &legal);
+		free(legal);
+
+		int mover = pos.whiteToMove ? white : !white;
+
+		if (!count) {
+			if (isCheckOnKing(pos.board, pos.whiteToMove)) {
+				*ending = MATE;
+				loser = mover;
+			} else
+				*ending = STALEMATE;
+			break;
+		}
+		if (pos.halfmoves >= 100) {
+			*ending = FIFTY_MOVES;
+			break;
+		}
+		if (repetitions(&history, &pos) >= 3) {
+			*ending = REPETITION;
+			break;
+		}
+		if (insufficientMaterial(pos.board)) {
+			*ending = MATERIAL;
+			break;
+		}
+		if (ply >= options->maxPlies) {
+			*ending = PLY_LIMIT;
+			break;
+		}
+
+		Engine *engine = slot->engines + mover;
+		long *clock = clocks + pos.whiteToMove;
+		uint64_t start = monotonicNs();
+
+		if (!sendEngine(engine, "position fen %s%s%s", opening->fen, movesLen ? " moves " : "", moves)
+			|| !sendEngine(engine, "go wtime %ld btime %ld winc %ld binc %ld", clocks[1], clocks[0], options->incrementMs, options->incrementMs)) {
+			*ending = CRASH;
+			loser = mover;
+			stopEngine(engine);
+			break;
+		}
+
+		int got;
+		do {
+			// Past the flag, only lines already in are read
+			long left = *clock + TIME_MARGIN_MS - (long) ((monotonicNs() - start) / 1000000);
+			got = readEngine(engine, line, ENGINE_LINE, left > 0 ? left : 0);
+		} while (got == 1 && strncmp(line, "bestmove ", 9));
+
+		*clock -= (monotonicNs() - start) / 1000000;
+		if (got != 1) {
+			*ending = got ? CRASH : ON_TIME;
+			loser = mover;
+			// It may still answer, but too late for this game
+			stopEngine(engine);
+			break;
+		}
+		if (*clock < -TIME_MARGIN_MS) {
+			*ending = ON_TIME;
+			loser = mover;
+			break;
+		}
+		*clock = (*clock > 0 ? *clock : 0) + options->incrementMs;
+
+		char uci[8];
+		snprintf(uci, sizeof uci, "%.*s", (int) strcspn(line + 9, " "), line + 9);
+		char *move = findUciMove(&pos, uci);
+		if (!move) {
+			*ending = ILLEGAL_MOVE;
+			loser = mover;
+			break;
+		}
+
+		if (movesLen + 8 > movesCap)
+			moves = realloc(moves, movesCap *= 2);
+		movesLen += sprintf(moves + movesLen, movesLen ? " %s" : "%s", uci);
+		playMove(&pos, move);
+		free(move);
+	}
+
+	if (loser != -1)
+		outcome = loser ? WIN : LOSS;
+
+	free(history.keys);
+	free(moves);
+	free(line);
+
+	return outcome;
+}
+
+// --- statistics -----------------------------------------------------------
+
+static double eloToScore(double elo) {
+	return 1 / (1 + pow(10, -elo / 400));
+}
+
+static double scoreToElo(double score) {
+	return -400 * log10(1 / score - 1);
+}
+
+// Score per game and its variance, from the first engine's side, counting
+// prior games on top of the results
+static void scoreStats(unsigned int const *results, double prior, double *score, double *variance) {
+	double w = results[WIN] + prior, d = results[DRAW] + prior, l = results[LOSS] + prior, n = w + d + l;
+	double s = (w + d / 2) / n;
+
+	*score = s;
+	*variance = (w * (1 - s) * (1 - s) + d * (0.5 - s) * (0.5 - s) + l * s * s) / n;
+}
+
+// With half a game of each outcome added, so the variance of a one-sided run
+// (all wins, say) isn't 0 and its ratio grows instead of staying at 0
+static double logLikelihoodRatio(unsigned int const *results, double elo0, double elo1) {
+	double n = results[WIN] + results[DRAW] + results[LOSS], s, variance;
+	double s0 = eloToScore(elo0), s1 = eloToScore(elo1);
+
+	if (!n)
+		return 0;
+	scoreStats(results, LLR_PRIOR_GAMES, &s, &variance);
+
+	return n * (s1 - s0) * (2 * s - s0 - s1) / (2 * variance);
+}
+
+static void printStatus(Match const *match, FILE *fp) {
+	Options const *options = match->options;
+	unsigned int const *r = match->results;
+	unsigned int n = r[WIN] + r[DRAW] + r[LOSS];
+	double s, variance, llr = logLikelihoodRatio(r, options->elo0, options->elo1);
+	double lower = log(options->beta / (1 - options->alpha)), upper = log((1 - options->beta) / options->alpha);
+
+	scoreStats(r, 0, &s, &variance);
+
+	double margin = 1.96 * sqrt(variance / n);
+	fprintf(fp, "Games %u: +%u -%u =%u, score %.1f%%", n, r[WIN], r[LOSS], r[DRAW], s * 100);
+	if (s > 0 && s < 1 && s - margin > 0 && s + margin < 1)
+		fprintf(fp, ", Elo %.1f +/- %.1f", scoreToElo(s), (scoreToElo(s + margin) - scoreToElo(s - margin)) / 2);
+	fprintf(fp, ", LLR %.2f [%.2f, %.2f]\n", llr, lower, upper);
+}
+
+// --- match ----------------------------------------------------------------
+
+static void *runSlot(void *slotPtr) {
+	Slot *slot = slotPtr;
+	Match *match = slot->match;
+	Options const *options = match->options;
+
+	while (1) {
+		pthread_mutex_lock(&match->lock);
+		if (match->done || match->started >= options->maxGames) {
+			pthread_mutex_unlock(&match->lock);
+			break;
+		}
+		unsigned int game = match->started++;
+		pthread_mutex_unlock(&match->lock);
+
+		Opening const *opening = match->openings + game / 2 % match->openingCount;
+		enum ending ending;
+		enum outcome outcome;
+
+		// An engine that can't be started says nothing about its strength
+		for (int i = 0; i < 2; i++)
+			if (!readyEngine(slot->engines + i)) {
+				pthread_mutex_lock(&match->lock);
+				match->done = 1;
+				match->failed = options->engines[i];
+				pthread_mutex_unlock(&match->lock);
+				goto stop;
+			}
+
+		outcome = playGame(slot, opening, game % 2, &ending);
+
+		pthread_mutex_lock(&match->lock);
+		match->results[outcome]++;
+		match->endings[ending]++;
+
+		double llr = logLikelihoodRatio(match->results, options->elo0, options->elo1);
+		if (llr <= log(options->beta / (1 - options->alpha)) || llr >= log((1 - options->beta) / options->alpha))
+			match->done = 1;
+
+		printStatus(match, stdout);
+		fflush(stdout);
+		pthread_mutex_unlock(&match->lock);
+	}
+
+stop:
+	stopEngine(slot->engines);
+	stopEngine(slot->engines + 1);
+
+	return NULL;
+}
+
+static void usage(char const *name) {
+	fprintf(stderr, "Usage: %s [-c concurrency] [-t seconds+increment] [-o openings.epd|pgn] [-r random plies] [-g max games] [-e elo0,elo1] [-a alpha,beta] [-p max plies] [-s seed] engine1 engine2\n", name);
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	Options options = {.concurrency = cores > 0 ? cores : 1, .timeMs = DEFAULT_TC_MS, .incrementMs = DEFAULT_INC_MS, .maxGames = DEFAULT_MAX_GAMES, .maxPlies = DEFAULT_MAX_PLIES,
+		.elo0 = 0, .elo1 = 5, .alpha = 0.05, .beta = 0.05};
+	char const *openings = NULL;
+	unsigned int randomPlies = DEFAULT_RANDOM_PLIES, seed = time(NULL);
+	Match match = {.options = &options};
+	double seconds, increment = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:t:o:r:g:e:a:p:s:")) != -1)
+		switch (opt) {
+			case 'c': options.concurrency = atoi(optarg); break;
+			case 't':
+				if (sscanf(optarg, "%lf+%lf", &seconds, &increment) < 1)
+					usage(argv[0]);
+				options.timeMs = seconds * 1000;
+				options.incrementMs = increment * 1000;
+				break;
+			case 'o': openings = optarg; break;
+			case 'r': randomPlies = atoi(optarg); break;
+			case 'g': options.maxGames = atoi(optarg); break;
+			case 'e': if (sscanf(optarg, "%lf,%lf", &options.elo0, &options.elo1) != 2) usage(argv[0]); break;
+			case 'a': if (sscanf(optarg, "%lf,%lf", &options.alpha, &options.beta) != 2) usage(argv[0]); break;
+			case 'p': options.maxPlies = atoi(optarg); break;
+			case 's': seed = atoi(optarg); break;
+			default: usage(argv[0]);
+		}
+
+	if (argc - optind != 2 || !options.concurrency || options.concurrency > MAX_SLOTS || options.timeMs <= 0 || !options.maxGames || options.elo1 <= options.elo0
+		|| !(options.alpha > 0 && options.alpha < 0.5) || !(options.beta > 0 && options.beta < 0.5))
+		usage(argv[0]);
+	options.engines[0] = argv[optind];
+	options.engines[1] = argv[optind + 1];
+
+	// Adjudication must not log to stdout
+	initLogger(stderr, LEVEL_ERROR, 64);
+	signal(SIGPIPE, SIG_IGN);
+
+	// The seed printed is the one to pass -s to replay the run
+	unsigned int random = seed;
+	if (openings && !loadOpenings(&match, openings)) {
+		fprintf(stderr, "Cannot read openings from %s\n", openings);
+		return 2;
+	}
+	if (!openings)
+		randomOpenings(&match, (options.maxGames + 1) / 2, randomPlies, &random);
+
+	// Shuffled, so a run that stops early still sees a spread of them
+	for (size_t i = match.openingCount; i > 1; i--) {
+		size_t j = rand_r(&random) % i;
+		Opening swap = match.openings[i - 1];
+		match.openings[i - 1] = match.openings[j];
+		match.openings[j] = swap;
+	}
+
+	printf("%s vs %s: %u concurrent games, %.1f+%.2f s, %zu openings, SPRT elo0 %.1f elo1 %.1f alpha %.3f beta %.3f, seed %u\n", options.engines[0], options.engines[1], options.concurrency,
+		options.timeMs / 1000.0, options.incrementMs / 1000.0, match.openingCount, options.elo0, options.elo1, options.alpha, options.beta, seed);
+
+	// Every engine answers uci before the first game, so a wrong command is
+	// an error rather than a match lost by forfeit
+	Slot *slots = calloc(options.concurrency, sizeof *slots);
+	for (unsigned int i = 0; i < options.concurrency; i++)
+		for (int e = 0; e < 2; e++) {
+			slots[i].engines[e].command = options.engines[e];
+			if (!startEngine(slots[i].engines + e)) {
+				fprintf(stderr, "Cannot start %s\n", options.engines[e]);
+				for (unsigned int j = 0; j <= i; j++) {
+					stopEngine(slots[j].engines);
+					stopEngine(slots[j].engines + 1);
+				}
+				return 2;
+			}
+		}
+
+	pthread_mutex_init(&match.lock, NULL);
+	for (unsigned int i = 0; i < options.concurrency; i++) {
+		slots[i].match = &match;
+		if (pthread_create(&slots[i].thread, NULL, runSlot, slots + i)) {
+			perror("pthread_create");
+			return 2;
+		}
+	}
+	for (unsigned int i = 0; i < options.concurrency; i++)
+		pthread_join(slots[i].thread, NULL);
+
+	double llr = logLikelihoodRatio(match.results, options.elo0, options.elo1);
+	printf("\n");
+	if (match.results[WIN] + match.results[DRAW] + match.results[LOSS])
+		printStatus(&match, stdout);
+	printf("Endings:");
+	for (int i = 0; i < ENDING_COUNT; i++)
+		if (match.endings[i])
+			printf(" %s %u", endingNames[i], match.endings[i]);
+	if (match.failed)
+		printf("\nStopped: cannot restart %s\n", match.failed);
+	else
+		printf("\n%s\n", llr >= log((1 - options.beta) / options.alpha) ? "H1 accepted: engine1 is stronger by elo1 or more" :
+			llr <= log(options.beta / (1 - options.alpha)) ? "H0 accepted: engine1 is not stronger by elo1" : "Inconclusive: out of games");
+
+	for (size_t i = 0; i < match.openingCount; i++)
+		free(match.openings[i].moves);
+	free(match.openings);
+	free(slots);
+	freeLogger();
+
+	return match.failed ? 2 : 0;
+}
@@ -0,0 +1,474 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Every allocation made by the code under test goes through these counters
+static size_t allocations;
+
+static void *countedMalloc(size_t size) {
+	allocations++;
+	return malloc(size);
+}
+
+static void *countedCalloc(size_t count, size_t size) {
+	allocations++;
+	return calloc(count, size);
+}
+
+static void *countedRealloc(void *ptr, size_t size) {
+	allocations++;
+	return realloc(ptr, size);
+}
+
+#define malloc(size) countedMalloc(size)
+#define calloc(count, size) countedCalloc(count, size)
+#define realloc(ptr, size) countedRealloc(ptr, size)
+
+#include "../Chess/basics.h"
+#include "../Chess/bench.h"
+#include "../JSON Parser/JSON.h"
+#include "../Util/results.h"
+
+#undef malloc
+#undef calloc
+#undef realloc
+
+// Times the engine's building blocks one at a time: move generation, making
+// a move, check detection, evaluation, UCI move conversion and JSON parsing.
+// Each runs over the positions of Chess/bench.h (every legal move of them,
+// where it takes a move), or over recorded lichess events for parseJSON,
+// round after round until it has run long enough. Reports ns and
+// allocations per operation and, where perf_event_open is allowed,
+// instructions per operation and per cycle in user space. With -j it prints
+// one JSON object instead of a table. Either way the results are kept in
+// the store of Util/results.h, to compare between commits with Bench/compare.
+//
+// Usage: Bench/micro [-j] [-s seconds] [-f name] [corpus.ndjson]
+
+#define DEFAULT_CORPUS "Bench/corpus/lichess.ndjson"
+#define DEFAULT_SECONDS 0.5
+
+typedef struct Position {
+	uint64_t board[4];
+	uint64_t prevBoard[4];
+	char brkrwrkr00;
+	char whiteToMove;
+	char *moves; // every legal move, 3 bytes each
+	unsigned long moveCount;
+	char (*uci)[6];
+	uint64_t (*children)[4]; // board after each move
+} Position;
+
+typedef struct Workload {
+	Position *positions;
+	size_t positionCount;
+	size_t moveCount;
+	char **docs; // NUL terminated, as parseJSON wants them
+	size_t docCount;
+} Workload;
+
+typedef struct Counters {
+	int fd; // group leader (cycles), -1 without perf
+	int instructionsFd;
+	uint64_t cycles, instructions;
+} Counters;
+
+typedef struct Result {
+	char const *name;
+	char const *set;
+	uint64_t ops;
+	double seconds;
+	size_t allocations;
+	Counters perf;
+} Result;
+
+// Runs the benchmark once over its whole set; returns the operations done
+typedef uint64_t (*Benchmark)(Workload const *);
+
+static volatile uint64_t sink;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int perfOpen(uint64_t config, int group) {
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof attr);
+	attr.size = sizeof attr;
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = group == -1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Cycles and instructions of this thread, counted together; fd is -1 if
+// the kernel won't let us (no PMU, or perf_event_paranoid)
+static void openCounters(Counters *counters) {
+	counters->instructionsFd = -1;
+	if ((counters->fd = perfOpen(PERF_COUNT_HW_CPU_CYCLES, -1)) == -1)
+		return;
+
+	if ((counters->instructionsFd = perfOpen(PERF_COUNT_HW_INSTRUCTIONS, counters->fd)) == -1) {
+		close(counters->fd);
+		counters->fd = -1;
+	}
+}
+
+static void closeCounters(Counters *counters) {
+	if (counters->fd == -1)
+		return;
+	close(counters->instructionsFd);
+	close(counters->fd);
+}
+
+static void startCounters(Counters *counters) {
+	if (counters->fd == -1)
+		return;
+	ioctl(counters->fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(counters->fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void stopCounters(Counters *counters) {
+	uint64_t values[3]; // count, cycles, instructions
+
+	if (counters->fd == -1)
+		return;
+	ioctl(counters->fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	if (read(counters->fd, values, sizeof values) == sizeof values) {
+		counters->cycles = values[1];
+		counters->instructions = values[2];
+	}
+}
+
+static uint64_t benchValidMoves(Workload const *work) {
+	for (size_t i = 0; i < work->positionCount; i++) {
+		Position const *p = work->positions + i;
+		char *moves = NULL;
+
+		sink += validMoves(p->board, p->prevBoard, p->brkrwrkr00, p->whiteToMove, &moves);
+		free(moves);
+	}
+
+	return work->positionCount;
+}
+
+// There is no unmake: the search copies the board and makes the move on the copy
+static uint64_t benchMakeForcedMove(Workload const *work) {
+	for (size_t i = 0; i < work->positionCount; i++) {
+		Position const *p = work->positions + i;
+
+		for (unsigned long j = 0; j < p->moveCount; j++) {
+			uint64_t child[4];
+			char rights = p->brkrwrkr00;
+
+			memcpy(child, p->board, sizeof child);
+			makeForcedMove(child, &rights, p->moves + j * 3);
+			sink += child[j & 3];
+		}
+	}
+
+	return work->moveCount;
+}
+
+static uint64_t benchIsCheckOnKing(Workload const *work) {
+	for (size_t i = 0; i < work->positionCount; i++) {
+		Position const *p = work->positions + i;
+
+		for (unsigned long j = 0; j < p->moveCount; j++)
+			sink += isCheckOnKing(p->children[j], !p->whiteToMove);
+	}
+
+	return work->moveCount;
+}
+
+// Every square, as the move generator asks about the squares a king crosses
+static uint64_t benchIsCheckOnXY(Workload const *work) {
+	for (size_t i = 0; i < work->positionCount; i++) {
+		Position const *p = work->positions + i;
+
+		for (char x = 0; x < 8; x++)
+			for (char y = 0; y < 8; y++)
+				sink += isCheckOnXY(p->board, p->whiteToMove, x, y);
+	}
+
+	return work->positionCount * 64;
+}
+
+// As the searches score their leaves
+static uint64_t benchEvaluateNode(Workload const *work) {
+	for (size_t i = 0; i < work->positionCount; i++) {
+		Position const *p = work->positions + i;
+
+		for (unsigned long j = 0; j < p->moveCount; j++) {
+			struct node n = {.len = 1, .pos = p->children[j], .move = p->moves + j * 3, .color = p->whiteToMove};
+			sink += evaluateNode(n);
+		}
+	}
+
+	return work->moveCount;
+}
+
+static uint64_t benchUciToIndices(Workload const *work) {
+	for (size_t i = 0; i < work->positionCount; i++) {
+		Position const *p = work->positions + i;
+
+		for (unsigned long j = 0; j < p->moveCount; j++) {
+			char *indices = uciToIndices(p->board, p->uci[j]);
+			sink += indices[1];
+			free(indices);
+		}
+	}
+
+	return work->moveCount;
+}
+
+static uint64_t benchIndicesToUci(Workload const *work) {
+	for (size_t i = 0; i < work->positionCount; i++) {
+		Position const *p = work->positions + i;
+
+		for (unsigned long j = 0; j < p->moveCount; j++) {
+			char *uci = indicesToUci(p->moves + j * 3);
+			sink += uci[3];
+			free(uci);
+		}
+	}
+
+	return work->moveCount;
+}
+
+static uint64_t benchParseJSON(Workload const *work) {
+	for (size_t i = 0; i < work->docCount; i++) {
+		JSON *json = NULL;
+
+		parseJSON(work->docs[i], &json);
+		sink += json->length;
+		freeJSON(json);
+	}
+
+	return work->docCount;
+}
+
+static Result run(char const *name, char const *set, Benchmark benchmark, Workload const *work, double seconds) {
+	Result result = {.name = name, .set = set};
+	double start;
+
+	// One round to warm the caches, not counted
+	benchmark(work);
+
+	openCounters(&result.perf);
+	allocations = 0;
+	start = now();
+	startCounters(&result.perf);
+
+	do
+		result.ops += benchmark(work);
+	while ((result.seconds = now() - start) < seconds);
+
+	stopCounters(&result.perf);
+	result.allocations = allocations;
+	closeCounters(&result.perf);
+
+	return result;
+}
+
+static int loadPositions(Workload *work) {
+	work->positions = calloc(BENCH_POSITION_COUNT, sizeof *work->positions);
+
+	for (size_t i = 0; i < BENCH_POSITION_COUNT; i++) {
+		Position *p = work->positions + work->positionCount;
+		char const *fen = benchPositions[i];
+
+		if (!setBoardFromFen(p->board, p->prevBoard, &p->brkrwrkr00, &p->whiteToMove, fen, strlen(fen)))
+			return 0;
+
+		p->moveCount = validMoves(p->board, p->prevBoard, p->brkrwrkr00, p->whiteToMove, &p->moves) / 3;
+		p->uci = malloc((p->moveCount + 1) * sizeof *p->uci);
+		p->children = malloc((p->moveCount + 1) * sizeof *p->children);
+
+		for (unsigned long j = 0; j < p->moveCount; j++) {
+			char *uci = indicesToUci(p->moves + j * 3);
+			char rights = p->brkrwrkr00;
+
+			memcpy(p->uci[j], uci, 6);
+			free(uci);
+			memcpy(p->children[j], p->board, sizeof *p->children);
+			makeForcedMove(p->children[j], &rights, p->moves + j * 3);
+		}
+
+		work->moveCount += p->moveCount;
+		work->positionCount++;
+	}
+
+	return 1;
+}
+
+static int loadDocuments(Workload *work, char const *path) {
+	FILE *fp = fopen(path, "r");
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+
+	if (!fp)
+		return 0;
+
+	while ((len = getline(&line, &cap, fp)) > 0) {
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = 0;
+		if (!len)
+			continue;
+		work->docs = realloc(work->docs, (work->docCount + 1) * sizeof *work->docs);
+		work->docs[work->docCount++] = strdup(line);
+	}
+
+	free(line);
+	fclose(fp);
+
+	return work->docCount > 0;
+}
+
+static void freeWorkload(Workload *work) {
+	for (size_t i = 0; i < work->positionCount; i++) {
+		free(work->positions[i].moves);
+		free(work->positions[i].uci);
+		free(work->positions[i].children);
+	}
+	free(work->positions);
+
+	for (size_t i = 0; i < work->docCount; i++)
+		free(work->docs[i]);
+	free(work->docs);
+}
+
+static void printResultsTable(Result const *results, size_t count) {
+	printf("%-16s %-10s %12s %10s %12s %12s %6s\n", "benchmark", "set", "ops", "ns/op", "allocs/op", "instr/op", "IPC");
+
+	for (size_t i = 0; i < count; i++) {
+		Result const *r = results + i;
+
+		printf("%-16s %-10s %12llu %10.1f %12.3f ", r->name, r->set, (unsigned long long) r->ops, r->seconds / r->ops * 1e9, (double) r->allocations / r->ops);
+		if (r->perf.fd != -1 && r->perf.cycles)
+			printf("%12.1f %6.2f\n", (double) r->perf.instructions / r->ops, (double) r->perf.instructions / r->perf.cycles);
+		else
+			printf("%12s %6s\n", "-", "-");
+	}
+}
+
+static void printResultsJSON(Result const *results, size_t count) {
+	printf("{\"benchmarks\":[");
+
+	for (size_t i = 0; i < count; i++) {
+		Result const *r = results + i;
+
+		printf("%s\n{\"name\":\"%s\",\"set\":\"%s\",\"ops\":%llu,\"seconds\":%.6f,\"ns_per_op\":%.3f,\"allocs_per_op\":%.4f,", i ? "," : "", r->name, r->set,
+			(unsigned long long) r->ops, r->seconds, r->seconds / r->ops * 1e9, (double) r->allocations / r->ops);
+		if (r->perf.fd != -1 && r->perf.cycles)
+			printf("\"instructions_per_op\":%.2f,\"ipc\":%.3f}", (double) r->perf.instructions / r->ops, (double) r->perf.instructions / r->perf.cycles);
+		else
+			printf("\"instructions_per_op\":null,\"ipc\":null}");
+	}
+
+	printf("\n]}\n");
+}
+
+static void recordResults(Result const *results, size_t count) {
+	BenchMetric *metrics = calloc(count * 3, sizeof *metrics);
+	size_t n = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		Result const *r = results + i;
+
+		snprintf(metrics[n].name, sizeof metrics[n].name, "%s ns/op", r->name);
+		metrics[n++].value = r->seconds / r->ops * 1e9;
+		snprintf(metrics[n].name, sizeof metrics[n].name, "%s allocs/op", r->name);
+		metrics[n++].value = (double) r->allocations / r->ops;
+		if (r->perf.fd != -1 && r->perf.cycles) {
+			snprintf(metrics[n].name, sizeof metrics[n].name, "%s instr/op", r->name);
+			metrics[n++].value = (double) r->perf.instructions / r->ops;
+		}
+	}
+
+	if (!recordBenchResults("micro", metrics, n))
+		fprintf(stderr, "Cannot record the results in %s\n", benchResultsPath());
+	free(metrics);
+}
+
+static void usage(char const *name) {
+	fprintf(stderr, "Usage: %s [-j] [-s seconds] [-f name] [corpus.ndjson]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	static struct {
+		char const *name;
+		char const *set;
+		Benchmark run;
+	} const benchmarks[] = {
+		{"validMoves", "positions", benchValidMoves},
+		{"makeForcedMove", "moves", benchMakeForcedMove},
+		{"isCheckOnKing", "moves", benchIsCheckOnKing},
+		{"isCheckOnXY", "squares", benchIsCheckOnXY},
+		{"evaluateNode", "moves", benchEvaluateNode},
+		{"uciToIndices", "moves", benchUciToIndices},
+		{"indicesToUci", "moves", benchIndicesToUci},
+		{"parseJSON", "events", benchParseJSON},
+	};
+	Result results[sizeof benchmarks / sizeof *benchmarks];
+	char const *filter = NULL, *path = DEFAULT_CORPUS;
+	double seconds = DEFAULT_SECONDS;
+	char json = 0;
+	size_t count = 0;
+	int opt;
+	Workload work = {0};
+
+	while ((opt = getopt(argc, argv, "js:f:")) != -1)
+		switch (opt) {
+			case 'j': json = 1; break;
+			case 's': seconds = atof(optarg); break;
+			case 'f': filter = optarg; break;
+			default: usage(argv[0]);
+		}
+
+	if (optind < argc)
+		path = argv[optind];
+	if (!(seconds > 0))
+		usage(argv[0]);
+
+	if (!loadPositions(&work)) {
+		fprintf(stderr, "Cannot read the bench positions\n");
+		return 1;
+	}
+	if (!loadDocuments(&work, path)) {
+		fprintf(stderr, "Cannot read corpus %s\n", path);
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof benchmarks / sizeof *benchmarks; i++)
+		if (!filter || strstr(benchmarks[i].name, filter))
+			results[count++] = run(benchmarks[i].name, benchmarks[i].set, benchmarks[i].run, &work, seconds);
+
+	if (json)
+		printResultsJSON(results, count);
+	else {
+		printf("%zu positions, %zu moves, %zu events\n", work.positionCount, work.moveCount, work.docCount);
+		printResultsTable(results, count);
+	}
+	recordResults(results, count);
+
+	freeWorkload(&work);
+
+	return 0;
+}
@@ -9,8 +9,17 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include "../Util/log.h"
+#include "../Util/arena.h"
+
+// Search trees are big and short-lived: a block size for the arenas they go in
+#define SEARCH_ARENA_BLOCK (1 << 20)
+
 // static unsigned int _movecounter_ = 0;
 
+// Nodes generateNodesIn made on this thread since takeSearchNodes last ran
+static _Thread_local unsigned long searchNodes;
+
 // A piece = 4 bits
 // black = 0, white = 1
 
@@ -51,6 +60,7 @@ static inline unsigned char accessBoardAt(uint64_t const *, unsigned char);
 static inline void setBoardAt(uint64_t *, unsigned char, unsigned char);
 static inline char makeMove(uint64_t *, uint64_t const *, char *, char *); // char * (3nd arg) -> {from, to, promotionPiece or 0}
 uint64_t *newChessBoard();
+char setBoardFromFen(uint64_t *, uint64_t *, char *, char *, char const *, size_t);
 void makeForcedMove(uint64_t *, char *, char const *); // make move without validating
 char validateMove(uint64_t const *, uint64_t const *, char, char const *);
 static inline char pieceToNotation(unsigned char);
@@ -60,11 +70,15 @@ static inline unsigned char notationToWhitePiece(char);
 static inline unsigned char notationToBlackPiece(char);
 void freeNodes(struct node);
 void printBoard(uint64_t const *);
+void formatBoard(char *, uint64_t const *);
 void printBoardToFile(FILE *, uint64_t const *);
 void printValidMoves(uint64_t const *, uint64_t const *, char, char);
 unsigned long validMoves(uint64_t const *, uint64_t const *, char, char, char **);
 unsigned long generateNodes(uint64_t const *, uint64_t const *, char, char, struct node **, int);
+unsigned long generateNodesIn(uint64_t const *, uint64_t const *, char, char, struct node **, int, Arena *);
+unsigned long takeSearchNodes(void);
 char *theBestMove(uint64_t const *, uint64_t const *, char, char, int);
+int evaluateRootMove(uint64_t const *, char, char, char const *, int, Arena *);
 static inline char *uciToIndices(uint64_t const *, char const *);
 static inline char *indicesToUci(char const *);
 static inline unsigned char chessPosToIndex(char const *);
@@ -86,14 +100,22 @@ static inline char isBlack(char p) {
 }
 
 void printBoard(uint64_t const *board) {
-	unsigned char i;
-	for (i = 0; i < 64; i++) {
-		printf("%c", pieceToNotation(accessBoardAt(board, i)));
-		if ((i + 1) % 8 == 0) printf("\n");
-	}
+	char out[73];
+	formatBoard(out, board);
+	fputs(out, stdout);
 	fflush(stdout);
 }
 
+// Eight ranks of eight squares, each followed by a newline; out holds 73 bytes
+void formatBoard(char *out, uint64_t const *board) {
+	for (unsigned char i = 0; i < 64; i++) {
+		*out++ = pieceToNotation(accessBoardAt(board, i));
+		if ((i + 1) % 8 == 0)
+			*out++ = '\n';
+	}
+	*out = 0;
+}
+
 // void printBoardToFile(FILE *fp, uint64_t const *board) {
 // 	unsigned char i;
 // 	for (i = 0; i < 64; i++) {
@@ -842,7 +864,18 @@ unsigned long validMoves(uint64_t const *boardcpy, uint64_t const *prevBoard, ch
 // 	return ret;
 // }
 
+// Allocates from the arena, or from the heap when there is none (freeNodes path)
+static inline void *nodeAlloc(Arena *arena, size_t size) {
+	return arena ? arenaAlloc(arena, size) : malloc(size);
+}
+
 unsigned long generateNodes(uint64_t const *board, uint64_t const *prevBoard, char brkrwrkr00, char isWhiteYourColor, struct node **ret, int depth) {
+	return generateNodesIn(board, prevBoard, brkrwrkr00, isWhiteYourColor, ret, depth, NULL);
+}
+
+// The whole tree is carved out of arena and goes with it; freeNodes is only
+// for trees built without one
+unsigned long generateNodesIn(uint64_t const *board, uint64_t const *prevBoard, char brkrwrkr00, char isWhiteYourColor, struct node **ret, int depth, Arena *arena) {
 	if (!depth)
 		return 0;
 
@@ -852,7 +885,8 @@ unsigned long generateNodes(uint64_t const *board, uint64_t const *prevBoard, ch
 	if (!_len_)
 		return 0;
 
-	*ret = malloc(_len_ / 3 * sizeof **ret);
+	*ret = nodeAlloc(arena, _len_ / 3 * sizeof **ret);
+	searchNodes += _len_ / 3;
 
 	// char *drname = NULL;
 	
@@ -861,11 +895,11 @@ unsigned long generateNodes(uint64_t const *board, uint64_t const *prevBoard, ch
 
 	for (unsigned long i = 0, j = 0; i < _len_; i += 3, j++) {
 		(*ret)[j].color = isWhiteYourColor;
-		(*ret)[j].pos = memcpy(malloc(32), board, 32);
+		(*ret)[j].pos = memcpy(nodeAlloc(arena, 32), board, 32);
 		(*ret)[j].brkrwrkr00 = brkrwrkr00;
-		(*ret)[j].move = memcpy(malloc(3), valids + i, 3);
+		(*ret)[j].move = memcpy(nodeAlloc(arena, 3), valids + i, 3);
 		makeForcedMove((*ret)[j].pos, &((*ret)[j].brkrwrkr00), (*ret)[j].move);
-		(*ret)[j].len = generateNodes((*ret)[j].pos, board, (*ret)[j].brkrwrkr00, !isWhiteYourColor, &((*ret)[j].branches), depth - 1);
+		(*ret)[j].len = generateNodesIn((*ret)[j].pos, board, (*ret)[j].brkrwrkr00, !isWhiteYourColor, &((*ret)[j].branches), depth - 1, arena);
 		(*ret)[j].isnotleafnode = depth != 1;
 		// if (depth > 1) {
 			// remove(drname);
@@ -888,12 +922,22 @@ unsigned long generateNodes(uint64_t const *board, uint64_t const *prevBoard, ch
 	return _len_ / 3;
 };
 
+unsigned long takeSearchNodes(void) {
+	unsigned long nodes = searchNodes;
+	searchNodes = 0;
+	return nodes;
+}
+
 void freeNodes(struct node n) {
 	free(n.move);
 	free(n.pos);
 
 	for (unsigned long i = 0; i < n.len; i++)
 		freeNodes(n.branches[i]);
+
+	// branches is only set when there are some
+	if (n.len)
+		free(n.branches);
 }
 
 struct stringandweight minimax(struct node n, int depth, char maximizer) {
@@ -919,15 +963,20 @@ char *theBestMove(uint64_t const *board, uint64_t const *prevBoard, char brkrwrk
 	if (!depth)
 		return NULL;
 
+	Arena arena;
+	arenaInit(&arena, SEARCH_ARENA_BLOCK);
+
 	struct node baseNode;
-	baseNode.len = generateNodes(board, prevBoard, brkrwrkr00, isWhiteYourColor, &baseNode.branches, depth);
+	baseNode.len = generateNodesIn(board, prevBoard, brkrwrkr00, isWhiteYourColor, &baseNode.branches, depth, &arena);
 	
-	printf("%ld\n", baseNode.len);
+	logMessage(LEVEL_DEBUG, "%ld root moves", baseNode.len);
 
-	if (!baseNode.len)
+	if (!baseNode.len) {
+		arenaFree(&arena);
 		return NULL;
+	}
 
-	baseNode.pos = memcpy(malloc(32), board, 32);
+	baseNode.pos = memcpy(arenaAlloc(&arena, 32), board, 32);
 	baseNode.brkrwrkr00 = brkrwrkr00;
 	baseNode.move = NULL;
 	baseNode.color = isWhiteYourColor;
@@ -935,11 +984,28 @@ char *theBestMove(uint64_t const *board, uint64_t const *prevBoard, char brkrwrk
 
 	char *bestmove = memcpy(malloc(3), minimax(baseNode, depth, isWhiteYourColor).move, 3);
 
-	freeNodes(baseNode);
+	arenaFree(&arena);
 
 	return bestmove;
 }
 
+// Score theBestMove gives to playing move from board, for splitting the root
+// moves of a search between threads. The tree is built in arena, which the
+// caller resets or frees.
+int evaluateRootMove(uint64_t const *board, char brkrwrkr00, char isWhiteYourColor, char const *move, int depth, Arena *arena) {
+	struct node n;
+
+	n.color = isWhiteYourColor;
+	n.pos = memcpy(arenaAlloc(arena, 32), board, 32);
+	n.brkrwrkr00 = brkrwrkr00;
+	n.move = memcpy(arenaAlloc(arena, 3), move, 3);
+	makeForcedMove(n.pos, &n.brkrwrkr00, n.move);
+	n.len = generateNodesIn(n.pos, board, n.brkrwrkr00, !isWhiteYourColor, &n.branches, depth - 1, arena);
+	n.isnotleafnode = depth != 1;
+
+	return minimax(n, depth - 1, !isWhiteYourColor).weight;
+}
+
 void printValidMoves(uint64_t const *board, uint64_t const *prevBoard, char brkrwrkr00, char isWhiteYourColor) {
 	char *ret = 0;
 	unsigned long len = validMoves(board, prevBoard, brkrwrkr00, isWhiteYourColor, &ret);
@@ -969,8 +1035,7 @@ char isCheckOnKing(uint64_t const *board, char kingColor) {
 			}
 
 	if (kingX == -1 || kingY == -1) {
-		printf("No King on Board!\n");
-		fflush(stdout);
+		logMessage(LEVEL_WARN, "No King on Board!");
 		return 0;
 	}
 
@@ -1132,8 +1197,7 @@ void makeForcedMove(uint64_t *board, char *brkrwrkr00, char const *args) {
 
 static inline char makeMove(uint64_t *board, uint64_t const *prevBoard, char *brkrwrkr00, char *args) {
 	if (!validateMove(board, prevBoard, *brkrwrkr00, args)) {
-		printf("Invalid!\n");
-		fflush(stdout);
+		logMessage(LEVEL_WARN, "Invalid!");
 		return 0;
 	}
 
@@ -1178,6 +1242,50 @@ uint64_t *newChessBoard() {
 	return board;
 }
 
+// Reads the placement, side to move, castling and en passant fields of a FEN
+// (the clocks are ignored). prevBoard becomes the position before the double
+// step named by the en passant field, since that is how en passant is
+// detected, or a copy of board. Returns 0 on malformed input.
+char setBoardFromFen(uint64_t *board, uint64_t *prevBoard, char *brkrwrkr00, char *whiteToMove, char const *fen, size_t len) {
+	size_t i = 0;
+	unsigned char sq = 0;
+
+	memset(board, 0, 4 * sizeof(uint64_t));
+
+	for (; i < len && fen[i] != ' '; i++) {
+		if (fen[i] == '/')
+			continue;
+		if (fen[i] >= '1' && fen[i] <= '8')
+			sq += fen[i] - '0';
+		else {
+			unsigned char p = notationToPiece(fen[i]);
+			if (p == UNKNOWN || p == BLANK || sq >= 64)
+				return 0;
+			setBoardAt(board, sq++, p);
+		}
+	}
+	if (sq != 64)
+		return 0;
+
+	*whiteToMove = !(i + 1 < len && fen[i + 1] == 'b');
+	i += 3;
+
+	*brkrwrkr00 = 0;
+	for (; i < len && fen[i] != ' '; i++)
+		*brkrwrkr00 |= fen[i] == 'K' ? 8 | 4 : fen[i] == 'Q' ? 8 | 16 : fen[i] == 'k' ? 64 | 32 : fen[i] == 'q' ? 64 | 128 : 0;
+
+	memcpy(prevBoard, board, 4 * sizeof(uint64_t));
+
+	if (i + 2 < len && fen[i + 1] >= 'a' && fen[i + 1] <= 'h' && (fen[i + 2] == '3' || fen[i + 2] == '6')) {
+		unsigned char ep = chessPosToIndex(fen + i + 1);
+		unsigned char pawn = *whiteToMove ? ep + 8 : ep - 8, from = *whiteToMove ? ep - 8 : ep + 8;
+		setBoardAt(prevBoard, from, accessBoardAt(board, pawn));
+		setBoardAt(prevBoard, pawn, BLANK);
+	}
+
+	return 1;
+}
+
 static inline unsigned char chessPosToIndex(char const *p) {
 	return (p[0] - 'a' + 1) + (8 - p[1] + '0') * 8 - 1;
 }
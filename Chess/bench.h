@@ -0,0 +1,174 @@
+#ifndef __CHESS_BENCH__
+#define __CHESS_BENCH__
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "basics.h"
+#include "search.h"
+#include "../Util/results.h"
+
+// Fixed workload for telling whether a change to move generation,
+// evaluation or search changed what the engine does, and how fast it does
+// it. Every position is searched on one thread to a fixed depth, by the
+// bot's full-width minimax (theBestMove) and by the alpha-beta search
+// (searchPosition). The total of the nodes they visit is the signature: a
+// change that only makes things faster must leave it alone, and one that
+// changes it has changed the engine. Neither search keeps a hash table, so
+// there is no table size to fix, and nothing depends on timing.
+//
+// Run with `Bot bench [minimax depth] [alpha-beta depth]`, or `make bench`.
+// Results go to the store of Util/results.h for Bench/compare.
+
+#define BENCH_MINIMAX_DEPTH 3
+#define BENCH_SEARCH_DEPTH 4
+
+typedef struct BenchResult {
+	uint64_t minimaxNodes;
+	uint64_t searchNodes;
+	uint64_t minimaxNs;
+	uint64_t searchNs;
+} BenchResult;
+
+// Openings, middlegames with tactics, endgames, checks and promotions
+static char const *const benchPositions[] = {
+	"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+	"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+	"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+	"4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+	"rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+	"r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+	"r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+	"r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+	"r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+	"4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+	"2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+	"r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+	"3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+	"r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+	"4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+	"3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+	"6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/8 b - - 3 54",
+	"r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3",
+	"rnbqkb1r/pp2pppp/3p1n2/8/3NP3/8/PPP2PPP/RNBQKB1R w KQkq - 1 5",
+	"rnbqkbnr/ppp1pppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR b KQkq - 0 2",
+	"rnbqkbnr/pp1ppppp/8/2pP4/8/8/PPP1PPPP/RNBQKBNR b KQkq - 0 2",
+	"rnbqkbnr/ppp2ppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 3",
+	"r1bqk2r/pppp1ppp/2n2n2/2b1p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4",
+	"r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4",
+	"rnb1kbnr/pppp1ppp/8/4p3/6Pq/5P2/PPPPP2P/RNBQKBNR w KQkq - 1 3",
+	"r2qkb1r/pp2nppp/3p4/2pNN1B1/2BnP3/3P4/PPP2PPP/R2bK2R w KQkq - 1 10",
+	"r1b1kb1r/pppp1ppp/5q2/4n3/3KP3/2N3PN/PPP4P/R1BQ1B1R b kq - 0 1",
+	"r2r1n2/pp2bk2/2p1p2p/3q4/3PN1QP/2P3R1/P4PP1/5RK1 w - - 0 1",
+	"6k1/3b3r/1p1p4/p1n2p2/1PPNpP1q/P3Q1p1/1R1RB1P1/5K2 b - - 0 1",
+	"2r3k1/pp3ppp/8/8/8/8/PP3PPP/2R3K1 w - - 0 1",
+	"6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1",
+	"r5k1/5ppp/8/8/8/8/5PPP/6K1 b - - 0 1",
+	"8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+	"7k/3p2pp/4q3/8/4Q3/5Kp1/P6b/8 w - - 0 1",
+	"8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+	"8/8/8/5N2/8/p7/8/2NK3k w - - 0 1",
+	"8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+	"8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+	"8/2p4P/8/kr6/6R1/8/8/1K6 w - - 0 1",
+	"8/8/3P3k/8/1p6/8/1P6/1K3n2 b - - 0 1",
+	"8/R7/2q5/8/6k1/8/1P5p/K6R w - - 0 124",
+	"8/8/8/8/8/6k1/6p1/6K1 w - - 0 1",
+	"7k/7P/6K1/8/3B4/8/8/8 b - - 0 1",
+	"2r5/8/3K4/8/4k3/8/3R4/8 w - - 0 1",
+	"8/8/8/8/8/2k5/1p6/1K6 w - - 0 1",
+	"8/2p1k3/3p4/4P3/8/8/8/2K5 w - - 0 1",
+	"4k3/8/8/8/8/8/4P3/4K3 w - - 0 1",
+	"8/8/4k3/8/2p5/8/B2K4/8 w - - 0 1",
+	"8/1P6/8/8/8/8/6k1/K7 w - - 0 1",
+	"r3k3/8/8/8/8/8/8/4K2R w Kq - 0 1",
+};
+
+#define BENCH_POSITION_COUNT (sizeof benchPositions / sizeof *benchPositions)
+
+BenchResult runBench(FILE *, int, int);
+int benchMain(int, char **);
+
+static inline uint64_t benchClockNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Searches every position with both searches; a line per position goes to
+// log, if there is one
+BenchResult runBench(FILE *log, int minimaxDepth, int searchDepth) {
+	BenchResult result = {0};
+	SearchLimits limits = {.depth = searchDepth};
+
+	for (size_t i = 0; i < BENCH_POSITION_COUNT; i++) {
+		char const *fen = benchPositions[i];
+		uint64_t board[4], prevBoard[4], start;
+		char brkrwrkr00, whiteToMove;
+		SearchInfo info;
+
+		if (!setBoardFromFen(board, prevBoard, &brkrwrkr00, &whiteToMove, fen, strlen(fen)) || !validSearchPosition(board, whiteToMove)) {
+			if (log)
+				fprintf(log, "Position %zu is not valid: %s\n", i + 1, fen);
+			continue;
+		}
+
+		takeSearchNodes();
+		start = benchClockNs();
+		free(theBestMove(board, prevBoard, brkrwrkr00, whiteToMove, minimaxDepth));
+		result.minimaxNs += benchClockNs() - start;
+		uint64_t minimaxNodes = takeSearchNodes();
+
+		start = benchClockNs();
+		searchPosition(board, prevBoard, brkrwrkr00, whiteToMove, &limits, &info);
+		result.searchNs += benchClockNs() - start;
+
+		result.minimaxNodes += minimaxNodes;
+		result.searchNodes += info.nodes;
+
+		if (log)
+			fprintf(log, "Position %zu/%zu: minimax %llu nodes, alpha-beta %llu nodes\n", i + 1, BENCH_POSITION_COUNT, (unsigned long long) minimaxNodes, (unsigned long long) info.nodes);
+	}
+
+	return result;
+}
+
+static inline uint64_t benchNps(uint64_t nodes, uint64_t ns) {
+	return ns ? nodes * 1000000000 / ns : 0;
+}
+
+// The bench subcommand: progress on stderr, the summary on stdout
+int benchMain(int argc, char **argv) {
+	int minimaxDepth = argc > 0 ? atoi(argv[0]) : BENCH_MINIMAX_DEPTH;
+	int searchDepth = argc > 1 ? atoi(argv[1]) : BENCH_SEARCH_DEPTH;
+
+	if (minimaxDepth < 1 || searchDepth < 1 || searchDepth > SEARCH_MAX_PLY) {
+		fprintf(stderr, "Usage: bench [minimax depth] [alpha-beta depth]\n");
+		return 1;
+	}
+
+	BenchResult result = runBench(stderr, minimaxDepth, searchDepth);
+	uint64_t nodes = result.minimaxNodes + result.searchNodes, ns = result.minimaxNs + result.searchNs;
+
+	printf("Minimax depth %d: %llu nodes, %llu nps\n", minimaxDepth, (unsigned long long) result.minimaxNodes, (unsigned long long) benchNps(result.minimaxNodes, result.minimaxNs));
+	printf("Alpha-beta depth %d: %llu nodes, %llu nps\n", searchDepth, (unsigned long long) result.searchNodes, (unsigned long long) benchNps(result.searchNodes, result.searchNs));
+	printf("Total time (ms) : %llu\n", (unsigned long long) (ns / 1000000));
+	printf("Nodes searched  : %llu\n", (unsigned long long) nodes);
+	printf("Nodes/second    : %llu\n", (unsigned long long) benchNps(nodes, ns));
+
+	BenchMetric metrics[] = {
+		{"nodes", nodes},
+		{"minimax nps", benchNps(result.minimaxNodes, result.minimaxNs)},
+		{"alpha-beta nps", benchNps(result.searchNodes, result.searchNs)},
+		{"nps", benchNps(nodes, ns)},
+	};
+	char tool[64];
+
+	snprintf(tool, sizeof tool, "bench %d %d", minimaxDepth, searchDepth);
+	if (!recordBenchResults(tool, metrics, sizeof metrics / sizeof *metrics))
+		fprintf(stderr, "Cannot record the results in %s\n", benchResultsPath());
+
+	return 0;
+}
+
+#endif /*__CHESS_BENCH__*/
@@ -0,0 +1,149 @@
+#ifndef __CHESS_GAME__
+#define __CHESS_GAME__
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "basics.h"
+
+// Position of a game being played, kept in step with the moves string of
+// gameFull/gameState events. The string always lists every move since the
+// initial position; the tracker remembers the prefix it has already applied
+// and only plays the new suffix. When the prefix no longer matches (takeback,
+// or a gameFull after reconnecting) the position is replayed from the start.
+
+typedef struct GameTracker {
+	uint64_t board[4];
+	uint64_t prevBoard[4]; // position before the last move, for en passant
+	char brkrwr00;
+	char whiteToMove;
+	unsigned int plies; // moves applied since the initial position
+	unsigned int resyncs; // times the position was replayed from the start
+	char checkMoves; // check every move is legal, for move lists not from lichess
+
+	// Initial position, to replay from on resync
+	uint64_t startBoard[4];
+	uint64_t startPrevBoard[4];
+	char startBrkrwr00;
+	char startWhiteToMove;
+
+	char *moves; // the moves string applied so far
+	size_t movesLen;
+	size_t movesCapacity;
+} GameTracker;
+
+void initGameTracker(GameTracker *);
+char resetGameTracker(GameTracker *, char const *, size_t);
+int updateGameTracker(GameTracker *, char const *, size_t);
+void freeGameTracker(GameTracker *);
+
+static void rewindGameTracker(GameTracker *game) {
+	memcpy(game->board, game->startBoard, sizeof game->board);
+	memcpy(game->prevBoard, game->startPrevBoard, sizeof game->prevBoard);
+	game->brkrwr00 = game->startBrkrwr00;
+	game->whiteToMove = game->startWhiteToMove;
+	game->plies = 0;
+	game->movesLen = 0;
+}
+
+void initGameTracker(GameTracker *game) {
+	memset(game, 0, sizeof *game);
+	resetGameTracker(game, NULL, 0);
+}
+
+// Sets the initial position from a FEN, or the standard one when fen is NULL,
+// empty or "startpos". Returns 0 (and keeps the standard position) on a
+// malformed FEN.
+char resetGameTracker(GameTracker *game, char const *fen, size_t len) {
+	char ok = 1;
+
+	if (!fen || !len || (len == 8 && !memcmp(fen, "startpos", 8)) || !(ok = setBoardFromFen(game->startBoard, game->startPrevBoard, &game->startBrkrwr00, &game->startWhiteToMove, fen, len))) {
+		uint64_t *board = newChessBoard();
+		memcpy(game->startBoard, board, sizeof game->startBoard);
+		memcpy(game->startPrevBoard, board, sizeof game->startPrevBoard);
+		free(board);
+		game->startBrkrwr00 = 0xfc;
+		game->startWhiteToMove = 1;
+	}
+
+	rewindGameTracker(game);
+	game->resyncs++;
+
+	return ok;
+}
+
+static char applyGameTrackerMove(GameTracker *game, char const *uci, size_t len) {
+	if ((len != 4 && len != 5) || uci[0] < 'a' || uci[0] > 'h' || uci[1] < '1' || uci[1] > '8' || uci[2] < 'a' || uci[2] > 'h' || uci[3] < '1' || uci[3] > '8')
+		return 0;
+
+	char move[3] = {chessPosToIndex(uci), chessPosToIndex(uci + 2), 0};
+	if (len == 5)
+		move[2] = game->whiteToMove ? notationToWhitePiece(uci[4]) : notationToBlackPiece(uci[4]);
+
+	if (game->checkMoves) {
+		char *moves = NULL, legal = 0;
+		unsigned long count = validMoves(game->board, game->prevBoard, game->brkrwr00, game->whiteToMove, &moves);
+
+		for (unsigned long i = 0; i < count && !legal; i += 3)
+			legal = moves[i] == move[0] && moves[i + 1] == move[1] && (moves[i + 2] ? moves[i + 2] | 1 : 0) == (move[2] ? move[2] | 1 : 0);
+		free(moves);
+		if (!legal)
+			return 0;
+	}
+
+	memcpy(game->prevBoard, game->board, sizeof game->board);
+	makeForcedMove(game->board, &game->brkrwr00, move);
+	game->whiteToMove = !game->whiteToMove;
+	game->plies++;
+
+	return 1;
+}
+
+// Applies the moves in moves that haven't been applied yet. Returns the number
+// of plies played, or -1 on a malformed (or, with checkMoves, illegal) move,
+// in which case the position is that of the moves before it. A resync bumps resyncs, so the position may
+// have changed even when 0 plies were played.
+int updateGameTracker(GameTracker *game, char const *moves, size_t len) {
+	size_t i = 0;
+	int played = 0;
+
+	// A memcmp over the applied prefix is far cheaper than replaying it, and
+	// it catches takebacks that leave the length unchanged
+	if (!game->movesLen || (len >= game->movesLen && (len == game->movesLen || moves[game->movesLen] == ' ') && !memcmp(moves, game->moves, game->movesLen)))
+		i = game->movesLen;
+	else {
+		rewindGameTracker(game);
+		game->resyncs++;
+	}
+
+	if (game->movesCapacity < len + 1) {
+		game->movesCapacity = len + 1 > 2 * game->movesCapacity ? len + 1 : 2 * game->movesCapacity;
+		game->moves = realloc(game->moves, game->movesCapacity);
+	}
+
+	while (i < len) {
+		while (i < len && moves[i] == ' ')
+			i++;
+		size_t start = i;
+		while (i < len && moves[i] != ' ')
+			i++;
+		if (start == i)
+			break;
+
+		if (!applyGameTrackerMove(game, moves + start, i - start))
+			return -1;
+
+		memcpy(game->moves + game->movesLen, moves + game->movesLen, i - game->movesLen);
+		game->movesLen = i;
+		played++;
+	}
+
+	return played;
+}
+
+void freeGameTracker(GameTracker *game) {
+	free(game->moves);
+	game->moves = NULL;
+	game->movesLen = game->movesCapacity = 0;
+}
+
+#endif /*__CHESS_GAME__*/
@@ -0,0 +1,310 @@
+#ifndef __CHESS_SEARCH__
+#define __CHESS_SEARCH__
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "basics.h"
+
+// Iterative deepening alpha-beta search for analysing positions. Unlike
+// theBestMove it never builds the tree: it walks it depth first, prunes
+// with alpha-beta, extends the leaves with captures only (quiescence) so
+// the score isn't taken in the middle of an exchange, keeps the principal
+// variation and can stop on a time limit. Each iteration tries the previous
+// one's principal variation first, which is what makes the next one cheap.
+// Whoever started the search can follow it iteration by iteration and stop
+// it from another thread.
+// Positions are scored with evaluateNode, so scores are in its units (a
+// pawn is 10), from the side to move's point of view.
+
+#define SEARCH_MAX_PLY 64
+#define SEARCH_MATE 64000 // evaluateNode's score for a mate
+#define SEARCH_INFINITY (SEARCH_MATE + 1)
+#define SEARCH_CHECK_NODES 1024 // nodes between looks at the clock
+
+struct SearchInfo;
+
+typedef struct SearchLimits {
+	int depth; // 0 for up to SEARCH_MAX_PLY
+	unsigned int timeMs; // 0 for no limit
+	atomic_int *stop; // set from any thread to end the search early, or NULL
+	void (*onIteration)(struct SearchInfo const *, void *); // on the searching thread, after every iteration that finished
+	void *data; // for onIteration
+} SearchLimits;
+
+typedef struct SearchInfo {
+	int depth; // of the last iteration that finished
+	int score;
+	uint64_t nodes;
+	uint64_t timeUs;
+	int pvLen;
+	char pv[SEARCH_MAX_PLY][3]; // {from, to, promotionPiece or 0}
+} SearchInfo;
+
+typedef struct SearchState {
+	uint64_t nodes;
+	uint64_t startNs;
+	uint64_t deadlineNs; // 0 for none
+	atomic_int *stop;
+	char stopped;
+	int pvLen[SEARCH_MAX_PLY + 1];
+	char pv[SEARCH_MAX_PLY + 1][SEARCH_MAX_PLY][3]; // triangular: pv[ply] is the line from ply on
+	int followLen; // previous iteration's line, tried first while the search is still on it
+	char follow[SEARCH_MAX_PLY][3];
+} SearchState;
+
+char validSearchPosition(uint64_t const *, char);
+int searchPosition(uint64_t const *, uint64_t const *, char, char, SearchLimits const *, SearchInfo *);
+int searchScoreCp(int);
+int searchScoreMate(int);
+
+static inline uint64_t searchClockNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// One king each and the side that just moved not left in check; anything
+// else would have the search (and isCheckOnKing) working on nonsense
+char validSearchPosition(uint64_t const *board, char whiteToMove) {
+	int kings[2] = {0, 0};
+
+	for (unsigned char i = 0; i < 64; i++) {
+		unsigned char p = accessBoardAt(board, i);
+		if (p == KING_B || p == KING_W)
+			kings[isWhite(p) ? 1 : 0]++;
+	}
+
+	return kings[0] == 1 && kings[1] == 1 && !isCheckOnKing(board, !whiteToMove);
+}
+
+// Score in centipawns, for a score that isn't a mate
+int searchScoreCp(int score) {
+	return score * 10;
+}
+
+// Moves to mate, negative when the side to move is mated; 0 if score isn't one
+int searchScoreMate(int score) {
+	if (score > SEARCH_MATE - SEARCH_MAX_PLY)
+		return (SEARCH_MATE - score + 1) / 2;
+	if (score < -(SEARCH_MATE - SEARCH_MAX_PLY))
+		return -(SEARCH_MATE + score) / 2;
+	return 0;
+}
+
+static int searchEvaluate(uint64_t const *board, char whiteToMove, char const *move) {
+	// A node with branches, so evaluateNode only counts material
+	struct node n = {.len = 1, .pos = (uint64_t *) board, .move = (char *) move, .color = !whiteToMove};
+	int score = evaluateNode(n);
+
+	return whiteToMove ? score : -score;
+}
+
+// The first iteration always finishes in time, so there is a move to give;
+// a stop from outside means nobody wants one
+static inline char searchTimeUp(SearchState *state) {
+	if (state->stopped || state->nodes % SEARCH_CHECK_NODES)
+		return state->stopped;
+
+	if (state->stop && atomic_load_explicit(state->stop, memory_order_relaxed))
+		state->stopped = 1;
+	else if (state->deadlineNs && state->followLen && searchClockNs() >= state->deadlineNs)
+		state->stopped = 1;
+
+	return state->stopped;
+}
+
+static inline int searchPieceValue(unsigned char p) {
+	switch (p | 1) {
+		case PAWN_W: return 1;
+		case KNIGHT_W: case BISHOP_W: return 3;
+		case ROOK_W: return 5;
+		case QUEEN_W: return 9;
+		default: return 0;
+	}
+}
+
+// Puts the move the previous iteration chose here first, then captures of
+// the biggest pieces by the smallest, then the rest in generation order
+static void orderSearchMoves(SearchState *state, uint64_t const *board, char *moves, unsigned long count, int ply, char onPv) {
+	int keys[count];
+
+	for (unsigned long i = 0; i < count; i++) {
+		char const *m = moves + i * 3;
+		unsigned char victim = accessBoardAt(board, m[1]);
+
+		keys[i] = victim ? 16 * searchPieceValue(victim) - searchPieceValue(accessBoardAt(board, m[0])) : -64;
+		if (onPv && ply < state->followLen && !memcmp(m, state->follow[ply], 3))
+			keys[i] = 1 << 20;
+	}
+
+	// Insertion sort; there are a few dozen moves at most
+	for (unsigned long i = 1; i < count; i++) {
+		int key = keys[i];
+		char move[3];
+		unsigned long j = i;
+
+		memcpy(move, moves + i * 3, 3);
+		for (; j > 0 && keys[j - 1] < key; j--) {
+			keys[j] = keys[j - 1];
+			memcpy(moves + j * 3, moves + (j - 1) * 3, 3);
+		}
+		keys[j] = key;
+		memcpy(moves + j * 3, move, 3);
+	}
+}
+
+// Captures only, until the position is quiet; the side to move may always
+// stand pat instead
+static int quiesce(SearchState *state, uint64_t const *board, uint64_t const *prevBoard, char brkrwrkr00, char whiteToMove, int ply, int alpha, int beta, char const *move) {
+	state->nodes++;
+	if (searchTimeUp(state))
+		return 0;
+
+	char *moves = NULL;
+	unsigned long len = validMoves(board, prevBoard, brkrwrkr00, whiteToMove, &moves) / 3;
+
+	if (!len)
+		return isCheckOnKing(board, whiteToMove) ? -SEARCH_MATE + ply : 0;
+
+	int best = searchEvaluate(board, whiteToMove, move);
+	if (best >= beta || ply >= SEARCH_MAX_PLY) {
+		free(moves);
+		return best;
+	}
+	if (best > alpha)
+		alpha = best;
+
+	orderSearchMoves(state, board, moves, len, ply, 0);
+
+	for (unsigned long i = 0; i < len; i++) {
+		char *m = moves + i * 3;
+		uint64_t child[4];
+		char childRights = brkrwrkr00;
+
+		if (!accessBoardAt(board, m[1]))
+			break; // captures come first, so the rest are quiet
+
+		memcpy(child, board, sizeof child);
+		makeForcedMove(child, &childRights, m);
+
+		int score = -quiesce(state, child, board, childRights, !whiteToMove, ply + 1, -beta, -alpha, m);
+		if (state->stopped)
+			break;
+
+		if (score > best)
+			best = score;
+		if (score > alpha)
+			alpha = score;
+		if (alpha >= beta)
+			break;
+	}
+
+	free(moves);
+
+	return best;
+}
+
+static int searchNode(SearchState *state, uint64_t const *board, uint64_t const *prevBoard, char brkrwrkr00, char whiteToMove, int depth, int ply, int alpha, int beta, char onPv, char const *move) {
+	state->pvLen[ply] = 0;
+
+	if (!depth || ply >= SEARCH_MAX_PLY)
+		return quiesce(state, board, prevBoard, brkrwrkr00, whiteToMove, ply, alpha, beta, move);
+
+	state->nodes++;
+	if (searchTimeUp(state))
+		return 0;
+
+	char *moves = NULL;
+	unsigned long len = validMoves(board, prevBoard, brkrwrkr00, whiteToMove, &moves) / 3;
+
+	if (!len)
+		return isCheckOnKing(board, whiteToMove) ? -SEARCH_MATE + ply : 0;
+
+	orderSearchMoves(state, board, moves, len, ply, onPv);
+
+	int best = -SEARCH_INFINITY;
+
+	for (unsigned long i = 0; i < len; i++) {
+		char *m = moves + i * 3;
+		uint64_t child[4];
+		char childRights = brkrwrkr00;
+
+		memcpy(child, board, sizeof child);
+		makeForcedMove(child, &childRights, m);
+
+		// Only the first move can still be on the previous line
+		int score = -searchNode(state, child, board, childRights, !whiteToMove, depth - 1, ply + 1, -beta, -alpha, onPv && !i, m);
+		if (state->stopped)
+			break;
+
+		if (score > best) {
+			best = score;
+
+			memcpy(state->pv[ply][0], m, 3);
+			memcpy(state->pv[ply] + 1, state->pv[ply + 1], state->pvLen[ply + 1] * 3);
+			state->pvLen[ply] = state->pvLen[ply + 1] + 1;
+		}
+		if (score > alpha)
+			alpha = score;
+		if (alpha >= beta)
+			break;
+	}
+
+	free(moves);
+
+	return best;
+}
+
+// Searches one iteration deeper at a time until limits run out, leaving the
+// last finished iteration in info. The position must pass
+// validSearchPosition. Returns 0 if the side to move has no moves, with
+// info->score telling mate from stalemate, or if it was stopped before the
+// first iteration finished (info->depth is 0 then).
+int searchPosition(uint64_t const *board, uint64_t const *prevBoard, char brkrwrkr00, char whiteToMove, SearchLimits const *limits, SearchInfo *info) {
+	SearchState *state = calloc(1, sizeof *state);
+	int maxDepth = limits->depth > 0 && limits->depth < SEARCH_MAX_PLY ? limits->depth : SEARCH_MAX_PLY;
+	static char const none[3] = {0, 0, 0};
+
+	memset(info, 0, sizeof *info);
+	state->startNs = searchClockNs();
+	state->stop = limits->stop;
+	if (limits->timeMs)
+		state->deadlineNs = state->startNs + (uint64_t) limits->timeMs * 1000000;
+
+	for (int depth = 1; depth <= maxDepth; depth++) {
+		int score = searchNode(state, board, prevBoard, brkrwrkr00, whiteToMove, depth, 0, -SEARCH_INFINITY, SEARCH_INFINITY, 1, none);
+
+		// An unfinished iteration may not have looked at its best move yet
+		if (state->stopped)
+			break;
+
+		uint64_t elapsedNs = searchClockNs() - state->startNs;
+
+		info->depth = depth;
+		info->score = score;
+		info->nodes = state->nodes;
+		info->timeUs = elapsedNs / 1000;
+		info->pvLen = state->pvLen[0];
+		memcpy(info->pv, state->pv[0], state->pvLen[0] * 3);
+
+		state->followLen = state->pvLen[0];
+		memcpy(state->follow, state->pv[0], state->pvLen[0] * 3);
+
+		if (limits->onIteration)
+			limits->onIteration(info, limits->data);
+
+		// No moves, a forced mate found, or the next iteration (several
+		// times this one) won't finish in time anyway
+		if (!info->pvLen || searchScoreMate(score) || state->stopped || (state->deadlineNs && state->startNs + elapsedNs * 2 >= state->deadlineNs))
+			break;
+	}
+
+	info->nodes = state->nodes;
+	free(state);
+
+	return info->pvLen > 0;
+}
+
+#endif /*__CHESS_SEARCH__*/
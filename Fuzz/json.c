@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../JSON Parser/JSON.h"
+#include "../JSON Parser/stream.h"
+#include "../Lichess/events.h"
+
+// Fuzz harness for every JSON entry point the bot feeds untrusted bytes to.
+// Built with -DFUZZ_LIBFUZZER it is a libFuzzer target; otherwise main reads
+// each file named on the command line (or stdin) and runs it once, which is
+// what AFL and crash replay need.
+//
+// Usage: Fuzz/json [input...]
+
+int LLVMFuzzerTestOneInput(uint8_t const *, size_t);
+
+static JSONKey fuzzKeys[] = {{"type"}, {"id"}, {"challenge"}, {"game"}};
+
+static void fuzzDocument(char const *str) {
+	static JSONDocument doc;
+	static int initialized;
+
+	if (!initialized) {
+		initJSONDocument(&doc);
+		for (unsigned int i = 0; i < 4; i++)
+			JSONInitKey(fuzzKeys + i);
+		initialized = 1;
+	}
+
+	JSON *root = parseJSONDocument(&doc, str);
+	if (!root)
+		return;
+
+	for (unsigned int i = 0; i < 4; i++) {
+		JSONContent value = JSONGetValueForJSONKey(fuzzKeys + i, root);
+		if (value.type == OBJECT)
+			JSONGetValueForJSONKey(fuzzKeys + 1, value.json);
+	}
+}
+
+// Feeds the input in chunks whose sizes come from the input itself, so the
+// fuzzer also explores lines split across transport reads
+static void fuzzStream(char const *data, size_t len) {
+	JSONStream stream;
+	size_t off = 0, lineLen;
+	char *line;
+
+	initJSONStream(&stream, 0);
+
+	while (off < len) {
+		size_t chunk = 1 + (unsigned char) data[off] % 97;
+		if (chunk > len - off)
+			chunk = len - off;
+
+		feedJSONStream(&stream, data + off, chunk);
+		off += chunk;
+
+		while ((line = nextJSONEvent(&stream, &lineLen))) {
+			GameEvent ev;
+			decodeGameEvent(line, lineLen, &ev);
+		}
+	}
+
+	if ((line = finishJSONStream(&stream, &lineLen))) {
+		GameEvent ev;
+		decodeGameEvent(line, lineLen, &ev);
+	}
+
+	freeJSONStream(&stream);
+}
+
+int LLVMFuzzerTestOneInput(uint8_t const *data, size_t len) {
+	// The parsers take NUL-terminated strings; decodeGameEvent gets an
+	// exact-size copy so reads past the end are caught
+	char *str = malloc(len + 1), *exact = malloc(len ? len : 1);
+	JSON *json = NULL;
+	GameEvent ev;
+
+	memcpy(str, data, len);
+	str[len] = 0;
+	memcpy(exact, data, len);
+
+	parseJSON(str, &json);
+	freeJSON(json);
+
+	fuzzDocument(str);
+	decodeGameEvent(exact, len, &ev);
+	fuzzStream(exact, len);
+
+	free(str);
+	free(exact);
+
+	return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+static int runFile(FILE *fp) {
+	size_t len = 0, cap = 4096, n;
+	uint8_t *data = malloc(cap);
+
+	while ((n = fread(data + len, 1, cap - len, fp)) > 0)
+		if ((len += n) == cap)
+			data = realloc(data, cap *= 2);
+
+	LLVMFuzzerTestOneInput(data, len);
+	free(data);
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		return runFile(stdin);
+
+	for (int i = 1; i < argc; i++) {
+		FILE *fp = fopen(argv[i], "rb");
+		if (!fp) {
+			fprintf(stderr, "Cannot read %s\n", argv[i]);
+			return -1;
+		}
+		runFile(fp);
+		fclose(fp);
+	}
+
+	return 0;
+}
+#endif
@@ -1,9 +1,20 @@
+#ifndef __JSON_PARSER__
+#define __JSON_PARSER__
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+
+#include "../Util/arena.h"
+#include "structural.h"
 
 #define isnumeric(c) (c >= '0' && c <= '9')
 
+// Objects with fewer members are looked up by comparing stored hashes
+#define JSON_INDEX_MIN 4
+// Documents nested deeper than this are rejected
+#define JSON_MAX_DEPTH 256
+
 struct JSON;
 struct Array;
 
@@ -23,6 +34,7 @@ typedef struct ArrayContent {
 
 typedef struct JSONContent {
 	char *name;
+	unsigned int hash; // JSONHash(name)
 	enum TYPE_T type;
 	union {
 		char *str;
@@ -42,31 +54,163 @@ typedef struct Array {
 typedef struct JSON {
 	unsigned int length;
 	struct JSONContent* contents;
+	unsigned int indexSize; // power of two, 0 when the object has no index
+	unsigned int *index; // open-addressed slots holding member index + 1, 0 = empty
 } JSON;
 
+// A key whose hash is computed once, for names that are looked up over and over
+typedef struct JSONKey {
+	char const *name;
+	unsigned int hash;
+} JSONKey;
+
+// A parsed document whose whole tree lives in one arena. Reparsing or
+// resetting the document releases the previous tree in O(1), and the arena's
+// memory is kept for the next document. The tree is built by walking the
+// structural index from findJSONStructurals, which is also kept between
+// documents.
+typedef struct JSONDocument {
+	Arena arena;
+	JSON *root;
+	uint32_t *structurals;
+	size_t structuralsCapacity;
+} JSONDocument;
+
+typedef struct JSONBuilder {
+	char const *str;
+	size_t len;
+	uint32_t const *structurals;
+	size_t count;
+	size_t next; // next structural to consume
+	Arena *arena;
+} JSONBuilder;
+
 unsigned int printArray(Array const *, unsigned int, unsigned int);
 unsigned int printJSON(JSON const *, unsigned int, unsigned int);
 unsigned int parseArray(char const *, Array **);
 unsigned int parseJSON(char const *, JSON **);
 unsigned int parseString(char const *, char **);
+unsigned int parseArrayIn(char const *, Array **, Arena *);
+unsigned int parseJSONIn(char const *, JSON **, Arena *);
+unsigned int parseStringIn(char const *, char **, Arena *);
 int JSONIndexOf(char const *, JSON const *);
+int JSONIndexOfKey(JSONKey const *, JSON const *);
 char *appendStringToString(char **, char const *);
 char *appendToString(char **, char);
 void freeJSON(JSON *);
 JSONContent JSONGetValueForKey(char const *, JSON const *);
+JSONContent JSONGetValueForJSONKey(JSONKey const *, JSON const *);
+unsigned int JSONHash(char const *);
+void JSONInitKey(JSONKey *);
+void buildJSONIndex(JSON *, Arena *);
+void initJSONDocument(JSONDocument *);
+JSON *parseJSONDocument(JSONDocument *, char const *);
+void resetJSONDocument(JSONDocument *);
+void freeJSONDocument(JSONDocument *);
+JSON *buildJSONObject(JSONBuilder *, unsigned int);
+Array *buildJSONArray(JSONBuilder *, unsigned int);
+
+// Allocates from the arena, or from the heap when there is none (freeJSON path)
+static inline void *jsonAlloc(Arena *arena, size_t size) {
+	return arena ? arenaAlloc(arena, size) : malloc(size);
+}
+
+// Never steps over the terminating NUL of truncated input
+static inline unsigned int skipJSONLiteral(char const *str, unsigned int len) {
+	unsigned int i = 0;
+	while (i < len && str[i])
+		i++;
+	return i;
+}
+
+// Makes room for one more element; capacity doubles so members aren't reallocated one by one
+static inline void *jsonReserve(Arena *arena, void *contents, unsigned int length, size_t size) {
+	unsigned int capacity;
+
+	if (!length)
+		capacity = 4;
+	else if (length >= 4 && !(length & (length - 1)))
+		capacity = length * 2;
+	else
+		return contents;
+
+	return arena ? arenaGrow(arena, contents, length * size, capacity * size) : realloc(contents, capacity * size);
+}
+
+// FNV-1a
+unsigned int JSONHash(char const *str) {
+	unsigned int hash = 2166136261u;
+
+	while (*str)
+		hash = (hash ^ (unsigned char) *(str++)) * 16777619u;
+
+	return hash;
+}
+
+void JSONInitKey(JSONKey *key) {
+	key->hash = JSONHash(key->name);
+}
+
+void buildJSONIndex(JSON *json, Arena *arena) {
+	if (json->length < JSON_INDEX_MIN)
+		return;
+
+	unsigned int size = 8;
+	while (size < json->length * 2)
+		size *= 2;
+
+	json->index = jsonAlloc(arena, size * sizeof(unsigned int));
+	memset(json->index, 0, size * sizeof(unsigned int));
+	json->indexSize = size;
+
+	// Duplicate names keep the first occurrence first in the probe chain
+	for (unsigned int i = 0; i < json->length; i++) {
+		unsigned int slot = json->contents[i].hash & (size - 1);
+		while (json->index[slot])
+			slot = (slot + 1) & (size - 1);
+		json->index[slot] = i + 1;
+	}
+}
+
+int JSONIndexOfKey(JSONKey const *key, JSON const *json) {
+	if (!json)
+		return -1;
 
-int JSONIndexOf(char const *str, JSON const *json) {
 	unsigned int i;
 
-	for (i = 0; i < json->length; i++)
-		if (!strcmp(json->contents[i].name, str)) return i;
+	if (!json->indexSize) {
+		for (i = 0; i < json->length; i++)
+			if (json->contents[i].hash == key->hash && !strcmp(json->contents[i].name, key->name)) return i;
+
+		return -1;
+	}
+
+	for (unsigned int slot = key->hash & (json->indexSize - 1); (i = json->index[slot]); slot = (slot + 1) & (json->indexSize - 1))
+		if (json->contents[i - 1].hash == key->hash && !strcmp(json->contents[i - 1].name, key->name)) return i - 1;
 
 	return -1;
 }
 
+int JSONIndexOf(char const *str, JSON const *json) {
+	JSONKey key = {str, JSONHash(str)};
+
+	return JSONIndexOfKey(&key, json);
+}
+
+// A missing key (or a NULL object) yields a NONE value whose pointers are NULL
+JSONContent JSONGetValueForJSONKey(JSONKey const *key, JSON const *json) {
+	int ind = JSONIndexOfKey(key, json);
+
+	if (ind == -1)
+		return (JSONContent) {.type = NONE};
+
+	return json->contents[ind];
+}
+
 JSONContent JSONGetValueForKey(char const *str, JSON const *json) {
-	// No error checking implemented
-	return json->contents[JSONIndexOf(str, json)];
+	JSONKey key = {str, JSONHash(str)};
+
+	return JSONGetValueForJSONKey(&key, json);
 }
 
 unsigned int printArray(Array const *arr, unsigned int indent, unsigned int depth) {
@@ -160,65 +304,77 @@ unsigned int printJSON(JSON const *json, unsigned int indent, unsigned int depth
 }
 
 unsigned int parseString(char const *jsonStr, char **str) {
-	int i = 0;
-	*str = NULL;
-	char escape = 0, lastEscape = 0;
+	return parseStringIn(jsonStr, str, NULL);
+}
 
-	while (jsonStr[i++] != '"');
-	while (1) {
-		lastEscape = escape;
-		escape = jsonStr[i] == '\\' && !lastEscape;
-		if (jsonStr[i] == '"' && !lastEscape)
-			break;
-		appendToString(str, jsonStr[i++]);
+unsigned int parseStringIn(char const *jsonStr, char **str, Arena *arena) {
+	unsigned int i = 0, start;
+	char escape = 0;
+
+	while (jsonStr[i] && jsonStr[i++] != '"');
+	start = i;
+	while (jsonStr[i] && (jsonStr[i] != '"' || escape)) {
+		escape = jsonStr[i] == '\\' && !escape;
+		i++;
 	}
 
+	*str = jsonAlloc(arena, i - start + 1);
+	memcpy(*str, jsonStr + start, i - start);
+	(*str)[i - start] = 0;
+
 	return i;
 }
 
 unsigned int parseArray(char const *arrStr, Array **arr) {
+	return parseArrayIn(arrStr, arr, NULL);
+}
+
+unsigned int parseArrayIn(char const *arrStr, Array **arr, Arena *arena) {
 	unsigned int i = 0;
 
-	while (arrStr[i++] != '[');
+	while (arrStr[i] && arrStr[i++] != '[');
 	
-	*arr = malloc(sizeof(Array));
+	*arr = jsonAlloc(arena, sizeof(Array));
 	memset(*arr, 0, sizeof(Array));
 	while (1) {
-		while (arrStr[i] != '"' && arrStr[i] != 'n' && arrStr[i] != 't' && arrStr[i] != 'f' && arrStr[i] != '.' && arrStr[i] != '-' && !isnumeric(arrStr[i]) && arrStr[i] != '[' && arrStr[i] != '{' && arrStr[i] != ']') i++;
-		if (arrStr[i] == ']')
+		while (arrStr[i] && arrStr[i] != '"' && arrStr[i] != 'n' && arrStr[i] != 't' && arrStr[i] != 'f' && arrStr[i] != '.' && arrStr[i] != '-' && !isnumeric(arrStr[i]) && arrStr[i] != '[' && arrStr[i] != '{' && arrStr[i] != ']') i++;
+		if (arrStr[i] == ']' || !arrStr[i])
 			break;
 
+		(*arr)->contents = jsonReserve(arena, (*arr)->contents, (*arr)->length, sizeof(ArrayContent));
 		(*arr)->length++;
-		(*arr)->contents = realloc((*arr)->contents, (*arr)->length * sizeof(ArrayContent));
 		
-		memset((*arr)->contents + ((*arr)->length - 1), 0, sizeof(JSONContent));
+		memset((*arr)->contents + ((*arr)->length - 1), 0, sizeof(ArrayContent));
 
 		switch (arrStr[i]) {
 			case '"': {
 				(*arr)->contents[(*arr)->length - 1].type = STRING;
-				i += parseString(arrStr + i, &(*arr)->contents[(*arr)->length - 1].str) + 1;
+				i += parseStringIn(arrStr + i, &(*arr)->contents[(*arr)->length - 1].str, arena);
+				i += !!arrStr[i];
 			} break;
 			case '{': {
 				(*arr)->contents[(*arr)->length - 1].type = OBJECT;
-				i += parseJSON(arrStr + i, &((*arr)->contents[(*arr)->length - 1].json)) + 1;
+				i += parseJSONIn(arrStr + i, &((*arr)->contents[(*arr)->length - 1].json), arena);
+				i += !!arrStr[i];
 			} break;
 			case '[': {
 				(*arr)->contents[(*arr)->length - 1].type = ARRAY;
-				i += parseArray(arrStr + i, &((*arr)->contents[(*arr)->length - 1].array)) + 1;
+				i += parseArrayIn(arrStr + i, &((*arr)->contents[(*arr)->length - 1].array), arena);
+				i += !!arrStr[i];
 			} break;
 			case 't': {
-				i += 4;
+				i += skipJSONLiteral(arrStr + i, 4);
 				(*arr)->contents[(*arr)->length - 1].type = TRUEORFALSE;
 				(*arr)->contents[(*arr)->length - 1].trueorfalse = 1;
 			} break;
 			case 'f': {
-				i += 5;
+				i += skipJSONLiteral(arrStr + i, 5);
 				(*arr)->contents[(*arr)->length - 1].type = TRUEORFALSE;
 				(*arr)->contents[(*arr)->length - 1].trueorfalse = 0;
 			} break;
 			case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9': case '0': case '.': case '-': {
 				(*arr)->contents[(*arr)->length - 1].type = NUMBER;
-				int num = 0;
+				double num = 0;
 				char minus = (arrStr[i] == '-');
 				i += minus;
 				if (arrStr[i] != '.')
@@ -226,15 +382,15 @@ unsigned int parseArray(char const *arrStr, Array **arr) {
 						num = num * 10 + arrStr[i++] - '0';
 				if (arrStr[i] == '.') {
 					i++;
-					int exp = 1;
+					double exp = 1;
 					while (isnumeric(arrStr[i]))
-						num += (arrStr[i++] - '0') / (double) (exp *= 10);
+						num += (arrStr[i++] - '0') / (exp *= 10);
 				}
 				num *= ((signed char) minus) * -2 + 1; // negate if required
 				(*arr)->contents[(*arr)->length - 1].number = num;
 			} break;
 			case 'n': {
-				i += 4;
+				i += skipJSONLiteral(arrStr + i, 4);
 				(*arr)->contents[(*arr)->length - 1].type = NONE;
 				(*arr)->contents[(*arr)->length - 1].none = 1;
 			} break;
@@ -245,46 +401,55 @@ unsigned int parseArray(char const *arrStr, Array **arr) {
 }
 
 unsigned int parseJSON(char const *jsonStr, JSON **json) {
+	return parseJSONIn(jsonStr, json, NULL);
+}
+
+unsigned int parseJSONIn(char const *jsonStr, JSON **json, Arena *arena) {
 	unsigned int i = 0;
 
-	while (jsonStr[i++] != '{');
+	while (jsonStr[i] && jsonStr[i++] != '{');
 
-	*json = malloc(sizeof(JSON));
+	*json = jsonAlloc(arena, sizeof(JSON));
 	memset(*json, 0, sizeof(JSON));
 	while (1) {
-		while (jsonStr[i] != '"' && jsonStr[i] != '}') i++;
-		if (jsonStr[i] == '}')
+		while (jsonStr[i] && jsonStr[i] != '"' && jsonStr[i] != '}') i++;
+		if (jsonStr[i] == '}' || !jsonStr[i])
 			break;
+		(*json)->contents = jsonReserve(arena, (*json)->contents, (*json)->length, sizeof(JSONContent));
 		(*json)->length++;
-		(*json)->contents = realloc((*json)->contents, (*json)->length * sizeof(JSONContent));
 		
 		memset((*json)->contents + ((*json)->length - 1), 0, sizeof(JSONContent));
 
-		i += parseString(jsonStr + i, &((*json)->contents[(*json)->length - 1].name)) + 1;
+		i += parseStringIn(jsonStr + i, &((*json)->contents[(*json)->length - 1].name), arena);
+		i += !!jsonStr[i];
+		(*json)->contents[(*json)->length - 1].hash = JSONHash((*json)->contents[(*json)->length - 1].name);
 
-		while (jsonStr[i] != ':') i++;
-		while (jsonStr[i] != '{' && jsonStr[i] != '[' && jsonStr[i] != '"' && jsonStr[i] != 't' && jsonStr[i] != 'f' && jsonStr[i] != 'n' && !isnumeric(jsonStr[i]) && jsonStr[i] != '.' && jsonStr[i] != '-') i++;
+		while (jsonStr[i] && jsonStr[i] != ':') i++;
+		while (jsonStr[i] && jsonStr[i] != '{' && jsonStr[i] != '[' && jsonStr[i] != '"' && jsonStr[i] != 't' && jsonStr[i] != 'f' && jsonStr[i] != 'n' && !isnumeric(jsonStr[i]) && jsonStr[i] != '.' && jsonStr[i] != '-') i++;
 
 		switch (jsonStr[i]) {
 			case '"': {
 				(*json)->contents[(*json)->length - 1].type = STRING;
-				i += parseString(jsonStr + i, &(*json)->contents[(*json)->length - 1].str) + 1;
+				i += parseStringIn(jsonStr + i, &(*json)->contents[(*json)->length - 1].str, arena);
+				i += !!jsonStr[i];
 			} break;
 			case '{': {
 				(*json)->contents[(*json)->length - 1].type = OBJECT;
-				i += parseJSON(jsonStr + i, &((*json)->contents[(*json)->length - 1].json)) + 1;
+				i += parseJSONIn(jsonStr + i, &((*json)->contents[(*json)->length - 1].json), arena);
+				i += !!jsonStr[i];
 			} break;
 			case '[': {
 				(*json)->contents[(*json)->length - 1].type = ARRAY;
-				i += parseArray(jsonStr + i, &((*json)->contents[(*json)->length - 1].array)) + 1;
+				i += parseArrayIn(jsonStr + i, &((*json)->contents[(*json)->length - 1].array), arena);
+				i += !!jsonStr[i];
 			} break;
 			case 't': {
-				i += 4;
+				i += skipJSONLiteral(jsonStr + i, 4);
 				(*json)->contents[(*json)->length - 1].type = TRUEORFALSE;
 				(*json)->contents[(*json)->length - 1].trueorfalse = 1;
 			} break;
 			case 'f': {
-				i += 5;
+				i += skipJSONLiteral(jsonStr + i, 5);
 				(*json)->contents[(*json)->length - 1].type = TRUEORFALSE;
 				(*json)->contents[(*json)->length - 1].trueorfalse = 0;
 			} break;
@@ -298,28 +463,30 @@ unsigned int parseJSON(char const *jsonStr, JSON **json) {
 						num = num * 10 + jsonStr[i++] - '0';
 				if (jsonStr[i] == '.') {
 					i++;
-					int exp = 1;
+					double exp = 1;
 					while (isnumeric(jsonStr[i]))
-						num += (jsonStr[i++] - '0') / (double) (exp *= 10);
+						num += (jsonStr[i++] - '0') / (exp *= 10);
 				}
 				num *= ((signed char) minus) * -2 + 1; // negate if required
 				(*json)->contents[(*json)->length - 1].number = num;
 			} break;
 			case 'n': {
-				i += 4;
+				i += skipJSONLiteral(jsonStr + i, 4);
 				(*json)->contents[(*json)->length - 1].type = NONE;
 				(*json)->contents[(*json)->length - 1].none = 1;
 			} break;
 		}
 
-		while (jsonStr[i] != ',' && jsonStr[i] != '}') i++;
+		while (jsonStr[i] && jsonStr[i] != ',' && jsonStr[i] != '}') i++;
 
-		if (jsonStr[i] == '}')
+		if (jsonStr[i] == '}' || !jsonStr[i])
 			break;
 
 		i++;
 	}
 
+	buildJSONIndex(*json, arena);
+
 	return i;
 }
 
@@ -392,5 +559,247 @@ void freeJSON(JSON *json) {
 	}
 
 	free(json->contents);
+	free(json->index);
 	free(json);
-}
\ No newline at end of file
+}
+
+static char *buildJSONString(JSONBuilder *b, size_t quote) {
+	size_t end = quote + 1;
+
+	while (1) {
+		char const *q = memchr(b->str + end, '"', b->len - end);
+		if (!q)
+			return NULL;
+
+		end = q - b->str;
+		size_t backslashes = 0;
+		while (end - backslashes > quote + 1 && b->str[end - backslashes - 1] == '\\')
+			backslashes++;
+		if (!(backslashes & 1))
+			break;
+		end++;
+	}
+
+	return arenaStrndup(b->arena, b->str + quote + 1, end - quote - 1);
+}
+
+static size_t buildJSONNumber(char const *str, double *num) {
+	size_t i = 0, digits = 0;
+	char minus = str[i] == '-';
+	i += minus;
+
+	*num = 0;
+	while (isnumeric(str[i])) {
+		*num = *num * 10 + str[i++] - '0';
+		digits++;
+	}
+
+	if (str[i] == '.') {
+		i++;
+		double exp = 1;
+		while (isnumeric(str[i])) {
+			*num += (str[i++] - '0') / (exp *= 10);
+			digits++;
+		}
+	}
+
+	if (!digits)
+		return 0;
+
+	if (str[i] == 'e' || str[i] == 'E') {
+		i++;
+		char expMinus = str[i] == '-';
+		i += expMinus || str[i] == '+';
+		int e = 0;
+		while (isnumeric(str[i]) && e < 400)
+			e = e * 10 + str[i++] - '0';
+		while (isnumeric(str[i]))
+			i++;
+		while (e--)
+			*num = expMinus ? *num / 10 : *num * 10;
+	}
+
+	if (minus)
+		*num = -*num;
+
+	return i;
+}
+
+// Fills value from the structural at b->next and consumes it
+static int buildJSONValue(JSONBuilder *b, ArrayContent *value, unsigned int depth) {
+	if (b->next >= b->count)
+		return 0;
+
+	size_t p = b->structurals[b->next++];
+	char const *str = b->str + p;
+
+	switch (*str) {
+		case '"': {
+			value->type = STRING;
+			return !!(value->str = buildJSONString(b, p));
+		}
+		case '{': {
+			value->type = OBJECT;
+			return !!(value->json = buildJSONObject(b, depth + 1));
+		}
+		case '[': {
+			value->type = ARRAY;
+			return !!(value->array = buildJSONArray(b, depth + 1));
+		}
+		case 't': {
+			value->type = TRUEORFALSE;
+			value->trueorfalse = 1;
+			return b->len - p >= 4 && !memcmp(str, "true", 4);
+		}
+		case 'f': {
+			value->type = TRUEORFALSE;
+			value->trueorfalse = 0;
+			return b->len - p >= 5 && !memcmp(str, "false", 5);
+		}
+		case 'n': {
+			value->type = NONE;
+			value->none = 1;
+			return b->len - p >= 4 && !memcmp(str, "null", 4);
+		}
+		case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9': case '0': case '.': case '-': {
+			value->type = NUMBER;
+			return !!buildJSONNumber(str, &value->number);
+		}
+	}
+
+	return 0;
+}
+
+static inline char nextJSONStructural(JSONBuilder const *b) {
+	return b->next < b->count ? b->str[b->structurals[b->next]] : 0;
+}
+
+// Called with the opening brace already consumed
+JSON *buildJSONObject(JSONBuilder *b, unsigned int depth) {
+	if (depth > JSON_MAX_DEPTH)
+		return NULL;
+
+	JSON *json = arenaAlloc(b->arena, sizeof(JSON));
+	memset(json, 0, sizeof(JSON));
+
+	if (nextJSONStructural(b) == '}') {
+		b->next++;
+		return json;
+	}
+
+	while (1) {
+		if (nextJSONStructural(b) != '"')
+			return NULL;
+
+		json->contents = jsonReserve(b->arena, json->contents, json->length, sizeof(JSONContent));
+		JSONContent *content = json->contents + json->length++;
+		ArrayContent value;
+
+		if (!(content->name = buildJSONString(b, b->structurals[b->next++])))
+			return NULL;
+		content->hash = JSONHash(content->name);
+
+		if (nextJSONStructural(b) != ':')
+			return NULL;
+		b->next++;
+
+		if (!buildJSONValue(b, &value, depth))
+			return NULL;
+
+		content->type = value.type;
+		switch (value.type) {
+			case STRING: content->str = value.str; break;
+			case NUMBER: content->number = value.number; break;
+			case OBJECT: content->json = value.json; break;
+			case ARRAY: content->array = value.array; break;
+			case TRUEORFALSE: content->trueorfalse = value.trueorfalse; break;
+			case NONE: content->none = value.none; break;
+		}
+
+		char c = nextJSONStructural(b);
+		b->next++;
+		if (c == '}')
+			break;
+		if (c != ',')
+			return NULL;
+	}
+
+	buildJSONIndex(json, b->arena);
+
+	return json;
+}
+
+// Called with the opening bracket already consumed
+Array *buildJSONArray(JSONBuilder *b, unsigned int depth) {
+	if (depth > JSON_MAX_DEPTH)
+		return NULL;
+
+	Array *arr = arenaAlloc(b->arena, sizeof(Array));
+	memset(arr, 0, sizeof(Array));
+
+	if (nextJSONStructural(b) == ']') {
+		b->next++;
+		return arr;
+	}
+
+	while (1) {
+		arr->contents = jsonReserve(b->arena, arr->contents, arr->length, sizeof(ArrayContent));
+
+		if (!buildJSONValue(b, arr->contents + arr->length++, depth))
+			return NULL;
+
+		char c = nextJSONStructural(b);
+		b->next++;
+		if (c == ']')
+			break;
+		if (c != ',')
+			return NULL;
+	}
+
+	return arr;
+}
+
+void initJSONDocument(JSONDocument *doc) {
+	arenaInit(&doc->arena, 0);
+	doc->root = NULL;
+	doc->structurals = NULL;
+	doc->structuralsCapacity = 0;
+}
+
+// Returns NULL on malformed input
+JSON *parseJSONDocument(JSONDocument *doc, char const *jsonStr) {
+	size_t len = strlen(jsonStr);
+	int unclosed;
+
+	resetJSONDocument(doc);
+
+	if (doc->structuralsCapacity < len + 1) {
+		free(doc->structurals);
+		doc->structuralsCapacity = len + 1 > 4096 ? len + 1 : 4096;
+		doc->structurals = malloc(doc->structuralsCapacity * sizeof(uint32_t));
+	}
+
+	JSONBuilder b = {jsonStr, len, doc->structurals, 0, 0, &doc->arena};
+	b.count = findJSONStructurals(jsonStr, len, doc->structurals, &unclosed);
+
+	if (unclosed || nextJSONStructural(&b) != '{')
+		return NULL;
+	b.next++;
+
+	return doc->root = buildJSONObject(&b, 0);
+}
+
+void resetJSONDocument(JSONDocument *doc) {
+	arenaReset(&doc->arena);
+	doc->root = NULL;
+}
+
+void freeJSONDocument(JSONDocument *doc) {
+	arenaFree(&doc->arena);
+	free(doc->structurals);
+	doc->root = NULL;
+	doc->structurals = NULL;
+	doc->structuralsCapacity = 0;
+}
+
+#endif /*__JSON_PARSER__*/
@@ -0,0 +1,166 @@
+#ifndef __JSON_STREAM__
+#define __JSON_STREAM__
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+// Resumable decoder for newline-delimited JSON (lichess streams one document
+// per line, plus bare newlines as keep-alives). Chunks are pushed in as they
+// arrive, however the transport split them, and complete lines are pulled out
+// with nextJSONEvent. Bytes live in a ring buffer that is reused for the whole
+// connection and every byte is searched for a newline only once.
+
+#define JSON_STREAM_DEFAULT_CAPACITY 16384
+
+typedef struct JSONStream {
+	char *buf;
+	size_t capacity; // power of two
+	size_t head; // offset of the first unconsumed byte
+	size_t tail; // offset past the last byte pushed
+	size_t scanned; // bytes in [head, scanned) hold no newline
+	char *line; // scratch for lines that wrap around the end of buf
+	size_t lineCapacity;
+} JSONStream;
+
+void initJSONStream(JSONStream *, size_t);
+int feedJSONStream(JSONStream *, char const *, size_t);
+char *nextJSONEvent(JSONStream *, size_t *);
+char *finishJSONStream(JSONStream *, size_t *);
+void freeJSONStream(JSONStream *);
+
+// Offsets grow forever; they're reduced modulo capacity when indexing
+#define jsonStreamAt(s, off) ((s)->buf + ((off) & ((s)->capacity - 1)))
+
+void initJSONStream(JSONStream *stream, size_t capacity) {
+	size_t cap = JSON_STREAM_DEFAULT_CAPACITY;
+	while (cap < capacity)
+		cap *= 2;
+
+	stream->buf = malloc(cap);
+	stream->capacity = cap;
+	stream->head = stream->tail = stream->scanned = 0;
+	stream->line = NULL;
+	stream->lineCapacity = 0;
+}
+
+// Returns 0 if the buffer could not grow
+int feedJSONStream(JSONStream *stream, char const *data, size_t len) {
+	size_t used = stream->tail - stream->head;
+
+	if (stream->capacity - used < len) {
+		size_t cap = stream->capacity;
+		while (cap - used < len)
+			cap *= 2;
+
+		char *buf = malloc(cap);
+		if (!buf)
+			return 0;
+
+		// Unwrap the pending bytes to the start of the new buffer
+		size_t start = stream->head & (stream->capacity - 1);
+		size_t first = used < stream->capacity - start ? used : stream->capacity - start;
+		memcpy(buf, stream->buf + start, first);
+		memcpy(buf + first, stream->buf, used - first);
+
+		free(stream->buf);
+		stream->buf = buf;
+		stream->capacity = cap;
+		stream->scanned -= stream->head;
+		stream->head = 0;
+		stream->tail = used;
+	}
+
+	size_t start = stream->tail & (stream->capacity - 1);
+	size_t first = len < stream->capacity - start ? len : stream->capacity - start;
+	memcpy(stream->buf + start, data, first);
+	memcpy(stream->buf, data + first, len - first);
+	stream->tail += len;
+
+	return 1;
+}
+
+// Makes the first len bytes contiguous and NUL-terminated, consumes
+// consumed bytes (the line and its terminator) and returns the line
+static char *takeJSONStreamLine(JSONStream *stream, size_t len, size_t consumed, size_t *outLen) {
+	size_t start = stream->head & (stream->capacity - 1);
+	char *line;
+
+	while (len && *jsonStreamAt(stream, stream->head + len - 1) == '\r')
+		len--;
+
+	// The byte after the line is its newline, a trimmed '\r' or free space
+	if (start + len < stream->capacity)
+		line = stream->buf + start;
+	else {
+		if (stream->lineCapacity < len + 1) {
+			free(stream->line);
+			stream->lineCapacity = len + 1 > 256 ? len + 1 : 256;
+			stream->line = malloc(stream->lineCapacity);
+		}
+
+		size_t first = stream->capacity - start;
+		memcpy(stream->line, stream->buf + start, first);
+		memcpy(stream->line + first, stream->buf, len - first);
+		line = stream->line;
+	}
+
+	line[len] = 0;
+	if (outLen)
+		*outLen = len;
+	stream->head += consumed;
+	if (stream->scanned < stream->head)
+		stream->scanned = stream->head;
+
+	return line;
+}
+
+// Returns the next complete line, or NULL when more bytes are needed. Empty
+// lines are skipped. The line is valid until the next call on the stream.
+char *nextJSONEvent(JSONStream *stream, size_t *len) {
+	while (stream->scanned < stream->tail) {
+		size_t start = stream->scanned & (stream->capacity - 1);
+		size_t avail = stream->tail - stream->scanned;
+		if (avail > stream->capacity - start)
+			avail = stream->capacity - start;
+
+		char const *nl = memchr(stream->buf + start, '\n', avail);
+		if (!nl) {
+			stream->scanned += avail;
+			continue;
+		}
+
+		stream->scanned += nl - (stream->buf + start);
+
+		size_t lineLen = stream->scanned - stream->head;
+		char first = lineLen ? *jsonStreamAt(stream, stream->head) : '\n';
+
+		// Keep-alive: drop the empty line and its newline without copying
+		if (!lineLen || (lineLen == 1 && first == '\r')) {
+			stream->head = ++stream->scanned;
+			continue;
+		}
+
+		return takeJSONStreamLine(stream, lineLen, lineLen + 1, len);
+	}
+
+	return NULL;
+}
+
+// Returns whatever is left after the last newline (for responses that are a
+// single unterminated document), or NULL if nothing is left
+char *finishJSONStream(JSONStream *stream, size_t *len) {
+	if (stream->head == stream->tail)
+		return NULL;
+
+	return takeJSONStreamLine(stream, stream->tail - stream->head, stream->tail - stream->head, len);
+}
+
+void freeJSONStream(JSONStream *stream) {
+	free(stream->buf);
+	free(stream->line);
+	stream->buf = stream->line = NULL;
+	stream->capacity = stream->lineCapacity = 0;
+	stream->head = stream->tail = stream->scanned = 0;
+}
+
+#endif /*__JSON_STREAM__*/
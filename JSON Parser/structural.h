@@ -0,0 +1,191 @@
+#ifndef __JSON_STRUCTURAL__
+#define __JSON_STRUCTURAL__
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define JSON_STRUCTURAL_X86
+#include <immintrin.h>
+#endif
+
+// Stage 1 of the document parser: one pass over the input, 64 bytes at a
+// time, producing the offsets of every structural character ({ } [ ] : ,),
+// every opening quote and the first byte of every other scalar, all outside
+// of strings. The tree builder then walks these offsets instead of the text.
+
+typedef struct JSONBlockMasks {
+	uint64_t quote;
+	uint64_t backslash;
+	uint64_t op; // { } [ ] : ,
+	uint64_t whitespace;
+} JSONBlockMasks;
+
+typedef struct JSONStructuralState {
+	uint64_t escapeCarry; // 1 when the previous block ended with an unescaped backslash
+	uint64_t inString; // all ones when the previous block ended inside a string
+	uint64_t scalarCarry; // 1 when the previous block ended inside a scalar
+} JSONStructuralState;
+
+size_t findJSONStructurals(char const *, size_t, uint32_t *, int *);
+
+static inline void classifyJSONBlockScalar(unsigned char const *block, JSONBlockMasks *masks) {
+	memset(masks, 0, sizeof *masks);
+
+	for (unsigned int i = 0; i < 64; i++) {
+		uint64_t bit = (uint64_t) 1 << i;
+		switch (block[i]) {
+			case '"': masks->quote |= bit; break;
+			case '\\': masks->backslash |= bit; break;
+			case '{': case '}': case '[': case ']': case ':': case ',': masks->op |= bit; break;
+			case ' ': case '\t': case '\n': case '\r': masks->whitespace |= bit; break;
+		}
+	}
+}
+
+#ifdef JSON_STRUCTURAL_X86
+static inline void classifyJSONBlockSSE2(unsigned char const *block, JSONBlockMasks *masks) {
+	uint64_t quote = 0, backslash = 0, op = 0, whitespace = 0;
+
+	for (unsigned int i = 0; i < 4; i++) {
+		__m128i c = _mm_loadu_si128((__m128i const *) (block + i * 16));
+		// '[' | 0x20 == '{' and ']' | 0x20 == '}'
+		__m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+
+		uint64_t q = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('"')));
+		uint64_t b = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('\\')));
+		uint64_t o = (uint16_t) _mm_movemask_epi8(_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lower, _mm_set1_epi8('}'))),
+			_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(':')), _mm_cmpeq_epi8(c, _mm_set1_epi8(',')))));
+		uint64_t w = (uint16_t) _mm_movemask_epi8(_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\t'))),
+			_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\r')))));
+
+		quote |= q << (i * 16);
+		backslash |= b << (i * 16);
+		op |= o << (i * 16);
+		whitespace |= w << (i * 16);
+	}
+
+	masks->quote = quote;
+	masks->backslash = backslash;
+	masks->op = op;
+	masks->whitespace = whitespace;
+}
+
+__attribute__((target("avx2")))
+static void classifyJSONBlockAVX2(unsigned char const *block, JSONBlockMasks *masks) {
+	uint64_t quote = 0, backslash = 0, op = 0, whitespace = 0;
+
+	for (unsigned int i = 0; i < 2; i++) {
+		__m256i c = _mm256_loadu_si256((__m256i const *) (block + i * 32));
+		__m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+
+		uint64_t q = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('"')));
+		uint64_t b = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\\')));
+		uint64_t o = (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('}'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8(',')))));
+		uint64_t w = (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\t'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\r')))));
+
+		quote |= q << (i * 32);
+		backslash |= b << (i * 32);
+		op |= o << (i * 32);
+		whitespace |= w << (i * 32);
+	}
+
+	masks->quote = quote;
+	masks->backslash = backslash;
+	masks->op = op;
+	masks->whitespace = whitespace;
+}
+#endif
+
+// Bits of characters escaped by a backslash. Backslashes are rare in lichess
+// payloads, so walking them one by one beats the branchless carry trick.
+static inline uint64_t findJSONEscaped(uint64_t backslash, JSONStructuralState *state) {
+	uint64_t escaped = state->escapeCarry;
+	state->escapeCarry = 0;
+
+	backslash &= ~escaped;
+	while (backslash) {
+		unsigned int p = __builtin_ctzll(backslash);
+		backslash &= backslash - 1;
+		if (p == 63)
+			state->escapeCarry = 1;
+		else {
+			escaped |= (uint64_t) 1 << (p + 1);
+			backslash &= ~((uint64_t) 1 << (p + 1));
+		}
+	}
+
+	return escaped;
+}
+
+static inline uint64_t prefixXor(uint64_t x) {
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+static inline uint64_t findJSONBlockStructurals(JSONBlockMasks const *masks, JSONStructuralState *state) {
+	uint64_t quote = masks->quote & ~findJSONEscaped(masks->backslash, state);
+
+	// Opening quote and string body are set, closing quote is not
+	uint64_t inString = prefixXor(quote) ^ state->inString;
+	state->inString = (uint64_t) ((int64_t) inString >> 63);
+
+	uint64_t string = inString | quote;
+	uint64_t scalar = ~(masks->op | masks->whitespace | string);
+	uint64_t scalarStart = scalar & ~((scalar << 1) | state->scalarCarry);
+	state->scalarCarry = scalar >> 63;
+
+	return (masks->op & ~string) | (quote & inString) | scalarStart;
+}
+
+static inline size_t flattenJSONStructurals(uint64_t bits, uint32_t base, uint32_t *out, size_t n) {
+	while (bits) {
+		out[n++] = base + __builtin_ctzll(bits);
+		bits &= bits - 1;
+	}
+	return n;
+}
+
+// Writes at most len + 1 offsets to out and returns their count. *unclosed is
+// set when the input ends inside a string.
+size_t findJSONStructurals(char const *str, size_t len, uint32_t *out, int *unclosed) {
+	void (*classify)(unsigned char const *, JSONBlockMasks *) = classifyJSONBlockScalar;
+	JSONStructuralState state = {0, 0, 0};
+	JSONBlockMasks masks;
+	size_t n = 0, i = 0;
+
+	#ifdef JSON_STRUCTURAL_X86
+		if (len >= 64)
+			classify = __builtin_cpu_supports("avx2") ? classifyJSONBlockAVX2 : classifyJSONBlockSSE2;
+	#endif
+
+	for (; i + 64 <= len; i += 64) {
+		classify((unsigned char const *) str + i, &masks);
+		n = flattenJSONStructurals(findJSONBlockStructurals(&masks, &state), i, out, n);
+	}
+
+	if (i < len) {
+		unsigned char tail[64];
+		memset(tail, ' ', 64);
+		memcpy(tail, str + i, len - i);
+		classifyJSONBlockScalar(tail, &masks);
+		n = flattenJSONStructurals(findJSONBlockStructurals(&masks, &state), i, out, n);
+	}
+
+	*unclosed = !!state.inString;
+
+	return n;
+}
+
+#endif /*__JSON_STRUCTURAL__*/
@@ -0,0 +1,252 @@
+#ifndef __LICHESS_EVENTS__
+#define __LICHESS_EVENTS__
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+// Single-pass decoder for the two game stream events the bot acts on,
+// gameFull and gameState. Only the fields below are extracted; everything
+// else is skipped without being materialized. Strings point into the input
+// (escapes are left as they are; none of these fields contain any), so the
+// input must outlive the GameEvent.
+
+enum gameEventType {GAME_EVENT_OTHER, GAME_EVENT_FULL, GAME_EVENT_STATE};
+
+typedef struct GameEventString {
+	char const *str;
+	size_t len;
+} GameEventString;
+
+typedef struct GameEvent {
+	enum gameEventType type;
+	GameEventString moves;
+	GameEventString status;
+	GameEventString whiteId; // gameFull only
+	GameEventString blackId; // gameFull only
+	GameEventString initialFen; // gameFull only
+	long wtime, btime, winc, binc; // milliseconds, -1 when absent
+} GameEvent;
+
+typedef struct GameEventScanner {
+	char const *str;
+	char const *end;
+} GameEventScanner;
+
+enum gameEventScope {SCOPE_ROOT, SCOPE_STATE, SCOPE_WHITE, SCOPE_BLACK, SCOPE_SKIP};
+
+int decodeGameEvent(char const *, size_t, GameEvent *);
+static int scanGameEventObject(GameEventScanner *, GameEvent *, enum gameEventScope, unsigned int);
+
+#define gameEventKeyIs(key, keyLen, lit) ((keyLen) == sizeof(lit) - 1 && !memcmp((key), (lit), sizeof(lit) - 1))
+
+static inline void skipGameEventSpace(GameEventScanner *s) {
+	while (s->str < s->end && (*s->str == ' ' || *s->str == '\t' || *s->str == '\n' || *s->str == '\r'))
+		s->str++;
+}
+
+// Expects the opening quote, leaves the scanner past the closing one
+static int scanGameEventString(GameEventScanner *s, GameEventString *out) {
+	char const *start = ++s->str;
+
+	while (1) {
+		char const *q = memchr(s->str, '"', s->end - s->str);
+		if (!q)
+			return 0;
+
+		char const *b = q;
+		while (b > start && b[-1] == '\\')
+			b--;
+
+		s->str = q + 1;
+		if (!((q - b) & 1))
+			break;
+	}
+
+	if (out) {
+		out->str = start;
+		out->len = s->str - 1 - start;
+	}
+
+	return 1;
+}
+
+static int scanGameEventNumber(GameEventScanner *s, long *out) {
+	char const *start = s->str;
+	long num = 0;
+	char minus = *s->str == '-';
+
+	s->str += minus;
+	while (s->str < s->end && *s->str >= '0' && *s->str <= '9')
+		num = num * 10 + *(s->str++) - '0';
+
+	// Fractions and exponents aren't expected in these fields; drop them
+	while (s->str < s->end && (*s->str == '.' || *s->str == 'e' || *s->str == 'E' || *s->str == '+' || *s->str == '-' || (*s->str >= '0' && *s->str <= '9')))
+		s->str++;
+
+	if (s->str == start + minus)
+		return 0;
+
+	if (out)
+		*out = minus ? -num : num;
+
+	return 1;
+}
+
+// Skips any value, including nested containers
+static int skipGameEventValue(GameEventScanner *s, unsigned int depth) {
+	if (s->str >= s->end)
+		return 0;
+
+	switch (*s->str) {
+		case '"':
+			return scanGameEventString(s, NULL);
+		case '{':
+			return scanGameEventObject(s, NULL, SCOPE_SKIP, depth + 1);
+		case '[': {
+			if (depth > 64)
+				return 0;
+
+			s->str++;
+			skipGameEventSpace(s);
+			if (s->str < s->end && *s->str == ']') {
+				s->str++;
+				return 1;
+			}
+
+			while (1) {
+				skipGameEventSpace(s);
+				if (!skipGameEventValue(s, depth + 1))
+					return 0;
+				skipGameEventSpace(s);
+				if (s->str >= s->end)
+					return 0;
+				if (*(s->str++) == ']')
+					return 1;
+				if (s->str[-1] != ',')
+					return 0;
+			}
+		}
+		case 't': case 'n': {
+			if (s->end - s->str < 4)
+				return 0;
+			s->str += 4;
+			return 1;
+		}
+		case 'f': {
+			if (s->end - s->str < 5)
+				return 0;
+			s->str += 5;
+			return 1;
+		}
+	}
+
+	return scanGameEventNumber(s, NULL);
+}
+
+static int scanGameEventField(GameEventScanner *s, GameEvent *ev, enum gameEventScope scope, char const *key, size_t keyLen, unsigned int depth) {
+	GameEventString *str = NULL;
+	long *num = NULL;
+
+	if (scope == SCOPE_ROOT || scope == SCOPE_STATE) {
+		switch (keyLen) {
+			case 4:
+				if (gameEventKeyIs(key, keyLen, "type") && scope == SCOPE_ROOT) {
+					GameEventString type;
+					if (*s->str != '"' || !scanGameEventString(s, &type))
+						return 0;
+					if (gameEventKeyIs(type.str, type.len, "gameFull"))
+						ev->type = GAME_EVENT_FULL;
+					else if (gameEventKeyIs(type.str, type.len, "gameState"))
+						ev->type = GAME_EVENT_STATE;
+					return 1;
+				}
+				num = gameEventKeyIs(key, keyLen, "winc") ? &ev->winc : gameEventKeyIs(key, keyLen, "binc") ? &ev->binc : NULL;
+				break;
+			case 5:
+				if (gameEventKeyIs(key, keyLen, "moves"))
+					str = &ev->moves;
+				else if (gameEventKeyIs(key, keyLen, "wtime"))
+					num = &ev->wtime;
+				else if (gameEventKeyIs(key, keyLen, "btime"))
+					num = &ev->btime;
+				else if (gameEventKeyIs(key, keyLen, "white") && scope == SCOPE_ROOT && *s->str == '{')
+					return scanGameEventObject(s, ev, SCOPE_WHITE, depth + 1);
+				else if (gameEventKeyIs(key, keyLen, "black") && scope == SCOPE_ROOT && *s->str == '{')
+					return scanGameEventObject(s, ev, SCOPE_BLACK, depth + 1);
+				else if (gameEventKeyIs(key, keyLen, "state") && scope == SCOPE_ROOT && *s->str == '{')
+					return scanGameEventObject(s, ev, SCOPE_STATE, depth + 1);
+				break;
+			case 6:
+				if (gameEventKeyIs(key, keyLen, "status"))
+					str = &ev->status;
+				break;
+			case 10:
+				if (gameEventKeyIs(key, keyLen, "initialFen") && scope == SCOPE_ROOT)
+					str = &ev->initialFen;
+				break;
+		}
+	} else if ((scope == SCOPE_WHITE || scope == SCOPE_BLACK) && gameEventKeyIs(key, keyLen, "id"))
+		str = scope == SCOPE_WHITE ? &ev->whiteId : &ev->blackId;
+
+	if (str && *s->str == '"')
+		return scanGameEventString(s, str);
+	if (num && (*s->str == '-' || (*s->str >= '0' && *s->str <= '9')))
+		return scanGameEventNumber(s, num);
+
+	return skipGameEventValue(s, depth);
+}
+
+// Expects the opening brace, leaves the scanner past the closing one
+static int scanGameEventObject(GameEventScanner *s, GameEvent *ev, enum gameEventScope scope, unsigned int depth) {
+	if (depth > 64)
+		return 0;
+
+	s->str++;
+	skipGameEventSpace(s);
+	if (s->str < s->end && *s->str == '}') {
+		s->str++;
+		return 1;
+	}
+
+	while (1) {
+		GameEventString key;
+
+		skipGameEventSpace(s);
+		if (s->str >= s->end || *s->str != '"' || !scanGameEventString(s, &key))
+			return 0;
+
+		skipGameEventSpace(s);
+		if (s->str >= s->end || *(s->str++) != ':')
+			return 0;
+		skipGameEventSpace(s);
+		if (s->str >= s->end)
+			return 0;
+
+		if (!(scope == SCOPE_SKIP ? skipGameEventValue(s, depth) : scanGameEventField(s, ev, scope, key.str, key.len, depth)))
+			return 0;
+
+		skipGameEventSpace(s);
+		if (s->str >= s->end)
+			return 0;
+		if (*(s->str++) == '}')
+			return 1;
+		if (s->str[-1] != ',')
+			return 0;
+	}
+}
+
+// Returns 0 on malformed input. Any other event decodes as GAME_EVENT_OTHER.
+int decodeGameEvent(char const *str, size_t len, GameEvent *ev) {
+	GameEventScanner s = {str, str + len};
+
+	memset(ev, 0, sizeof *ev);
+	ev->wtime = ev->btime = ev->winc = ev->binc = -1;
+
+	skipGameEventSpace(&s);
+	if (s.str >= s.end || *s.str != '{')
+		return 0;
+
+	return scanGameEventObject(&s, ev, SCOPE_ROOT, 0);
+}
+
+#endif /*__LICHESS_EVENTS__*/
@@ -0,0 +1,167 @@
+#ifndef __UTIL_ARENA__
+#define __UTIL_ARENA__
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Bump allocator: allocations are carved out of large blocks and released
+// all at once by arenaReset/arenaFree. Arenas can report the bytes they hold
+// to a shared counter, so each subsystem's live memory can be watched.
+
+#define ARENA_ALIGN 16
+#define ARENA_DEFAULT_BLOCK 16384
+
+typedef struct ArenaBlock {
+	struct ArenaBlock *next;
+	size_t size;
+	size_t used;
+	char *data;
+} ArenaBlock;
+
+// Bytes reserved by every arena counted against it, and the most there were
+typedef struct ArenaCounter {
+	char const *name;
+	atomic_size_t live;
+	atomic_size_t peak;
+} ArenaCounter;
+
+typedef struct Arena {
+	ArenaBlock *head; // block currently being carved
+	size_t blockSize; // minimum size of a fresh block
+	size_t reserved; // bytes reserved across all blocks
+	ArenaCounter *counter; // NULL if nobody is counting
+} Arena;
+
+void arenaInit(Arena *, size_t);
+void arenaCount(Arena *, ArenaCounter *);
+void *arenaAlloc(Arena *, size_t);
+void *arenaGrow(Arena *, void *, size_t, size_t);
+char *arenaStrndup(Arena *, char const *, size_t);
+void arenaReset(Arena *);
+void arenaFree(Arena *);
+
+static inline size_t arenaAlign(size_t n) {
+	return (n + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+}
+
+static void arenaCounterAdd(ArenaCounter *counter, size_t bytes) {
+	if (!counter)
+		return;
+
+	size_t live = atomic_fetch_add_explicit(&counter->live, bytes, memory_order_relaxed) + bytes;
+	size_t peak = atomic_load_explicit(&counter->peak, memory_order_relaxed);
+	while (live > peak && !atomic_compare_exchange_weak_explicit(&counter->peak, &peak, live, memory_order_relaxed, memory_order_relaxed));
+}
+
+static ArenaBlock *arenaNewBlock(Arena *arena, size_t size) {
+	if (size < arena->blockSize)
+		size = arena->blockSize;
+
+	// Header and data share one allocation
+	ArenaBlock *block = malloc(arenaAlign(sizeof(ArenaBlock)) + size);
+	if (!block)
+		return NULL;
+
+	block->next = arena->head;
+	block->size = size;
+	block->used = 0;
+	block->data = (char *) block + arenaAlign(sizeof(ArenaBlock));
+
+	arena->head = block;
+	arena->reserved += size;
+	arenaCounterAdd(arena->counter, size);
+
+	return block;
+}
+
+void arenaInit(Arena *arena, size_t blockSize) {
+	arena->head = NULL;
+	arena->blockSize = blockSize ? arenaAlign(blockSize) : ARENA_DEFAULT_BLOCK;
+	arena->reserved = 0;
+	arena->counter = NULL;
+}
+
+// Counts the arena's blocks, from now until it is freed, against counter
+void arenaCount(Arena *arena, ArenaCounter *counter) {
+	arena->counter = counter;
+	arenaCounterAdd(counter, arena->reserved);
+}
+
+void *arenaAlloc(Arena *arena, size_t size) {
+	size = arenaAlign(size ? size : 1);
+
+	ArenaBlock *block = arena->head;
+	if (!block || block->size - block->used < size)
+		if (!(block = arenaNewBlock(arena, size)))
+			return NULL;
+
+	void *ret = block->data + block->used;
+	block->used += size;
+
+	return ret;
+}
+
+// Grows the most recent allocation in place when possible, otherwise copies
+void *arenaGrow(Arena *arena, void *ptr, size_t oldSize, size_t newSize) {
+	if (!ptr)
+		return arenaAlloc(arena, newSize);
+
+	ArenaBlock *block = arena->head;
+	size_t oldAligned = arenaAlign(oldSize ? oldSize : 1);
+	size_t newAligned = arenaAlign(newSize ? newSize : 1);
+
+	if ((char *) ptr + oldAligned == block->data + block->used && block->used - oldAligned + newAligned <= block->size) {
+		block->used = block->used - oldAligned + newAligned;
+		return ptr;
+	}
+
+	void *ret = arenaAlloc(arena, newSize);
+	if (ret)
+		memcpy(ret, ptr, oldSize < newSize ? oldSize : newSize);
+
+	return ret;
+}
+
+char *arenaStrndup(Arena *arena, char const *str, size_t len) {
+	char *ret = arenaAlloc(arena, len + 1);
+	if (!ret)
+		return NULL;
+
+	memcpy(ret, str, len);
+	ret[len] = 0;
+
+	return ret;
+}
+
+// Forgets every allocation. If the previous round spilled into several blocks
+// they are coalesced into one, so a steady workload settles on a single block
+// and reset becomes a pointer move.
+void arenaReset(Arena *arena) {
+	ArenaBlock *block = arena->head;
+
+	if (block && block->next) {
+		size_t total = arena->reserved;
+		arenaFree(arena);
+		arenaNewBlock(arena, total);
+	} else if (block)
+		block->used = 0;
+}
+
+void arenaFree(Arena *arena) {
+	ArenaBlock *block = arena->head;
+
+	while (block) {
+		ArenaBlock *next = block->next;
+		free(block);
+		block = next;
+	}
+
+	if (arena->counter)
+		atomic_fetch_sub_explicit(&arena->counter->live, arena->reserved, memory_order_relaxed);
+
+	arena->head = NULL;
+	arena->reserved = 0;
+}
+
+#endif /*__UTIL_ARENA__*/
@@ -0,0 +1,114 @@
+#ifndef __UTIL_HISTOGRAM__
+#define __UTIL_HISTOGRAM__
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// Log-linear latency histogram in the style of HdrHistogram: every power of
+// two is split into 16 linear buckets, so any recorded value is known to
+// within 1/16 (6.25%) while the whole range of 64-bit values fits in under
+// a thousand buckets. Values are unitless; the bot records microseconds.
+
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct Histogram {
+	uint64_t counts[HISTOGRAM_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+} Histogram;
+
+void initHistogram(Histogram *);
+void recordHistogram(Histogram *, uint64_t);
+void mergeHistogram(Histogram *, Histogram const *);
+uint64_t histogramPercentile(Histogram const *, double);
+void printHistogram(FILE *, char const *, Histogram const *);
+
+static inline uint64_t monotonicNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline unsigned int histogramBucket(uint64_t value) {
+	if (value < HISTOGRAM_SUB_BUCKETS)
+		return value;
+
+	unsigned int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+	return (shift + 1) * HISTOGRAM_SUB_BUCKETS + (unsigned int) ((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+// Smallest value that falls in bucket
+static inline uint64_t histogramBucketValue(unsigned int bucket) {
+	if (bucket < HISTOGRAM_SUB_BUCKETS)
+		return bucket;
+
+	unsigned int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	return (uint64_t) (HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+void initHistogram(Histogram *hist) {
+	memset(hist, 0, sizeof *hist);
+	hist->min = UINT64_MAX;
+}
+
+void recordHistogram(Histogram *hist, uint64_t value) {
+	hist->counts[histogramBucket(value)]++;
+	hist->count++;
+	hist->sum += value;
+	if (value < hist->min)
+		hist->min = value;
+	if (value > hist->max)
+		hist->max = value;
+}
+
+// Adds everything recorded in from to into
+void mergeHistogram(Histogram *into, Histogram const *from) {
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		into->counts[i] += from->counts[i];
+	into->count += from->count;
+	into->sum += from->sum;
+	if (from->min < into->min)
+		into->min = from->min;
+	if (from->max > into->max)
+		into->max = from->max;
+}
+
+// Value at or below which percentile percent of the recordings fall, to
+// within the bucket's precision
+uint64_t histogramPercentile(Histogram const *hist, double percentile) {
+	if (!hist->count)
+		return 0;
+
+	uint64_t rank = (uint64_t) (percentile / 100 * hist->count + 0.5), seen = 0;
+	if (rank < 1)
+		rank = 1;
+
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		if ((seen += hist->counts[i]) >= rank) {
+			// Highest value of the bucket, as HdrHistogram reports it
+			uint64_t value = i + 1 < HISTOGRAM_BUCKETS ? histogramBucketValue(i + 1) - 1 : UINT64_MAX;
+			return value < hist->min ? hist->min : value > hist->max ? hist->max : value;
+		}
+
+	return hist->max;
+}
+
+void printHistogram(FILE *fp, char const *name, Histogram const *hist) {
+	if (!hist->count) {
+		fprintf(fp, "%-10s no samples\n", name);
+		return;
+	}
+
+	fprintf(fp, "%-10s n=%-8llu min=%-9llu p50=%-9llu p90=%-9llu p99=%-9llu p99.9=%-9llu max=%-9llu mean=%llu\n", name,
+		(unsigned long long) hist->count, (unsigned long long) hist->min,
+		(unsigned long long) histogramPercentile(hist, 50), (unsigned long long) histogramPercentile(hist, 90),
+		(unsigned long long) histogramPercentile(hist, 99), (unsigned long long) histogramPercentile(hist, 99.9),
+		(unsigned long long) hist->max, (unsigned long long) (hist->sum / hist->count));
+}
+
+#endif /*__UTIL_HISTOGRAM__*/
@@ -0,0 +1,207 @@
+#ifndef __UTIL_LOG__
+#define __UTIL_LOG__
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "queue.h"
+
+// Asynchronous logger. Records are fixed-size buffers taken from a lock-free
+// free list, formatted in place by the caller and handed to a flusher thread
+// over a lock-free queue, so logging from a hot path costs a format and two
+// queue operations and never touches a file or takes a lock. The flusher
+// wakes every LOG_FLUSH_MS and writes whatever is pending in one go. When
+// every record is in flight new ones are dropped and counted instead of
+// waiting. Before initLogger (and after freeLogger) messages are written
+// straight to stderr.
+
+#define LOG_RECORD_SIZE 1024
+#define LOG_FLUSH_MS 10
+
+enum logLevel {LEVEL_DEBUG, LEVEL_INFO, LEVEL_WARN, LEVEL_ERROR, LEVEL_COUNT};
+
+typedef struct LogRecord {
+	struct timespec time;
+	enum logLevel level;
+	size_t len;
+	char text[LOG_RECORD_SIZE];
+} LogRecord;
+
+static struct {
+	MPMCQueue free;
+	MPMCQueue filled;
+	LogRecord *records;
+	FILE *fp;
+	enum logLevel level;
+	atomic_int running;
+	atomic_ulong dropped;
+	pthread_t flusher;
+} logger = {.level = LEVEL_INFO};
+
+int initLogger(FILE *, enum logLevel, size_t);
+enum logLevel logLevelFromName(char const *, enum logLevel);
+void logMessage(enum logLevel, char const *, ...) __attribute__((format(printf, 2, 3)));
+void logRecord(enum logLevel, char const *, size_t);
+void freeLogger(void);
+
+static char const logLevelNames[LEVEL_COUNT] = {'D', 'I', 'W', 'E'};
+
+static inline int logEnabled(enum logLevel level) {
+	return level >= logger.level;
+}
+
+static void writeLogRecord(FILE *fp, LogRecord const *record) {
+	struct tm tm;
+
+	localtime_r(&record->time.tv_sec, &tm);
+	fprintf(fp, "%02d:%02d:%02d.%06ld %c %.*s\n", tm.tm_hour, tm.tm_min, tm.tm_sec, record->time.tv_nsec / 1000, logLevelNames[record->level], (int) record->len, record->text);
+}
+
+// Writes out the pending records; only the flusher (or freeLogger once it
+// has stopped) may call this. Returns how many there were.
+static size_t drainLogger(void) {
+	LogRecord *record;
+	size_t count = 0;
+
+	while ((record = popMPMCQueue(&logger.filled))) {
+		writeLogRecord(logger.fp, record);
+		pushMPMCQueue(&logger.free, record);
+		count++;
+	}
+
+	unsigned long dropped = atomic_exchange_explicit(&logger.dropped, 0, memory_order_relaxed);
+	if (dropped)
+		fprintf(logger.fp, "%lu log records dropped\n", dropped);
+
+	if (count || dropped)
+		fflush(logger.fp);
+
+	return count;
+}
+
+static void *logFlusher(void *unused) {
+	struct timespec interval = {0, LOG_FLUSH_MS * 1000000L};
+
+	while (atomic_load_explicit(&logger.running, memory_order_acquire))
+		if (!drainLogger())
+			nanosleep(&interval, NULL);
+
+	return NULL;
+}
+
+// Returns 0 on failure, leaving messages to go straight to stderr
+int initLogger(FILE *fp, enum logLevel level, size_t records) {
+	logger.fp = fp;
+	logger.level = level;
+	atomic_init(&logger.dropped, 0);
+
+	if (!(logger.records = malloc(records * sizeof *logger.records)))
+		return 0;
+
+	if (!initMPMCQueue(&logger.free, records) || !initMPMCQueue(&logger.filled, records))
+		goto fail;
+
+	for (size_t i = 0; i < records; i++)
+		pushMPMCQueue(&logger.free, logger.records + i);
+
+	atomic_store_explicit(&logger.running, 1, memory_order_release);
+	if (!pthread_create(&logger.flusher, NULL, logFlusher, NULL))
+		return 1;
+
+	atomic_store(&logger.running, 0);
+fail:
+	freeMPMCQueue(&logger.free);
+	freeMPMCQueue(&logger.filled);
+	free(logger.records);
+	logger.records = NULL;
+	return 0;
+}
+
+// debug, info, warn or error; fallback for NULL or anything else
+enum logLevel logLevelFromName(char const *name, enum logLevel fallback) {
+	static char const *names[LEVEL_COUNT] = {"debug", "info", "warn", "error"};
+
+	if (name)
+		for (int i = 0; i < LEVEL_COUNT; i++)
+			if (!strcasecmp(name, names[i]))
+				return i;
+
+	return fallback;
+}
+
+// Returns 0 if the message should go straight to stderr. Otherwise *record
+// is the record to fill, or NULL if the message is dropped.
+static int takeLogRecord(LogRecord **record) {
+	*record = NULL;
+
+	if (!atomic_load_explicit(&logger.running, memory_order_acquire))
+		return 0;
+
+	if (!(*record = popMPMCQueue(&logger.free)))
+		atomic_fetch_add_explicit(&logger.dropped, 1, memory_order_relaxed);
+
+	return 1;
+}
+
+// Queues a record from takeLogRecord, or writes out the caller's own
+static void postLogRecord(LogRecord *record, int queued, enum logLevel level) {
+	record->level = level;
+	clock_gettime(CLOCK_REALTIME, &record->time);
+
+	// A queued record came off the free list, so there is always room for it
+	if (queued)
+		pushMPMCQueue(&logger.filled, record);
+	else
+		writeLogRecord(stderr, record);
+}
+
+void logMessage(enum logLevel level, char const *fmt, ...) {
+	LogRecord *record, local;
+	va_list args;
+
+	if (!logEnabled(level) || (takeLogRecord(&record) && !record))
+		return;
+
+	LogRecord *out = record ? record : &local;
+	va_start(args, fmt);
+	int len = vsnprintf(out->text, LOG_RECORD_SIZE, fmt, args);
+	va_end(args);
+
+	out->len = len < 0 ? 0 : len < LOG_RECORD_SIZE ? len : LOG_RECORD_SIZE - 1;
+	postLogRecord(out, record != NULL, level);
+}
+
+// Logs len bytes of text as they are; anything past LOG_RECORD_SIZE is cut
+void logRecord(enum logLevel level, char const *text, size_t len) {
+	LogRecord *record, local;
+
+	if (!logEnabled(level) || (takeLogRecord(&record) && !record))
+		return;
+
+	LogRecord *out = record ? record : &local;
+	out->len = len < LOG_RECORD_SIZE ? len : LOG_RECORD_SIZE;
+	memcpy(out->text, text, out->len);
+	postLogRecord(out, record != NULL, level);
+}
+
+// Stops the flusher and writes out everything logged before the call. No
+// other thread may be logging by then.
+void freeLogger(void) {
+	if (!logger.records)
+		return;
+
+	atomic_store_explicit(&logger.running, 0, memory_order_release);
+	pthread_join(logger.flusher, NULL);
+	drainLogger();
+
+	freeMPMCQueue(&logger.free);
+	freeMPMCQueue(&logger.filled);
+	free(logger.records);
+	logger.records = NULL;
+}
+
+#endif /*__UTIL_LOG__*/
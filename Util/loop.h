@@ -0,0 +1,211 @@
+#ifndef __UTIL_LOOP__
+#define __UTIL_LOOP__
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <curl/curl.h>
+
+// Event loop that drives any number of curl transfers from one thread, with
+// curl_multi_socket_action on top of epoll. curl's timeouts go through a
+// timerfd and other threads get the loop's attention with wakeCurlLoop, so
+// epoll_wait is the only place the loop ever blocks.
+
+#define CURL_LOOP_EVENTS 64
+
+typedef struct CurlTransfer {
+	CURL *easy;
+	void (*done)(struct CurlTransfer *, CURLcode); // runs on the loop thread once the transfer ends
+	void *data;
+	struct CurlTransfer *next; // while waiting to be added
+} CurlTransfer;
+
+typedef struct CurlLoop {
+	CURLM *multi;
+	int epfd;
+	int timerfd;
+	int wakefd;
+	int running; // transfers in progress
+	char stop;
+	CurlTransfer *pending; // added from inside a curl callback, or not added at all
+	void (*wake)(struct CurlLoop *); // runs on the loop thread after wakeCurlLoop
+	void *data;
+} CurlLoop;
+
+int initCurlLoop(CurlLoop *);
+void addCurlTransfer(CurlLoop *, CurlTransfer *);
+void wakeCurlLoop(CurlLoop *);
+void runCurlLoop(CurlLoop *);
+void freeCurlLoop(CurlLoop *);
+
+static int curlLoopSocket(CURL *easy, curl_socket_t fd, int what, void *loopPtr, void *socketPtr) {
+	CurlLoop *loop = loopPtr;
+	struct epoll_event ev;
+
+	if (what == CURL_POLL_REMOVE) {
+		epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+		return 0;
+	}
+
+	memset(&ev, 0, sizeof ev);
+	ev.events = (what & CURL_POLL_IN ? EPOLLIN : 0) | (what & CURL_POLL_OUT ? EPOLLOUT : 0);
+	ev.data.fd = fd;
+
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev) == -1 && errno == ENOENT)
+		epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+
+	return 0;
+}
+
+// curl must not be re-entered from here, so the timeout is armed on the
+// timerfd and acted on by the loop
+static int curlLoopTimer(CURLM *multi, long timeoutMs, void *loopPtr) {
+	CurlLoop *loop = loopPtr;
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof its);
+	if (timeoutMs > 0) {
+		its.it_value.tv_sec = timeoutMs / 1000;
+		its.it_value.tv_nsec = (timeoutMs % 1000) * 1000000;
+	} else if (!timeoutMs)
+		its.it_value.tv_nsec = 1; // as soon as possible; all zeroes would disarm it
+
+	timerfd_settime(loop->timerfd, 0, &its, NULL);
+
+	return 0;
+}
+
+static int watchCurlLoopFd(CurlLoop *loop, int fd) {
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+
+	return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// Returns 0 on failure
+int initCurlLoop(CurlLoop *loop) {
+	memset(loop, 0, sizeof *loop);
+
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	loop->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	loop->multi = curl_multi_init();
+
+	if (loop->epfd == -1 || loop->timerfd == -1 || loop->wakefd == -1 || !loop->multi || watchCurlLoopFd(loop, loop->timerfd) == -1 || watchCurlLoopFd(loop, loop->wakefd) == -1) {
+		freeCurlLoop(loop);
+		return 0;
+	}
+
+	curl_multi_setopt(loop->multi, CURLMOPT_SOCKETFUNCTION, curlLoopSocket);
+	curl_multi_setopt(loop->multi, CURLMOPT_SOCKETDATA, loop);
+	curl_multi_setopt(loop->multi, CURLMOPT_TIMERFUNCTION, curlLoopTimer);
+	curl_multi_setopt(loop->multi, CURLMOPT_TIMERDATA, loop);
+
+	return 1;
+}
+
+// The transfer's easy handle must be set up; it is removed from the loop
+// before done is called, and done owns it from then on
+void addCurlTransfer(CurlLoop *loop, CurlTransfer *transfer) {
+	curl_easy_setopt(transfer->easy, CURLOPT_PRIVATE, transfer);
+
+	// curl refuses to be re-entered from its own callbacks (a write
+	// callback starting a request, say), so those wait for the loop. So does
+	// any other failure: the loop tries once more and then ends the transfer
+	// with an error, outside whatever called us.
+	if (curl_multi_add_handle(loop->multi, transfer->easy) != CURLM_OK) {
+		transfer->next = loop->pending;
+		loop->pending = transfer;
+	}
+}
+
+// Safe to call from any thread
+void wakeCurlLoop(CurlLoop *loop) {
+	uint64_t one = 1;
+	if (write(loop->wakefd, &one, sizeof one) == -1 && errno != EAGAIN)
+		perror("wakeCurlLoop");
+}
+
+static void finishCurlTransfers(CurlLoop *loop) {
+	CURLMsg *msg;
+	int left;
+
+	while ((msg = curl_multi_info_read(loop->multi, &left))) {
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		CurlTransfer *transfer = NULL;
+		CURL *easy = msg->easy_handle;
+		CURLcode res = msg->data.result;
+
+		curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **) &transfer);
+		curl_multi_remove_handle(loop->multi, easy);
+
+		if (transfer && transfer->done)
+			transfer->done(transfer, res);
+	}
+}
+
+// Runs until stop is set
+void runCurlLoop(CurlLoop *loop) {
+	struct epoll_event events[CURL_LOOP_EVENTS];
+	uint64_t count;
+
+	while (!loop->stop) {
+		while (loop->pending) {
+			CurlTransfer *transfer = loop->pending;
+			loop->pending = transfer->next;
+			if (curl_multi_add_handle(loop->multi, transfer->easy) != CURLM_OK && transfer->done)
+				transfer->done(transfer, CURLE_FAILED_INIT);
+		}
+
+		int n = epoll_wait(loop->epfd, events, CURL_LOOP_EVENTS, -1);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+
+			if (fd == loop->timerfd) {
+				if (read(fd, &count, sizeof count) > 0)
+					curl_multi_socket_action(loop->multi, CURL_SOCKET_TIMEOUT, 0, &loop->running);
+			} else if (fd == loop->wakefd) {
+				if (read(fd, &count, sizeof count) > 0 && loop->wake)
+					loop->wake(loop);
+			} else {
+				int flags = (events[i].events & EPOLLIN ? CURL_CSELECT_IN : 0) | (events[i].events & EPOLLOUT ? CURL_CSELECT_OUT : 0) | (events[i].events & (EPOLLERR | EPOLLHUP) ? CURL_CSELECT_ERR : 0);
+				curl_multi_socket_action(loop->multi, fd, flags, &loop->running);
+			}
+		}
+
+		finishCurlTransfers(loop);
+	}
+}
+
+void freeCurlLoop(CurlLoop *loop) {
+	if (loop->multi)
+		curl_multi_cleanup(loop->multi);
+	if (loop->epfd != -1)
+		close(loop->epfd);
+	if (loop->timerfd != -1)
+		close(loop->timerfd);
+	if (loop->wakefd != -1)
+		close(loop->wakefd);
+
+	loop->multi = NULL;
+	loop->epfd = loop->timerfd = loop->wakefd = -1;
+}
+
+#endif /*__UTIL_LOOP__*/
@@ -0,0 +1,87 @@
+#ifndef __UTIL_POOL__
+#define __UTIL_POOL__
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "queue.h"
+
+// Fixed set of threads running tasks off a lock-free MPMC queue. Tasks are
+// embedded as the first member of whatever struct carries their data, and a
+// semaphore counts queued tasks so idle workers sleep instead of spinning.
+
+typedef struct ThreadPoolTask {
+	void (*run)(struct ThreadPoolTask *);
+} ThreadPoolTask;
+
+typedef struct ThreadPool {
+	MPMCQueue queue;
+	sem_t ready;
+	unsigned int threads;
+	pthread_t *workers;
+} ThreadPool;
+
+int initThreadPool(ThreadPool *, unsigned int, size_t);
+void submitThreadPool(ThreadPool *, ThreadPoolTask *);
+void freeThreadPool(ThreadPool *);
+
+static void *threadPoolWorker(void *poolPtr) {
+	ThreadPool *pool = poolPtr;
+	ThreadPoolTask *task;
+
+	while (1) {
+		while (sem_wait(&pool->ready));
+
+		// The semaphore says a task is there; its producer may still be
+		// publishing it
+		while (!(task = popMPMCQueue(&pool->queue)))
+			sched_yield();
+
+		if (task->run)
+			task->run(task);
+		else
+			break;
+	}
+
+	return NULL;
+}
+
+// Returns 0 on failure
+int initThreadPool(ThreadPool *pool, unsigned int threads, size_t capacity) {
+	if (!threads)
+		threads = 1;
+
+	if (!initMPMCQueue(&pool->queue, capacity))
+		return 0;
+	sem_init(&pool->ready, 0, 0);
+
+	pool->workers = malloc(threads * sizeof *pool->workers);
+	for (pool->threads = 0; pool->threads < threads; pool->threads++)
+		if (pthread_create(pool->workers + pool->threads, NULL, threadPoolWorker, pool))
+			break;
+
+	return pool->threads > 0;
+}
+
+// Any thread may submit, workers included
+void submitThreadPool(ThreadPool *pool, ThreadPoolTask *task) {
+	while (!pushMPMCQueue(&pool->queue, task))
+		sched_yield();
+	sem_post(&pool->ready);
+}
+
+// Stops the workers once they have taken the tasks queued before the call
+void freeThreadPool(ThreadPool *pool) {
+	static ThreadPoolTask stop = {NULL};
+
+	for (unsigned int i = 0; i < pool->threads; i++)
+		submitThreadPool(pool, &stop);
+	for (unsigned int i = 0; i < pool->threads; i++)
+		pthread_join(pool->workers[i], NULL);
+
+	free(pool->workers);
+	sem_destroy(&pool->ready);
+	freeMPMCQueue(&pool->queue);
+}
+
+#endif /*__UTIL_POOL__*/
@@ -0,0 +1,107 @@
+#ifndef __UTIL_QUEUE__
+#define __UTIL_QUEUE__
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Bounded lock-free multi-producer multi-consumer queue of pointers (Dmitry
+// Vyukov's design). Each cell carries a sequence number telling producers and
+// consumers whose turn it is, so the only contended operation is a CAS on the
+// enqueue or dequeue position, which live on separate cache lines.
+
+#define MPMC_CACHE_LINE 64
+
+typedef struct MPMCCell {
+	atomic_size_t sequence;
+	void *data;
+} MPMCCell;
+
+typedef struct MPMCQueue {
+	MPMCCell *cells;
+	size_t mask;
+	_Alignas(MPMC_CACHE_LINE) atomic_size_t enqueuePos;
+	_Alignas(MPMC_CACHE_LINE) atomic_size_t dequeuePos;
+} MPMCQueue;
+
+int initMPMCQueue(MPMCQueue *, size_t);
+int pushMPMCQueue(MPMCQueue *, void *);
+void *popMPMCQueue(MPMCQueue *);
+void freeMPMCQueue(MPMCQueue *);
+
+// The capacity is rounded up to a power of two. Returns 0 on failure.
+int initMPMCQueue(MPMCQueue *queue, size_t capacity) {
+	size_t cap = 2;
+	while (cap < capacity)
+		cap *= 2;
+
+	if (!(queue->cells = malloc(cap * sizeof *queue->cells)))
+		return 0;
+
+	for (size_t i = 0; i < cap; i++)
+		atomic_init(&queue->cells[i].sequence, i);
+
+	queue->mask = cap - 1;
+	atomic_init(&queue->enqueuePos, 0);
+	atomic_init(&queue->dequeuePos, 0);
+
+	return 1;
+}
+
+// Returns 0 when the queue is full
+int pushMPMCQueue(MPMCQueue *queue, void *data) {
+	size_t pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+	MPMCCell *cell;
+
+	while (1) {
+		cell = queue->cells + (pos & queue->mask);
+		size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		ptrdiff_t diff = (ptrdiff_t) seq - (ptrdiff_t) pos;
+
+		if (!diff) {
+			if (atomic_compare_exchange_weak_explicit(&queue->enqueuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (diff < 0)
+			return 0;
+		else
+			pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+	}
+
+	cell->data = data;
+	atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
+	return 1;
+}
+
+// Returns NULL when the queue is empty. An element whose producer has claimed
+// a cell but not yet filled it isn't visible yet, so callers that know an
+// element is coming should retry.
+void *popMPMCQueue(MPMCQueue *queue) {
+	size_t pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+	MPMCCell *cell;
+
+	while (1) {
+		cell = queue->cells + (pos & queue->mask);
+		size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		ptrdiff_t diff = (ptrdiff_t) seq - (ptrdiff_t) (pos + 1);
+
+		if (!diff) {
+			if (atomic_compare_exchange_weak_explicit(&queue->dequeuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (diff < 0)
+			return NULL;
+		else
+			pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+	}
+
+	void *data = cell->data;
+	atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+
+	return data;
+}
+
+void freeMPMCQueue(MPMCQueue *queue) {
+	free(queue->cells);
+	queue->cells = NULL;
+}
+
+#endif /*__UTIL_QUEUE__*/
@@ -0,0 +1,154 @@
+#ifndef __UTIL_RESULTS__
+#define __UTIL_RESULTS__
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+// Local, append-only store of benchmark results for Bench/compare. Every
+// run of a benchmark appends one line of JSON:
+//
+//   {"commit":"<sha>","dirty":false,"machine":"<host> <cpu>","tool":"micro",
+//    "time":<epoch s>,"metrics":{"validMoves ns/op":3847.4,...}}
+//
+// to Bench/results.ndjson, or to $BENCH_RESULTS (empty turns it off). A
+// dirty run is one made with uncommitted changes to tracked files, which is
+// how a change is usually measured before it's committed. $BENCH_MACHINE
+// names the machine if the hostname and CPU don't tell them apart.
+//
+// Names say which way is better: those ending in "nps" or "/s" are better
+// higher, those ending in "nodes" are signatures that must not change, and
+// the rest (times, allocations, instructions) are better lower.
+
+#define BENCH_RESULTS_PATH "Bench/results.ndjson"
+#define BENCH_LINE_SIZE 8192
+
+typedef struct BenchMetric {
+	char name[64];
+	double value;
+} BenchMetric;
+
+char const *benchResultsPath(void);
+void benchCommit(char *, size_t, char *);
+void benchMachine(char *, size_t);
+int recordBenchResults(char const *, BenchMetric const *, size_t);
+
+// NULL when results aren't to be kept
+char const *benchResultsPath(void) {
+	char const *path = getenv("BENCH_RESULTS");
+
+	if (!path)
+		return BENCH_RESULTS_PATH;
+	return *path ? path : NULL;
+}
+
+// First line of what command prints, without the line break
+static int benchCommandLine(char const *command, char *out, size_t size) {
+	FILE *fp = popen(command, "r");
+	int found = 0;
+
+	if (!fp)
+		return 0;
+
+	if (fgets(out, size, fp)) {
+		out[strcspn(out, "\n")] = 0;
+		found = 1;
+	}
+	pclose(fp);
+
+	return found;
+}
+
+// HEAD of the checkout we run in, or "unknown" outside one
+void benchCommit(char *out, size_t size, char *dirty) {
+	char line[256];
+
+	*dirty = 0;
+	if (!benchCommandLine("git rev-parse HEAD 2>/dev/null", out, size)) {
+		snprintf(out, size, "unknown");
+		return;
+	}
+
+	*dirty = benchCommandLine("git status --porcelain --untracked-files=no 2>/dev/null", line, sizeof line);
+}
+
+void benchMachine(char *out, size_t size) {
+	char host[64] = "unknown", line[256], *model = NULL;
+	FILE *cpuinfo;
+
+	if (getenv("BENCH_MACHINE")) {
+		snprintf(out, size, "%s", getenv("BENCH_MACHINE"));
+		return;
+	}
+
+	gethostname(host, sizeof host - 1);
+
+	if ((cpuinfo = fopen("/proc/cpuinfo", "r"))) {
+		while (!model && fgets(line, sizeof line, cpuinfo))
+			if (!strncmp(line, "model name", 10) && (model = strchr(line, ':'))) {
+				model += 1 + strspn(model + 1, " \t");
+				model[strcspn(model, "\n")] = 0;
+			}
+		fclose(cpuinfo);
+	}
+
+	snprintf(out, size, "%s %s", host, model ? model : "unknown cpu");
+}
+
+// Writes str as the contents of a JSON string
+static size_t benchJSONString(char *out, size_t size, char const *str) {
+	size_t len = 0;
+
+	for (; *str && len + 2 < size; str++) {
+		if (*str == '"' || *str == '\\')
+			out[len++] = '\\';
+		out[len++] = (unsigned char) *str < ' ' ? ' ' : *str;
+	}
+	out[len] = 0;
+
+	return len;
+}
+
+// Appends one line for the run of tool. A single write on a file opened with
+// O_APPEND, so runs finishing at the same time don't mix their lines.
+// Returns 0 if it couldn't; 1 if it did or results are off.
+int recordBenchResults(char const *tool, BenchMetric const *metrics, size_t count) {
+	char const *path = benchResultsPath();
+	char commit[64], machine[256], escaped[512], escapedTool[256], name[128], dirty;
+	char *line;
+	size_t len;
+	int fd, written;
+
+	if (!path)
+		return 1;
+	if (!(line = malloc(BENCH_LINE_SIZE)))
+		return 0;
+
+	benchCommit(commit, sizeof commit, &dirty);
+	benchMachine(machine, sizeof machine);
+	benchJSONString(escaped, sizeof escaped, machine);
+	benchJSONString(escapedTool, sizeof escapedTool, tool);
+
+	len = snprintf(line, BENCH_LINE_SIZE, "{\"commit\":\"%s\",\"dirty\":%s,\"machine\":\"%s\",\"tool\":\"%s\",\"time\":%lld,\"metrics\":{", commit, dirty ? "true" : "false", escaped, escapedTool, (long long) time(NULL));
+	for (size_t i = 0; i < count && len < BENCH_LINE_SIZE; i++) {
+		benchJSONString(name, sizeof name, metrics[i].name);
+		len += snprintf(line + len, BENCH_LINE_SIZE - len, "%s\"%s\":%.17g", i ? "," : "", name, metrics[i].value);
+	}
+	if (len < BENCH_LINE_SIZE)
+		len += snprintf(line + len, BENCH_LINE_SIZE - len, "}}\n");
+
+	if (len >= BENCH_LINE_SIZE || (fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1) {
+		free(line);
+		return 0;
+	}
+
+	written = write(fd, line, len) == (ssize_t) len;
+	close(fd);
+	free(line);
+
+	return written;
+}
+
+#endif /*__UTIL_RESULTS__*/
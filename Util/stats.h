@@ -0,0 +1,162 @@
+#ifndef __UTIL_STATS__
+#define __UTIL_STATS__
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Counters and gauges the bot publishes for Web/server's /metrics, in a
+// POSIX shared memory segment. The bot updates them with relaxed atomic
+// adds and stores, so nothing on its hot paths waits or takes a lock, and
+// the server maps the segment read-only and copies what it finds. Counters
+// only ever go up; readers take differences. Searches add their nodes once
+// per root move, not per node.
+
+#define BOT_STATS_NAME "/cosmo-engine-stats" // BOT_STATS in the environment overrides it
+#define BOT_STATS_MAGIC 0x434f534d // "COSM"
+#define BOT_STATS_VERSION 1
+
+typedef struct BotStats {
+	uint32_t magic;
+	uint32_t version; // of this layout
+	atomic_int pid; // of the bot, 0 once it has exited
+	atomic_ulong startedMs; // CLOCK_REALTIME
+
+	atomic_ulong activeGames; // gauge
+	atomic_ulong gamesStarted;
+	atomic_ulong movesPlayed;
+
+	atomic_ulong searches;
+	atomic_ulong searchNodes;
+	atomic_ulong searchUs; // time spent searching
+	atomic_ulong searchBudgetUs; // time the clock allowed those searches
+	atomic_ulong searchesOverBudget;
+	atomic_ulong lastSearchNps; // gauge
+
+	atomic_ulong jsonBytes; // fed to the event and game stream parsers
+	atomic_ulong jsonEvents;
+
+	atomic_ulong curlErrors; // transfers curl failed
+	atomic_ulong httpErrors; // transfers lichess answered with 4xx or 5xx
+} BotStats;
+
+BotStats *createBotStats(char const *);
+void removeBotStats(BotStats *, char const *);
+BotStats const *mapBotStats(char const *);
+void unmapBotStats(BotStats const *);
+long processResidentBytes(int);
+
+static inline char const *botStatsName(void) {
+	char const *name = getenv("BOT_STATS");
+	return name && *name == '/' ? name : BOT_STATS_NAME;
+}
+
+static inline void statAdd(atomic_ulong *stat, unsigned long value) {
+	atomic_fetch_add_explicit(stat, value, memory_order_relaxed);
+}
+
+static inline void statSub(atomic_ulong *stat, unsigned long value) {
+	atomic_fetch_sub_explicit(stat, value, memory_order_relaxed);
+}
+
+static inline void statSet(atomic_ulong *stat, unsigned long value) {
+	atomic_store_explicit(stat, value, memory_order_relaxed);
+}
+
+static inline unsigned long statGet(atomic_ulong const *stat) {
+	return atomic_load_explicit((atomic_ulong *) stat, memory_order_relaxed);
+}
+
+// For the bot: a zeroed segment, replacing whatever a previous run left.
+// Returns NULL on failure; the bot then keeps its stats in memory of its own.
+BotStats *createBotStats(char const *name) {
+	BotStats *stats = MAP_FAILED;
+	int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd != -1) {
+		if (!ftruncate(fd, sizeof *stats))
+			stats = mmap(NULL, sizeof *stats, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+	}
+
+	if (stats == MAP_FAILED) {
+		static BotStats fallback;
+		stats = &fallback;
+	}
+
+	memset(stats, 0, sizeof *stats);
+	stats->magic = BOT_STATS_MAGIC;
+	stats->version = BOT_STATS_VERSION;
+	atomic_store(&stats->pid, getpid());
+
+	return stats;
+}
+
+void removeBotStats(BotStats *stats, char const *name) {
+	atomic_store(&stats->pid, 0);
+	shm_unlink(name);
+}
+
+// For readers: the bot's segment, or NULL if there is none or it has
+// another layout. The bot may have died without removing it; check pid.
+BotStats const *mapBotStats(char const *name) {
+	BotStats const *stats = MAP_FAILED;
+	struct stat st;
+	int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+
+	if (fd == -1)
+		return NULL;
+
+	if (!fstat(fd, &st) && st.st_size >= (off_t) sizeof *stats)
+		stats = mmap(NULL, sizeof *stats, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (stats == MAP_FAILED)
+		return NULL;
+
+	if (stats->magic != BOT_STATS_MAGIC || stats->version != BOT_STATS_VERSION) {
+		unmapBotStats(stats);
+		return NULL;
+	}
+
+	return stats;
+}
+
+void unmapBotStats(BotStats const *stats) {
+	munmap((void *) stats, sizeof *stats);
+}
+
+// Whether the bot that wrote stats is still running
+static inline char botStatsLive(BotStats const *stats) {
+	int pid = atomic_load((atomic_int *) &stats->pid);
+	return pid > 0 && (!kill(pid, 0) || errno == EPERM);
+}
+
+// Resident set of pid (0 for ourselves) in bytes, or -1
+long processResidentBytes(int pid) {
+	char path[64];
+	long pages = -1;
+	FILE *statm;
+
+	if (pid)
+		snprintf(path, sizeof path, "/proc/%d/statm", pid);
+	else
+		snprintf(path, sizeof path, "/proc/self/statm");
+
+	if (!(statm = fopen(path, "r")))
+		return -1;
+	if (fscanf(statm, "%*s %ld", &pages) != 1)
+		pages = -1;
+	fclose(statm);
+
+	return pages < 0 ? -1 : pages * sysconf(_SC_PAGESIZE);
+}
+
+#endif /*__UTIL_STATS__*/
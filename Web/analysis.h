@@ -0,0 +1,142 @@
+#ifndef __WEB_ANALYSIS__
+#define __WEB_ANALYSIS__
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Chess/search.h"
+#include "../JSON Parser/JSON.h"
+#include "../Util/pool.h"
+
+// Analysis requests of the HTTP server. A request body names the position
+// as a FEN and the limits of the search:
+//
+//   {"fen": "...", "depth": 6, "movetime": 1000}
+//
+// and /analyze/batch takes "fens", an array of them, instead of "fen".
+// /analyze/stream takes the same as a query string. Each position becomes
+// an AnalysisJob that runs searchPosition on the search pool; done is
+// called on the pool thread once the result is in.
+
+#define ANALYSIS_DEFAULT_DEPTH 5
+#define ANALYSIS_MAX_DEPTH 20
+#define ANALYSIS_MAX_MS 60000
+#define ANALYSIS_MAX_BATCH 1024
+#define ANALYSIS_RESULT_SIZE 1024 // formatted result, whole PV included
+
+typedef struct AnalysisJob {
+	ThreadPoolTask task;
+	void (*done)(struct AnalysisJob *);
+	void *data;
+	struct AnalysisJob *next; // free for whoever holds the job
+	unsigned int index; // in the batch
+	uint64_t board[4];
+	uint64_t prevBoard[4];
+	char brkrwrkr00;
+	char whiteToMove;
+	SearchLimits limits;
+	SearchInfo info;
+} AnalysisJob;
+
+char setAnalysisLimits(SearchLimits *, char, double, char, double);
+char readAnalysisLimits(JSON const *, SearchLimits *);
+AnalysisJob *newAnalysisJob(char const *, SearchLimits const *, unsigned int);
+size_t formatSearchInfo(char *, size_t, unsigned int, SearchInfo const *);
+size_t formatAnalysis(char *, size_t, AnalysisJob const *);
+
+// depth and movetime (ms) are both optional; without either the search
+// goes to ANALYSIS_DEFAULT_DEPTH. Returns 0 if one is out of range.
+char setAnalysisLimits(SearchLimits *limits, char hasDepth, double depth, char hasMovetime, double movetime) {
+	memset(limits, 0, sizeof *limits);
+
+	if ((hasDepth && !(depth >= 1 && depth <= ANALYSIS_MAX_DEPTH)) || (hasMovetime && !(movetime >= 1 && movetime <= ANALYSIS_MAX_MS)))
+		return 0;
+
+	if (hasDepth)
+		limits->depth = depth;
+	if (hasMovetime)
+		limits->timeMs = movetime;
+	if (!limits->depth && !limits->timeMs)
+		limits->depth = ANALYSIS_DEFAULT_DEPTH;
+
+	// A time limit alone still needs a depth to stop at
+	if (!limits->depth)
+		limits->depth = ANALYSIS_MAX_DEPTH;
+
+	return 1;
+}
+
+// From the members of a request body; anything but a number is out of range
+char readAnalysisLimits(JSON const *json, SearchLimits *limits) {
+	JSONContent depth = JSONGetValueForKey("depth", json);
+	JSONContent movetime = JSONGetValueForKey("movetime", json);
+
+	if ((depth.type != NONE && depth.type != NUMBER) || (movetime.type != NONE && movetime.type != NUMBER))
+		return 0;
+
+	return setAnalysisLimits(limits, depth.type == NUMBER, depth.number, movetime.type == NUMBER, movetime.number);
+}
+
+static void runAnalysisJob(ThreadPoolTask *task) {
+	AnalysisJob *job = (AnalysisJob *) task;
+
+	searchPosition(job->board, job->prevBoard, job->brkrwrkr00, job->whiteToMove, &job->limits, &job->info);
+	job->done(job);
+}
+
+// Returns NULL if fen isn't a position the search can take
+AnalysisJob *newAnalysisJob(char const *fen, SearchLimits const *limits, unsigned int index) {
+	AnalysisJob *job = calloc(1, sizeof *job);
+
+	if (!job)
+		return NULL;
+
+	if (!fen || !setBoardFromFen(job->board, job->prevBoard, &job->brkrwrkr00, &job->whiteToMove, fen, strlen(fen)) || !validSearchPosition(job->board, job->whiteToMove)) {
+		free(job);
+		return NULL;
+	}
+
+	job->task.run = runAnalysisJob;
+	job->limits = *limits;
+	job->index = index;
+
+	return job;
+}
+
+// An iteration of the search as one JSON object; the score is the side to
+// move's. Returns its length.
+size_t formatSearchInfo(char *out, size_t size, unsigned int index, SearchInfo const *info) {
+	int mate = searchScoreMate(info->score);
+	size_t len;
+
+	len = snprintf(out, size, "{\"index\":%u,\"depth\":%d,", index, info->depth);
+
+	// Mated shows as mate 0, stalemate as a draw
+	if (mate || (!info->pvLen && info->score))
+		len += snprintf(out + len, size - len, "\"score\":{\"mate\":%d},", mate);
+	else
+		len += snprintf(out + len, size - len, "\"score\":{\"cp\":%d},", searchScoreCp(info->score));
+
+	len += snprintf(out + len, size - len, "\"nodes\":%llu,\"nps\":%llu,\"time\":%llu,\"bestmove\":", (unsigned long long) info->nodes,
+		(unsigned long long) (info->timeUs ? info->nodes * 1000000 / info->timeUs : 0), (unsigned long long) (info->timeUs / 1000));
+
+	char *best = info->pvLen ? indicesToUci(info->pv[0]) : NULL;
+	len += snprintf(out + len, size - len, best ? "\"%s\",\"pv\":[" : "null,\"pv\":[", best);
+	free(best);
+
+	for (int i = 0; i < info->pvLen && len < size; i++) {
+		char *move = indicesToUci(info->pv[i]);
+		len += snprintf(out + len, size - len, i ? ",\"%s\"" : "\"%s\"", move);
+		free(move);
+	}
+
+	len += snprintf(out + len, size - len, "]}");
+
+	return len < size ? len : size - 1;
+}
+
+// The final result of the job
+size_t formatAnalysis(char *out, size_t size, AnalysisJob const *job) {
+	return formatSearchInfo(out, size, job->index, &job->info);
+}
+
+#endif /*__WEB_ANALYSIS__*/
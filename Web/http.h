@@ -0,0 +1,242 @@
+#ifndef __WEB_HTTP__
+#define __WEB_HTTP__
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+// Incremental HTTP/1.1 request parser. The caller appends whatever it reads
+// to one buffer and calls parseHTTPRequest again; parsing picks up where it
+// stopped, so every byte is looked at once however the request is split
+// between reads. Positions are offsets into that buffer, which may move as
+// it grows.
+
+#define HTTP_MAX_HEAD 8192
+#define HTTP_MAX_BODY (1 << 20)
+
+enum httpParseState {HTTP_REQUEST_LINE, HTTP_HEADERS, HTTP_BODY, HTTP_DONE, HTTP_ERROR};
+
+typedef struct HTTPSlice {
+	size_t start;
+	size_t len;
+} HTTPSlice;
+
+typedef struct HTTPRequest {
+	enum httpParseState state;
+	size_t scanned; // bytes of the buffer already parsed
+	size_t headLen; // request line and headers, blank line included
+	HTTPSlice method;
+	HTTPSlice target;
+	HTTPSlice body;
+	char minorVersion; // HTTP/1.x
+	char keepAlive;
+	size_t contentLength;
+	int status; // what to answer on HTTP_ERROR
+} HTTPRequest;
+
+void initHTTPRequest(HTTPRequest *);
+enum httpParseState parseHTTPRequest(HTTPRequest *, char const *, size_t);
+size_t httpRequestLength(HTTPRequest const *);
+int httpSliceIs(char const *, HTTPSlice, char const *);
+HTTPSlice httpPath(char const *, HTTPSlice);
+int httpQueryValue(char const *, HTTPSlice, char const *, char *, size_t);
+
+void initHTTPRequest(HTTPRequest *req) {
+	memset(req, 0, sizeof *req);
+	req->state = HTTP_REQUEST_LINE;
+}
+
+// Bytes the request takes up in the buffer once it is HTTP_DONE
+size_t httpRequestLength(HTTPRequest const *req) {
+	return req->headLen + req->contentLength;
+}
+
+int httpSliceIs(char const *buf, HTTPSlice slice, char const *str) {
+	return slice.len == strlen(str) && !memcmp(buf + slice.start, str, slice.len);
+}
+
+// The target without its query string
+HTTPSlice httpPath(char const *buf, HTTPSlice target) {
+	char const *query = memchr(buf + target.start, '?', target.len);
+
+	if (query)
+		target.len = query - (buf + target.start);
+
+	return target;
+}
+
+static int httpHexDigit(char c) {
+	return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+}
+
+// Copies the value of the first name=value pair of the target's query string
+// into out as a C string, with %XX escapes and '+' decoded. Returns 1 if it
+// was there, 0 if not, and -1 if it is malformed or doesn't fit in size.
+int httpQueryValue(char const *buf, HTTPSlice target, char const *name, char *out, size_t size) {
+	char const *pos = memchr(buf + target.start, '?', target.len);
+	char const *end = buf + target.start + target.len;
+	size_t nameLen = strlen(name);
+
+	for (pos = pos ? pos + 1 : end; pos < end;) {
+		char const *pairEnd = memchr(pos, '&', end - pos);
+		if (!pairEnd)
+			pairEnd = end;
+
+		if ((size_t) (pairEnd - pos) > nameLen && !memcmp(pos, name, nameLen) && pos[nameLen] == '=') {
+			size_t len = 0;
+
+			for (pos += nameLen + 1; pos < pairEnd; pos++) {
+				int c = *pos == '+' ? ' ' : *pos;
+
+				if (*pos == '%') {
+					int high = pairEnd - pos > 2 ? httpHexDigit(pos[1]) : -1;
+					int low = high >= 0 ? httpHexDigit(pos[2]) : -1;
+					if (low < 0)
+						return -1;
+					c = high * 16 + low;
+					pos += 2;
+				}
+				if (!c || len + 1 >= size)
+					return -1;
+				out[len++] = c;
+			}
+
+			out[len] = 0;
+			return 1;
+		}
+
+		pos = pairEnd + 1;
+	}
+
+	return 0;
+}
+
+static enum httpParseState httpFail(HTTPRequest *req, int status) {
+	req->status = status;
+	return req->state = HTTP_ERROR;
+}
+
+// Whether the comma-separated header value holds token, in any case
+static int httpHasToken(char const *value, size_t len, char const *token) {
+	size_t tokenLen = strlen(token);
+
+	for (size_t i = 0; i < len;) {
+		while (i < len && (value[i] == ' ' || value[i] == '\t' || value[i] == ','))
+			i++;
+
+		size_t start = i;
+		while (i < len && value[i] != ',' && value[i] != ' ' && value[i] != '\t')
+			i++;
+
+		if (i - start == tokenLen && !strncasecmp(value + start, token, tokenLen))
+			return 1;
+	}
+
+	return 0;
+}
+
+static enum httpParseState parseHTTPRequestLine(HTTPRequest *req, char const *buf, size_t start, size_t len) {
+	char const *line = buf + start;
+	char const *sp1 = memchr(line, ' ', len);
+	char const *sp2 = sp1 ? memchr(sp1 + 1, ' ', len - (sp1 + 1 - line)) : NULL;
+
+	if (!sp1 || !sp2 || sp1 == line || sp2 == sp1 + 1)
+		return httpFail(req, 400);
+
+	char const *version = sp2 + 1;
+	size_t versionLen = len - (version - line);
+	if (versionLen != 8 || memcmp(version, "HTTP/1.", 7) || !isdigit((unsigned char) version[7]))
+		return httpFail(req, versionLen > 5 && !memcmp(version, "HTTP/", 5) ? 505 : 400);
+
+	req->method = (HTTPSlice) {start, sp1 - line};
+	req->target = (HTTPSlice) {sp1 + 1 - buf, sp2 - (sp1 + 1)};
+	req->minorVersion = version[7] - '0';
+	req->keepAlive = req->minorVersion >= 1; // 1.0 closes unless asked not to
+
+	return req->state = HTTP_HEADERS;
+}
+
+static enum httpParseState parseHTTPHeader(HTTPRequest *req, char const *buf, size_t start, size_t len) {
+	char const *line = buf + start;
+	char const *colon = memchr(line, ':', len);
+
+	if (!colon || colon == line || line[0] == ' ' || line[0] == '\t')
+		return httpFail(req, 400);
+
+	size_t nameLen = colon - line;
+	char const *value = colon + 1;
+	size_t valueLen = len - nameLen - 1;
+	while (valueLen && (*value == ' ' || *value == '\t'))
+		value++, valueLen--;
+	while (valueLen && (value[valueLen - 1] == ' ' || value[valueLen - 1] == '\t'))
+		valueLen--;
+
+	if (nameLen == 14 && !strncasecmp(line, "Content-Length", 14)) {
+		size_t length = 0;
+
+		if (!valueLen)
+			return httpFail(req, 400);
+		for (size_t i = 0; i < valueLen; i++) {
+			if (!isdigit((unsigned char) value[i]))
+				return httpFail(req, 400);
+			if ((length = length * 10 + value[i] - '0') > HTTP_MAX_BODY)
+				return httpFail(req, 413);
+		}
+		req->contentLength = length;
+	} else if (nameLen == 17 && !strncasecmp(line, "Transfer-Encoding", 17))
+		return httpFail(req, 501); // no chunked request bodies
+	else if (nameLen == 10 && !strncasecmp(line, "Connection", 10)) {
+		if (httpHasToken(value, valueLen, "close"))
+			req->keepAlive = 0;
+		else if (httpHasToken(value, valueLen, "keep-alive"))
+			req->keepAlive = 1;
+	}
+
+	return req->state;
+}
+
+// Parses what's new in the len bytes of buf. HTTP_DONE means a whole request
+// (httpRequestLength bytes) is there; bytes after it belong to the next one.
+enum httpParseState parseHTTPRequest(HTTPRequest *req, char const *buf, size_t len) {
+	while (req->state == HTTP_REQUEST_LINE || req->state == HTTP_HEADERS) {
+		char const *nl = memchr(buf + req->scanned, '\n', len - req->scanned);
+
+		if (!nl) {
+			req->scanned = len;
+			if (len > HTTP_MAX_HEAD)
+				return httpFail(req, 431);
+			return req->state;
+		}
+
+		// Lines are scanned up to their newline, so a line starts where the
+		// previous request part ended
+		size_t start = req->headLen;
+		size_t end = nl - buf;
+		size_t lineLen = end - start;
+		if (lineLen && buf[end - 1] == '\r')
+			lineLen--;
+
+		req->scanned = req->headLen = end + 1;
+		if (req->headLen > HTTP_MAX_HEAD)
+			return httpFail(req, 431);
+
+		if (req->state == HTTP_REQUEST_LINE) {
+			// Empty lines before a request are allowed
+			if (lineLen)
+				parseHTTPRequestLine(req, buf, start, lineLen);
+		} else if (!lineLen)
+			req->state = HTTP_BODY;
+		else
+			parseHTTPHeader(req, buf, start, lineLen);
+	}
+
+	if (req->state == HTTP_BODY && len - req->headLen >= req->contentLength) {
+		req->body = (HTTPSlice) {req->headLen, req->contentLength};
+		req->scanned = req->headLen + req->contentLength;
+		req->state = HTTP_DONE;
+	}
+
+	return req->state;
+}
+
+#endif /*__WEB_HTTP__*/
@@ -0,0 +1,637 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "../Chess/game.h"
+#include "../Util/histogram.h"
+
+// Local stand-in for the parts of lichess the bot talks to: /api/account,
+// /api/stream/event, /api/bot/game/stream/{id}, /api/bot/game/{id}/move/{uci}
+// and /api/challenge/{id}/accept, over plain HTTP/1.1. Once the bot opens the
+// event stream it is challenged to games, up to a number at once, and plays
+// them against a random mover that answers after a fixed tempo. With -r the
+// games instead replay the gameFull/gameState lines of a recorded stream.
+// When every game is over (or on SIGINT) it reports how many moves the bot
+// made per second and how long it took to answer each position.
+//
+// Usage: Web/lichess-mock [-p port] [-g games] [-c concurrent] [-t tempo ms]
+//                         [-m max plies] [-s clock seconds] [-i bot id]
+//                         [-r recorded.ndjson]
+// Point the bot at it with LICHESS_URL=http://127.0.0.1:<port>
+
+#define MAXLINE 4096
+#define MAX_EVENTS 64
+
+#define errout(str, ...) {\
+	fprintf(stderr, str "\n", ## __VA_ARGS__);\
+	exit(-1);\
+}
+
+#define realerr(str, ...) {\
+	fprintf(stderr, str "\nError Code: %d\nError message: %s\n", ## __VA_ARGS__, errno, strerror(errno));\
+	exit(-1);\
+}
+
+enum mockConnType {CONN_REQUEST, CONN_EVENT_STREAM, CONN_GAME_STREAM};
+enum mockGameState {GAME_WAITING, GAME_CHALLENGED, GAME_ACCEPTED, GAME_STARTED, GAME_OVER};
+
+struct mockGame;
+
+struct mockConn {
+	int fd;
+	enum mockConnType type;
+	char in[MAXLINE + 1];
+	size_t inLen;
+	size_t skipBody; // request body bytes still to be discarded
+	char *out;
+	size_t outLen, outCap, outSent;
+	char closeAfterFlush;
+	struct mockGame *game;
+};
+
+struct mockGame {
+	char id[12]; // "m" and up to 10 digits
+	enum mockGameState state;
+	GameTracker tracker;
+	char botWhite;
+	char *moves;
+	size_t movesLen, movesCap;
+	struct mockConn *stream;
+	uint64_t botToMoveSince; // 0 unless the bot owes us a move
+	uint64_t opponentAt; // when the opponent moves (or the next recorded line is sent), 0 for never
+	size_t replayLine;
+};
+
+static struct {
+	unsigned int port;
+	unsigned int games;
+	unsigned int concurrent;
+	unsigned int tempo; // ms
+	unsigned int maxPlies;
+	long clock; // ms
+	char const *botId;
+	char const *replay;
+} config = {9000, 100, 10, 100, 200, 300000, "cosmobot", NULL};
+
+static int epfd;
+static struct mockGame *games;
+static unsigned int started, active, finished;
+static struct mockConn *eventStream;
+static char **replayLines;
+static size_t replayCount;
+
+static Histogram responseLatency; // us from the position reaching the bot to its move reaching us
+static uint64_t botMoves, illegalMoves, firstEventAt;
+static volatile sig_atomic_t interrupted;
+
+void sendEvent(struct mockConn *, char const *, size_t);
+void finishGame(struct mockGame *, char const *);
+
+void interrupt(int sig) {
+	interrupted = 1;
+}
+
+void watchConn(struct mockConn *conn, int writable) {
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | (writable ? EPOLLOUT : 0);
+	ev.data.ptr = conn;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+void closeConn(struct mockConn *conn) {
+	if (conn == eventStream)
+		eventStream = NULL;
+	if (conn->game && conn->game->stream == conn)
+		conn->game->stream = NULL;
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	free(conn->out);
+	free(conn);
+}
+
+// Returns 0 if the connection was closed
+int flushConn(struct mockConn *conn) {
+	while (conn->outSent < conn->outLen) {
+		ssize_t n = write(conn->fd, conn->out + conn->outSent, conn->outLen - conn->outSent);
+		if (n == -1) {
+			if (errno == EAGAIN) {
+				watchConn(conn, 1);
+				return 1;
+			}
+			closeConn(conn);
+			return 0;
+		}
+		conn->outSent += n;
+	}
+
+	conn->outLen = conn->outSent = 0;
+	watchConn(conn, 0);
+
+	if (conn->closeAfterFlush) {
+		closeConn(conn);
+		return 0;
+	}
+
+	return 1;
+}
+
+void queueOut(struct mockConn *conn, char const *data, size_t len) {
+	if (conn->outLen + len > conn->outCap) {
+		conn->outCap = (conn->outLen + len) * 2;
+		conn->out = realloc(conn->out, conn->outCap);
+	}
+	memcpy(conn->out + conn->outLen, data, len);
+	conn->outLen += len;
+}
+
+void respond(struct mockConn *conn, char const *status, char const *body) {
+	char head[256];
+	int len = sprintf(head, "HTTP/1.1 %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n", status, strlen(body));
+
+	queueOut(conn, head, len);
+	queueOut(conn, body, strlen(body));
+}
+
+void startStream(struct mockConn *conn, enum mockConnType type) {
+	static char const head[] = "HTTP/1.1 200 OK\r\nContent-Type: application/x-ndjson\r\nConnection: close\r\n\r\n";
+
+	conn->type = type;
+	queueOut(conn, head, sizeof head - 1);
+}
+
+void sendEvent(struct mockConn *conn, char const *line, size_t len) {
+	if (!conn)
+		return;
+	queueOut(conn, line, len);
+	queueOut(conn, "\n", 1);
+	flushConn(conn);
+}
+
+struct mockGame *findGame(char const *id, size_t len) {
+	for (unsigned int i = 0; i < started; i++)
+		if (strlen(games[i].id) == len && !memcmp(games[i].id, id, len))
+			return games + i;
+	return NULL;
+}
+
+// Challenges the bot until enough games are under way
+void startGames(void) {
+	char line[256];
+
+	while (eventStream && active < config.concurrent && started < config.games) {
+		struct mockGame *game = games + started++;
+
+		snprintf(game->id, sizeof game->id, "m%07u", started);
+		game->state = GAME_CHALLENGED;
+		game->botWhite = started % 2;
+		initGameTracker(&game->tracker);
+		active++;
+
+		int len = sprintf(line, "{\"type\":\"challenge\",\"challenge\":{\"id\":\"%s\",\"status\":\"created\",\"challenger\":{\"id\":\"mockopponent\",\"name\":\"MockOpponent\"},\"destUser\":{\"id\":\"%s\"},\"variant\":{\"key\":\"standard\"},\"rated\":false,\"speed\":\"blitz\"}}", game->id, config.botId);
+		sendEvent(eventStream, line, len);
+	}
+}
+
+static void appendMove(struct mockGame *game, char const *uci) {
+	size_t len = strlen(uci);
+
+	if (game->movesLen + len + 2 > game->movesCap) {
+		game->movesCap = (game->movesLen + len + 2) * 2;
+		game->moves = realloc(game->moves, game->movesCap);
+	}
+	if (game->movesLen)
+		game->moves[game->movesLen++] = ' ';
+	memcpy(game->moves + game->movesLen, uci, len + 1);
+	game->movesLen += len;
+
+	updateGameTracker(&game->tracker, game->moves, game->movesLen);
+}
+
+static void sendGameState(struct mockGame *game, char const *status, char full) {
+	char head[512];
+	int len;
+
+	if (!game->stream)
+		return;
+
+	if (full) {
+		len = sprintf(head, "{\"type\":\"gameFull\",\"id\":\"%s\",\"rated\":false,\"variant\":{\"key\":\"standard\"},\"clock\":{\"initial\":%ld,\"increment\":0},\"speed\":\"blitz\",\"white\":{\"id\":\"%s\",\"name\":\"%s\"},\"black\":{\"id\":\"%s\",\"name\":\"%s\"},\"initialFen\":\"startpos\",\"state\":", game->id, config.clock, game->botWhite ? config.botId : "mockopponent", game->botWhite ? config.botId : "MockOpponent", game->botWhite ? "mockopponent" : config.botId, game->botWhite ? "MockOpponent" : config.botId);
+		queueOut(game->stream, head, len);
+	}
+
+	queueOut(game->stream, "{\"type\":\"gameState\",\"moves\":\"", 29);
+	queueOut(game->stream, game->moves ? game->moves : "", game->movesLen);
+	len = sprintf(head, "\",\"wtime\":%ld,\"btime\":%ld,\"winc\":0,\"binc\":0,\"status\":\"%s\"}%s", config.clock, config.clock, status, full ? "}" : "");
+	sendEvent(game->stream, head, len);
+}
+
+// Legal moves for the side to move, 3 bytes each
+static unsigned long legalMoves(struct mockGame *game, char **moves) {
+	*moves = NULL;
+	return validMoves(game->tracker.board, game->tracker.prevBoard, game->tracker.brkrwr00, game->tracker.whiteToMove, moves);
+}
+
+// Ends the game if the side to move has no legal move or the game is long enough
+static int checkGameOver(struct mockGame *game) {
+	char *moves;
+	unsigned long len = legalMoves(game, &moves);
+	free(moves);
+
+	if (!len)
+		finishGame(game, isCheckOnKing(game->tracker.board, game->tracker.whiteToMove) ? "mate" : "stalemate");
+	else if (game->tracker.plies >= config.maxPlies)
+		finishGame(game, "draw");
+	else
+		return 0;
+
+	return 1;
+}
+
+void opponentMove(struct mockGame *game, uint64_t now) {
+	game->opponentAt = 0;
+
+	if (config.replay) {
+		if (game->replayLine >= replayCount) {
+			finishGame(game, "draw");
+			return;
+		}
+		sendEvent(game->stream, replayLines[game->replayLine], strlen(replayLines[game->replayLine]));
+		game->replayLine++;
+		game->botToMoveSince = now;
+		game->opponentAt = now + config.tempo * 1000000ull;
+		return;
+	}
+
+	char *moves;
+	unsigned long len = legalMoves(game, &moves);
+	char *uci = indicesToUci(moves + rand() % (len / 3) * 3);
+
+	appendMove(game, uci);
+	free(uci);
+	free(moves);
+
+	if (checkGameOver(game))
+		return;
+
+	sendGameState(game, "started", 0);
+	game->botToMoveSince = now;
+}
+
+void finishGame(struct mockGame *game, char const *status) {
+	if (game->state == GAME_OVER)
+		return;
+
+	if (!config.replay)
+		sendGameState(game, status, 0);
+
+	game->state = GAME_OVER;
+	game->opponentAt = game->botToMoveSince = 0;
+	if (game->stream) {
+		game->stream->closeAfterFlush = 1;
+		flushConn(game->stream);
+	}
+
+	freeGameTracker(&game->tracker);
+	active--;
+	finished++;
+
+	startGames();
+}
+
+void botMove(struct mockConn *conn, struct mockGame *game, char const *uci, uint64_t now) {
+	if (!game || game->state != GAME_STARTED) {
+		respond(conn, "404 Not Found", "{\"error\":\"No such game\"}");
+		return;
+	}
+
+	if (config.replay) {
+		if (game->botToMoveSince) {
+			recordHistogram(&responseLatency, (now - game->botToMoveSince) / 1000);
+			game->botToMoveSince = 0;
+		}
+		botMoves++;
+		respond(conn, "200 OK", "{\"ok\":true}");
+		return;
+	}
+
+	char *moves, legal = 0;
+	unsigned long len = game->tracker.whiteToMove == game->botWhite ? legalMoves(game, &moves) : (moves = NULL, 0);
+
+	for (unsigned long i = 0; i < len && !legal; i += 3) {
+		char *candidate = indicesToUci(moves + i);
+		legal = !strcmp(candidate, uci);
+		free(candidate);
+	}
+	free(moves);
+
+	if (!legal) {
+		illegalMoves++;
+		respond(conn, "400 Bad Request", "{\"error\":\"Not your turn, or invalid move\"}");
+		return;
+	}
+
+	recordHistogram(&responseLatency, (now - game->botToMoveSince) / 1000);
+	game->botToMoveSince = 0;
+	botMoves++;
+	respond(conn, "200 OK", "{\"ok\":true}");
+
+	appendMove(game, uci);
+	if (checkGameOver(game))
+		return;
+
+	// lichess echoes our own move back on the game stream
+	sendGameState(game, "started", 0);
+	game->opponentAt = now + config.tempo * 1000000ull;
+}
+
+void streamGame(struct mockConn *conn, struct mockGame *game, uint64_t now) {
+	if (!game || game->state < GAME_ACCEPTED || game->state == GAME_OVER) {
+		respond(conn, "404 Not Found", "{\"error\":\"No such game\"}");
+		return;
+	}
+
+	startStream(conn, CONN_GAME_STREAM);
+	conn->game = game;
+	game->stream = conn;
+
+	if (game->state == GAME_STARTED) {
+		// Reconnect: a gameFull with everything so far
+		sendGameState(game, "started", 1);
+		return;
+	}
+	game->state = GAME_STARTED;
+
+	if (config.replay) {
+		game->replayLine = 0;
+		opponentMove(game, now); // the recorded gameFull
+		return;
+	}
+
+	sendGameState(game, "started", 1);
+	if (game->botWhite)
+		game->botToMoveSince = now;
+	else
+		game->opponentAt = now + config.tempo * 1000000ull;
+}
+
+// Handles one complete request head
+void handleRequest(struct mockConn *conn, char *method, char *path) {
+	uint64_t now = monotonicNs();
+	char line[256];
+
+	if (!strcmp(method, "GET") && !strcmp(path, "/api/account")) {
+		sprintf(line, "{\"id\":\"%s\",\"username\":\"%s\",\"title\":\"BOT\"}", config.botId, config.botId);
+		respond(conn, "200 OK", line);
+	} else if (!strcmp(method, "GET") && !strcmp(path, "/api/stream/event")) {
+		startStream(conn, CONN_EVENT_STREAM);
+		if (eventStream)
+			eventStream->closeAfterFlush = 1;
+		eventStream = conn;
+		if (!firstEventAt)
+			firstEventAt = now;
+		flushConn(conn);
+		startGames();
+	} else if (!strcmp(method, "GET") && !strncmp(path, "/api/bot/game/stream/", 21)) {
+		streamGame(conn, findGame(path + 21, strlen(path + 21)), now);
+	} else if (!strcmp(method, "POST") && !strncmp(path, "/api/bot/game/", 14) && strstr(path + 14, "/move/")) {
+		char *move = strstr(path + 14, "/move/");
+		botMove(conn, findGame(path + 14, move - (path + 14)), move + 6, now);
+	} else if (!strcmp(method, "POST") && !strncmp(path, "/api/challenge/", 15) && strstr(path + 15, "/accept")) {
+		struct mockGame *game = findGame(path + 15, strstr(path + 15, "/accept") - (path + 15));
+		if (!game || game->state != GAME_CHALLENGED)
+			respond(conn, "404 Not Found", "{\"error\":\"No such challenge\"}");
+		else {
+			game->state = GAME_ACCEPTED;
+			respond(conn, "200 OK", "{\"ok\":true}");
+			int len = sprintf(line, "{\"type\":\"gameStart\",\"game\":{\"id\":\"%s\",\"gameId\":\"%s\"}}", game->id, game->id);
+			sendEvent(eventStream, line, len);
+		}
+	} else
+		respond(conn, "404 Not Found", "{\"error\":\"Not found\"}");
+}
+
+void readConn(struct mockConn *conn) {
+	while (1) {
+		ssize_t n = read(conn->fd, conn->in + conn->inLen, MAXLINE - conn->inLen);
+		if (n == 0 || (n == -1 && errno != EAGAIN)) {
+			closeConn(conn);
+			return;
+		}
+		if (n == -1)
+			break;
+		conn->inLen += n;
+
+		// Streams don't take further requests; anything the client sends is dropped
+		if (conn->type != CONN_REQUEST) {
+			conn->inLen = 0;
+			continue;
+		}
+
+		while (conn->inLen) {
+			if (conn->skipBody) {
+				size_t skip = conn->skipBody < conn->inLen ? conn->skipBody : conn->inLen;
+				memmove(conn->in, conn->in + skip, conn->inLen - skip);
+				conn->inLen -= skip;
+				conn->skipBody -= skip;
+				continue;
+			}
+
+			conn->in[conn->inLen] = 0;
+			char *end = strstr(conn->in, "\r\n\r\n");
+			if (!end) {
+				if (conn->inLen == MAXLINE) {
+					closeConn(conn);
+					return;
+				}
+				break;
+			}
+
+			char method[8], path[1024];
+			char *length = strstr(conn->in, "\r\nContent-Length:");
+			if (!length)
+				length = strstr(conn->in, "\r\ncontent-length:");
+			if (length && length < end)
+				conn->skipBody = strtoul(length + 17, NULL, 10);
+
+			if (sscanf(conn->in, "%7s %1023s", method, path) == 2)
+				handleRequest(conn, method, path);
+			else
+				respond(conn, "400 Bad Request", "{\"error\":\"Bad request\"}");
+
+			size_t used = end + 4 - conn->in;
+			memmove(conn->in, end + 4, conn->inLen - used);
+			conn->inLen -= used;
+
+			if (conn->type != CONN_REQUEST) {
+				conn->inLen = 0;
+				break;
+			}
+		}
+
+		if (!flushConn(conn))
+			return;
+	}
+}
+
+void acceptConns(int listenfd) {
+	int fd;
+
+	while ((fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+		struct mockConn *conn = calloc(1, sizeof *conn);
+		struct epoll_event ev;
+		int one = 1;
+
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+		conn->fd = fd;
+		ev.events = EPOLLIN;
+		ev.data.ptr = conn;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			close(fd);
+			free(conn);
+		}
+	}
+}
+
+void loadReplay(char const *path) {
+	FILE *fp = fopen(path, "r");
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+
+	if (!fp)
+		realerr("Cannot open %s", path);
+
+	while ((len = getline(&line, &cap, fp)) > 0) {
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = 0;
+		if (!strstr(line, "\"type\":\"gameFull\"") && !strstr(line, "\"type\":\"gameState\""))
+			continue;
+		// Each game starts from the first gameFull
+		if (!replayCount && !strstr(line, "\"type\":\"gameFull\""))
+			continue;
+
+		replayLines = realloc(replayLines, (replayCount + 1) * sizeof *replayLines);
+		replayLines[replayCount++] = strcpy(malloc(len + 1), line);
+	}
+
+	free(line);
+	fclose(fp);
+
+	if (!replayCount)
+		errout("%s has no gameFull event", path);
+}
+
+void report(void) {
+	double elapsed = firstEventAt ? (monotonicNs() - firstEventAt) / 1e9 : 0;
+
+	printf("games: %u finished of %u (%u at once), %llu bot moves, %llu illegal\n", finished, config.games, config.concurrent, (unsigned long long) botMoves, (unsigned long long) illegalMoves);
+	printf("throughput: %.1f bot moves/s over %.2f s\n", elapsed > 0 ? botMoves / elapsed : 0, elapsed);
+	printf("response latency (us):\n");
+	printHistogram(stdout, "move", &responseLatency);
+	fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+	int listenfd, opt, one = 1;
+	struct sockaddr_in servaddr;
+	struct epoll_event ev, events[MAX_EVENTS];
+
+	while ((opt = getopt(argc, argv, "p:g:c:t:m:s:i:r:")) != -1)
+		switch (opt) {
+			case 'p': config.port = atoi(optarg); break;
+			case 'g': config.games = atoi(optarg); break;
+			case 'c': config.concurrent = atoi(optarg); break;
+			case 't': config.tempo = atoi(optarg); break;
+			case 'm': config.maxPlies = atoi(optarg); break;
+			case 's': config.clock = atol(optarg) * 1000; break;
+			case 'i': config.botId = optarg; break;
+			case 'r': config.replay = optarg; break;
+			default: errout("Usage: %s [-p port] [-g games] [-c concurrent] [-t tempo ms] [-m max plies] [-s clock seconds] [-i bot id] [-r recorded.ndjson]", argv[0]);
+		}
+
+	if (config.replay)
+		loadReplay(config.replay);
+
+	srand(time(0));
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, interrupt);
+	initHistogram(&responseLatency);
+	games = calloc(config.games ? config.games : 1, sizeof *games);
+
+	if ((listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1)
+		realerr("Error while creating the socket");
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+	memset(&servaddr, 0, sizeof servaddr);
+	servaddr.sin_family = AF_INET;
+	servaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	servaddr.sin_port = htons(config.port);
+
+	if (bind(listenfd, (struct sockaddr *) &servaddr, sizeof servaddr) == -1)
+		realerr("Bind error");
+	if (listen(listenfd, SOMAXCONN) == -1)
+		realerr("Listen error");
+
+	if ((epfd = epoll_create1(0)) == -1)
+		realerr("epoll_create1 failed");
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+
+	printf("Mock lichess on http://127.0.0.1:%u: %u games, %u at once, %u ms tempo%s%s\n", config.port, config.games, config.concurrent, config.tempo, config.replay ? ", replaying " : "", config.replay ? config.replay : "");
+	fflush(stdout);
+
+	while (!interrupted && finished < config.games) {
+		uint64_t now = monotonicNs(), next = 0;
+
+		// The opponent moves that are due, and the time until the next one
+		for (unsigned int i = 0; i < started; i++) {
+			if (!games[i].opponentAt || games[i].state != GAME_STARTED)
+				continue;
+			if (games[i].opponentAt <= now)
+				opponentMove(games + i, now);
+			if (games[i].opponentAt && (!next || games[i].opponentAt < next))
+				next = games[i].opponentAt;
+		}
+		if (finished >= config.games)
+			break;
+
+		int timeout = next ? (int) ((next - now + 999999) / 1000000) : -1;
+		int n = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			realerr("epoll_wait failed");
+		}
+
+		for (int i = 0; i < n; i++) {
+			struct mockConn *conn = events[i].data.ptr;
+
+			if (!conn)
+				acceptConns(listenfd);
+			else if (events[i].events & (EPOLLERR | EPOLLHUP))
+				closeConn(conn);
+			else if (events[i].events & EPOLLOUT && !flushConn(conn))
+				continue;
+			else if (events[i].events & EPOLLIN)
+				readConn(conn);
+		}
+	}
+
+	report();
+
+	return 0;
+}
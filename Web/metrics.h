@@ -0,0 +1,77 @@
+#ifndef __WEB_METRICS__
+#define __WEB_METRICS__
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "../Util/stats.h"
+
+// GET /metrics in the Prometheus text format: the server's own counters and
+// whatever the bot published in its shared memory segment (Util/stats.h).
+// Every scrape maps the segment afresh, so it follows the bot across
+// restarts, and only reads it.
+
+#define METRICS_SIZE 8192
+
+typedef struct MetricsText {
+	char text[METRICS_SIZE];
+	size_t len;
+} MetricsText;
+
+void writeMetric(MetricsText *, char const *, char const *, char const *, double);
+void writeBotMetrics(MetricsText *, char const *);
+
+static void metricsPrintf(MetricsText *metrics, char const *format, ...) {
+	va_list args;
+	int len;
+
+	if (metrics->len >= sizeof metrics->text)
+		return;
+
+	va_start(args, format);
+	len = vsnprintf(metrics->text + metrics->len, sizeof metrics->text - metrics->len, format, args);
+	va_end(args);
+
+	metrics->len = len < 0 ? sizeof metrics->text : metrics->len + len;
+}
+
+// One sample with its HELP and TYPE lines; type is "counter" or "gauge"
+void writeMetric(MetricsText *metrics, char const *name, char const *type, char const *help, double value) {
+	metricsPrintf(metrics, "# HELP %s %s\n# TYPE %s %s\n%s %.15g\n", name, help, name, type, name, value);
+}
+
+// cosmo_bot_up is 0 if there is no bot, or only the segment of one that
+// died; its counters are still shown then, as it left them
+void writeBotMetrics(MetricsText *metrics, char const *name) {
+	BotStats const *stats = mapBotStats(name);
+	char live = stats && botStatsLive(stats);
+
+	writeMetric(metrics, "cosmo_bot_up", "gauge", "Whether the bot is running", live);
+	if (!stats)
+		return;
+
+	writeMetric(metrics, "cosmo_bot_start_time_seconds", "gauge", "When the bot started, in seconds since the epoch", statGet(&stats->startedMs) / 1000.0);
+	if (live)
+		writeMetric(metrics, "cosmo_bot_resident_memory_bytes", "gauge", "Resident set of the bot", processResidentBytes(atomic_load((atomic_int *) &stats->pid)));
+
+	writeMetric(metrics, "cosmo_bot_active_games", "gauge", "Games being played", statGet(&stats->activeGames));
+	writeMetric(metrics, "cosmo_bot_games_started_total", "counter", "Games started", statGet(&stats->gamesStarted));
+	writeMetric(metrics, "cosmo_bot_moves_played_total", "counter", "Moves sent to lichess", statGet(&stats->movesPlayed));
+
+	writeMetric(metrics, "cosmo_bot_searches_total", "counter", "Searches for a move", statGet(&stats->searches));
+	writeMetric(metrics, "cosmo_bot_search_nodes_total", "counter", "Nodes generated by those searches", statGet(&stats->searchNodes));
+	writeMetric(metrics, "cosmo_bot_search_seconds_total", "counter", "Time spent searching", statGet(&stats->searchUs) / 1e6);
+	writeMetric(metrics, "cosmo_bot_search_budget_seconds_total", "counter", "Time the clock allowed for the searches it was known for", statGet(&stats->searchBudgetUs) / 1e6);
+	writeMetric(metrics, "cosmo_bot_searches_over_budget_total", "counter", "Searches that took longer than the clock allowed", statGet(&stats->searchesOverBudget));
+	writeMetric(metrics, "cosmo_bot_last_search_nodes_per_second", "gauge", "Speed of the last search", statGet(&stats->lastSearchNps));
+
+	writeMetric(metrics, "cosmo_bot_json_bytes_total", "counter", "Bytes of the event and game streams parsed", statGet(&stats->jsonBytes));
+	writeMetric(metrics, "cosmo_bot_json_events_total", "counter", "Events of the event and game streams parsed", statGet(&stats->jsonEvents));
+
+	writeMetric(metrics, "cosmo_bot_curl_errors_total", "counter", "Transfers that failed in curl", statGet(&stats->curlErrors));
+	writeMetric(metrics, "cosmo_bot_http_errors_total", "counter", "Transfers lichess answered with an error status", statGet(&stats->httpErrors));
+
+	unmapBotStats(stats);
+}
+
+#endif /*__WEB_METRICS__*/
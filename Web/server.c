@@ -1,6 +1,14 @@
+#define _GNU_SOURCE
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
+#include <sched.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -10,11 +18,51 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <sys/time.h>
-#include <sys/ioctl.h>
-#include <netdb.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "../Util/log.h"
+#include "../Util/pool.h"
+#include "http.h"
+#include "analysis.h"
+#include "metrics.h"
+
+// Every worker thread has its own listening socket on the port (with
+// SO_REUSEPORT the kernel spreads new connections between them), its own
+// edge-triggered epoll loop and its own core, and shares nothing with the
+// others, so no lock is taken from accept to close. Sockets are
+// non-blocking, so a slow client only ever holds up itself. Every
+// connection is a small state machine: it reads until a request is complete
+// (http.h parses as bytes come in), answers it, and either waits for the
+// next request on the same connection or closes once the answer is out.
+// Connections that are partway through a request or an answer and those
+// idling between requests sit on two lists ordered by deadline, so timeouts
+// cost nothing until they fire.
+//
+// Analyses (analysis.h) are too slow for a worker to run itself, so they go
+// to a pool of search threads shared by all workers. Finished ones are
+// handed back to the worker that owns the connection over a lock-free list
+// and an eventfd, and the connection waits for them before it reads its next
+// request. A batch is answered as a stream, one chunk per position in the
+// order they finish, and /analyze/stream as Server-Sent Events, one per
+// iteration of the search. Closing a connection stops its searches.
+//
+// Every worker counts what it did with relaxed atomics of its own, which
+// /metrics adds up across workers along with what the bot published.
 
 #define MAXLINE 4096
+#define LOG_RECORDS 256
+#define MAX_EVENTS 256
+#define DEFAULT_PORT 8080
+#define MAX_WORKERS 256
+#define REQUEST_TIMEOUT_MS 10000 // to send a whole request or take a whole answer
+#define IDLE_TIMEOUT_MS 60000 // between requests on a kept-alive connection
+#define MAX_IN (HTTP_MAX_HEAD + HTTP_MAX_BODY + MAXLINE) // buffered, pipelined requests included
+#define MAX_OUT (1 << 16) // pending answers before pipelined requests wait
+#define SEARCH_QUEUE (1 << 16) // analyses waiting for a search thread
+#define MAX_QUERY_VALUE 256
+
+#define XSTR(x) #x
+#define STR(x) XSTR(x)
 
 #define errout(str, ...) {\
 	fprintf(stderr, str "\n", ## __VA_ARGS__);\
@@ -26,83 +74,921 @@
 	exit(-1);\
 }
 
-void myprint(char const *);
+struct connection;
+
+// An iteration of a streamed analysis, on its way from the search thread
+struct analysisEvent {
+	struct analysisEvent *next;
+	struct connection *conn;
+	size_t len;
+	char text[];
+};
+
+// Connections with the same timeout, oldest deadline first
+struct timeoutList {
+	struct connection *head, *tail;
+	unsigned int timeoutMs;
+};
+
+struct eventLoop {
+	unsigned int worker;
+	int cpu; // pinned to, or -1
+	pthread_t thread;
+	int epfd;
+	int listenfd;
+	char accepting; // off while we're out of file descriptors
+	unsigned int connections;
+	struct timeoutList active, idle;
+	int wakefd; // written when finished goes from empty to not
+	_Atomic(AnalysisJob *) finished; // pushed by the search threads
+	_Atomic(struct analysisEvent *) events; // likewise
+	JSONDocument doc; // request bodies, parsed one at a time
+	struct connection *closed; // to free once the epoll batch is handled
+	atomic_ulong requests, analyses, analysisNodes, analysisUs, open; // for /metrics, read by every worker
+};
+
+struct connection {
+	int fd;
+	struct eventLoop *loop;
+	char *in;
+	size_t inLen, inCap;
+	char *out;
+	size_t outLen, outSent, outCap;
+	HTTPRequest req;
+	char closing; // close once out is sent
+	char readPaused; // stopped reading at MAX_IN with bytes left in the socket
+	unsigned int jobs; // analyses still running for the current request
+	char streaming; // answering the current request one chunk at a time
+	char chunked; // with chunked transfer coding; HTTP/1.0 ends the stream by closing
+	char eventStream; // text/event-stream rather than one JSON object a line
+	char closed; // fd is gone; freed once no job or epoll event points at it
+	atomic_int cancel; // stops the jobs; set once it's closed
+	uint64_t deadline;
+	struct timeoutList *list;
+	struct connection *prev, *next;
+	struct connection *nextClosed;
+};
+
+void myprint(char const *, size_t);
 unsigned int Atoui(char const *);
+int readConnection(struct connection *);
+static int advanceConnection(struct connection *);
 
-int main(int argc, char **argv) {
-	unsigned int SERVER_PORT = Atoui(getenv("PORT"));
-	int listenfd, connfd, n;
+// Every worker's analyses run here
+static ThreadPool searchPool;
+
+static struct eventLoop loops[MAX_WORKERS];
+static unsigned int workers;
+
+static inline uint64_t monotonicMs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void unlinkTimeout(struct connection *conn) {
+	struct timeoutList *list = conn->list;
+
+	if (!list)
+		return;
+
+	if (conn->prev)
+		conn->prev->next = conn->next;
+	else
+		list->head = conn->next;
+	if (conn->next)
+		conn->next->prev = conn->prev;
+	else
+		list->tail = conn->prev;
+
+	conn->list = NULL;
+	conn->prev = conn->next = NULL;
+}
+
+// Restarts the connection's timeout on list
+static void touchConnection(struct connection *conn, struct timeoutList *list) {
+	unlinkTimeout(conn);
+
+	conn->deadline = monotonicMs() + list->timeoutMs;
+	conn->list = list;
+	conn->prev = list->tail;
+	if (list->tail)
+		list->tail->next = conn;
+	else
+		list->head = conn;
+	list->tail = conn;
+}
+
+static void freeConnection(struct connection *conn) {
+	free(conn->in);
+	free(conn->out);
+	free(conn);
+}
+
+// Later events of the same epoll batch may still point at a closed
+// connection, so it's freed only once the batch is handled
+static void retireConnection(struct connection *conn) {
+	conn->nextClosed = conn->loop->closed;
+	conn->loop->closed = conn;
+}
+
+static void freeClosedConnections(struct eventLoop *loop) {
+	while (loop->closed) {
+		struct connection *conn = loop->closed;
+		loop->closed = conn->nextClosed;
+		freeConnection(conn);
+	}
+}
+
+void closeConnection(struct connection *conn) {
+	struct eventLoop *loop = conn->loop;
+
+	if (conn->closed)
+		return;
+	conn->closed = 1;
+
+	unlinkTimeout(conn);
+	close(conn->fd);
+
+	loop->connections--;
+	statSet(&loop->open, loop->connections);
+	if (!loop->accepting) {
+		struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+		if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, loop->listenfd, &ev) != -1)
+			loop->accepting = 1;
+	}
+
+	// Analyses still running hold on to it; the last one back retires it
+	if (conn->jobs)
+		atomic_store_explicit(&conn->cancel, 1, memory_order_relaxed);
+	else
+		retireConnection(conn);
+}
+
+static int reserve(char **buf, size_t *cap, size_t need) {
+	if (need <= *cap)
+		return 1;
+
+	size_t newCap = *cap ? *cap : MAXLINE;
+	while (newCap < need)
+		newCap *= 2;
+
+	char *newBuf = realloc(*buf, newCap);
+	if (!newBuf)
+		return 0;
+
+	*buf = newBuf;
+	*cap = newCap;
+	return 1;
+}
+
+static void queueOut(struct connection *conn, char const *data, size_t len) {
+	if (!reserve(&conn->out, &conn->outCap, conn->outLen + len)) {
+		conn->closing = 1;
+		return;
+	}
+
+	memcpy(conn->out + conn->outLen, data, len);
+	conn->outLen += len;
+}
+
+static char const *statusText(int status) {
+	switch (status) {
+		case 200: return "OK";
+		case 400: return "Bad Request";
+		case 404: return "Not Found";
+		case 405: return "Method Not Allowed";
+		case 408: return "Request Timeout";
+		case 413: return "Content Too Large";
+		case 431: return "Request Header Fields Too Large";
+		case 501: return "Not Implemented";
+		case 503: return "Service Unavailable";
+		case 505: return "HTTP Version Not Supported";
+		default: return "Internal Server Error";
+	}
+}
+
+void respond(struct connection *conn, int status, char const *type, char const *body, size_t len) {
+	char head[256];
+	char keepAlive = !conn->closing && conn->req.keepAlive;
+	char headOnly = httpSliceIs(conn->in, conn->req.method, "HEAD");
+
+	int headLen = snprintf(head, sizeof head, "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n%s\r\n", status, statusText(status), type, len,
+		!keepAlive ? "Connection: close\r\n" : conn->req.minorVersion == 0 ? "Connection: keep-alive\r\n" : "");
+
+	queueOut(conn, head, headLen);
+	if (!headOnly)
+		queueOut(conn, body, len);
+
+	if (!keepAlive)
+		conn->closing = 1;
+}
+
+void respondError(struct connection *conn, int status, char const *message) {
+	char body[256];
+	int len = snprintf(body, sizeof body, "{\"error\":\"%s\"}", message);
+
+	respond(conn, status, "application/json", body, len < (int) sizeof body ? len : (int) sizeof body - 1);
+}
+
+// Sends the head of an answer whose body comes in pieces through queueChunk
+void startStream(struct connection *conn, char const *type) {
+	char head[256];
+
+	// HTTP/1.0 has no chunks, so the end of the body is the end of the connection
+	conn->chunked = conn->req.minorVersion >= 1;
+	if (!conn->chunked || !conn->req.keepAlive)
+		conn->closing = 1;
+
+	int headLen = snprintf(head, sizeof head, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nCache-Control: no-cache\r\n%s%s\r\n", type, conn->chunked ? "Transfer-Encoding: chunked\r\n" : "", conn->closing ? "Connection: close\r\n" : "");
+
+	queueOut(conn, head, headLen);
+	conn->streaming = 1;
+}
+
+// A piece of a streamed body; len 0 ends it
+void queueChunk(struct connection *conn, char const *data, size_t len) {
+	char size[24];
+
+	if (!len) {
+		if (conn->chunked)
+			queueOut(conn, "0\r\n\r\n", 5);
+		return;
+	}
+	if (!conn->chunked) {
+		queueOut(conn, data, len);
+		return;
+	}
+
+	queueOut(conn, size, snprintf(size, sizeof size, "%zx\r\n", len));
+	queueOut(conn, data, len);
+	queueOut(conn, "\r\n", 2);
+}
+
+// Drops the answered request from the buffer, making way for the next one
+static void finishRequest(struct connection *conn) {
+	size_t used = httpRequestLength(&conn->req);
+
+	memmove(conn->in, conn->in + used, conn->inLen - used);
+	conn->inLen -= used;
+	conn->streaming = conn->eventStream = 0;
+	initHTTPRequest(&conn->req);
+}
+
+static void wakeLoop(struct eventLoop *loop) {
+	uint64_t one = 1;
+
+	if (write(loop->wakefd, &one, sizeof one) == -1 && errno != EAGAIN)
+		logMessage(LEVEL_ERROR, "Cannot wake worker %u: %s", loop->worker, strerror(errno));
+}
+
+// Runs on the search thread: hands the job back to the connection's worker
+static void analysisDone(AnalysisJob *job) {
+	struct eventLoop *loop = ((struct connection *) job->data)->loop;
+	AnalysisJob *head = atomic_load_explicit(&loop->finished, memory_order_relaxed);
+
+	do
+		job->next = head;
+	while (!atomic_compare_exchange_weak_explicit(&loop->finished, &head, job, memory_order_release, memory_order_relaxed));
+
+	// A list that wasn't empty has a wake-up on the way already
+	if (!head)
+		wakeLoop(loop);
+}
+
+// Runs on the search thread after every iteration of a streamed analysis.
+// The event is formatted here so the worker only has to copy it out.
+static void analysisIteration(SearchInfo const *info, void *jobPtr) {
+	AnalysisJob *job = jobPtr;
+	struct connection *conn = job->data;
+	struct eventLoop *loop = conn->loop;
+	char result[ANALYSIS_RESULT_SIZE];
+	size_t len = formatSearchInfo(result, sizeof result, job->index, info);
+	struct analysisEvent *event = malloc(sizeof *event + len + 32);
+
+	if (!event)
+		return;
+
+	event->conn = conn;
+	event->len = sprintf(event->text, "event: info\ndata: %.*s\n\n", (int) len, result);
+	event->next = atomic_load_explicit(&loop->events, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(&loop->events, &event->next, event, memory_order_release, memory_order_relaxed));
+
+	if (!event->next)
+		wakeLoop(loop);
+}
+
+static void submitAnalysis(struct connection *conn, AnalysisJob *job) {
+	job->done = analysisDone;
+	job->data = conn;
+	job->limits.stop = &conn->cancel;
+	if (conn->eventStream) {
+		job->limits.onIteration = analysisIteration;
+		job->limits.data = job;
+	}
+
+	conn->jobs++;
+	submitThreadPool(&searchPool, &job->task);
+}
+
+// Answers with the result, or adds it to the stream of a batch
+static void finishAnalysis(AnalysisJob *job) {
+	struct connection *conn = job->data;
+	char result[ANALYSIS_RESULT_SIZE + 1];
+	size_t len;
+
+	conn->jobs--;
+	if (conn->closed) {
+		free(job);
+		if (!conn->jobs)
+			retireConnection(conn);
+		return;
+	}
+
+	statAdd(&conn->loop->analyses, 1);
+	statAdd(&conn->loop->analysisNodes, job->info.nodes);
+	statAdd(&conn->loop->analysisUs, job->info.timeUs);
+
+	len = formatAnalysis(result, ANALYSIS_RESULT_SIZE, job);
+	free(job);
+
+	if (!conn->streaming) {
+		respond(conn, 200, "application/json", result, len);
+		finishRequest(conn);
+	} else if (conn->eventStream) {
+		char event[ANALYSIS_RESULT_SIZE + 32];
+
+		queueChunk(conn, event, snprintf(event, sizeof event, "event: bestmove\ndata: %.*s\n\n", (int) len, result));
+		queueChunk(conn, NULL, 0);
+		finishRequest(conn);
+	} else {
+		result[len++] = '\n';
+		queueChunk(conn, result, len);
+		if (!conn->jobs) {
+			queueChunk(conn, NULL, 0);
+			finishRequest(conn);
+		}
+	}
+
+	advanceConnection(conn);
+}
+
+static void collectAnalyses(struct eventLoop *loop) {
+	uint64_t count;
+	AnalysisJob *job, *nextJob, *jobs = NULL;
+	struct analysisEvent *event, *nextEvent, *events = NULL;
+
+	while (read(loop->wakefd, &count, sizeof count) > 0);
+
+	// Finished jobs are taken first, so every iteration event they sent is
+	// in the events taken after them and goes out ahead of their result.
+	// Both lists are newest first.
+	for (job = atomic_exchange_explicit(&loop->finished, NULL, memory_order_acquire); job; job = nextJob) {
+		nextJob = job->next;
+		job->next = jobs;
+		jobs = job;
+	}
+	for (event = atomic_exchange_explicit(&loop->events, NULL, memory_order_acquire); event; event = nextEvent) {
+		nextEvent = event->next;
+		event->next = events;
+		events = event;
+	}
+
+	// The job an event came from hasn't been finished yet, so its
+	// connection is still there, if only as closed
+	for (event = events; event; event = nextEvent) {
+		nextEvent = event->next;
+		if (!event->conn->closed) {
+			queueChunk(event->conn, event->text, event->len);
+			advanceConnection(event->conn);
+		}
+		free(event);
+	}
+
+	for (job = jobs; job; job = nextJob) {
+		nextJob = job->next;
+		finishAnalysis(job);
+	}
+}
+
+// POST /analyze and /analyze/batch. Every position of a batch is checked
+// before any is searched, so a bad one fails the whole batch up front.
+static void analyze(struct connection *conn, char batch) {
+	struct eventLoop *loop = conn->loop;
+	char *text = strndup(conn->in + conn->req.body.start, conn->req.body.len); // the parser wants a C string
+	JSON *json = text ? parseJSONDocument(&loop->doc, text) : NULL;
+	AnalysisJob *jobs = NULL, *job;
+	SearchLimits limits;
+	char message[64];
+
+	if (!json)
+		respondError(conn, 400, "The body must be a JSON object");
+	else if (!readAnalysisLimits(json, &limits))
+		respondError(conn, 400, "depth must be 1-" STR(ANALYSIS_MAX_DEPTH) " and movetime 1-" STR(ANALYSIS_MAX_MS));
+	else if (!batch) {
+		JSONContent fen = JSONGetValueForKey("fen", json);
+
+		if ((job = newAnalysisJob(fen.type == STRING ? fen.str : NULL, &limits, 0)))
+			submitAnalysis(conn, job);
+		else
+			respondError(conn, 400, "fen is not a valid position");
+	} else {
+		JSONContent fens = JSONGetValueForKey("fens", json);
+
+		if (fens.type != ARRAY || !fens.array->length || fens.array->length > ANALYSIS_MAX_BATCH) {
+			respondError(conn, 400, "fens must be an array of 1-" STR(ANALYSIS_MAX_BATCH) " positions");
+			goto done;
+		}
+
+		for (unsigned int i = fens.array->length; i-- > 0;) {
+			ArrayContent *fen = fens.array->contents + i;
+
+			if (!(job = newAnalysisJob(fen->type == STRING ? fen->str : NULL, &limits, i))) {
+				snprintf(message, sizeof message, "fens[%u] is not a valid position", i);
+				respondError(conn, 400, message);
+				goto done;
+			}
+			job->next = jobs;
+			jobs = job;
+		}
+
+		startStream(conn, "application/x-ndjson");
+		for (job = jobs, jobs = NULL; job; job = job->next)
+			submitAnalysis(conn, job);
+	}
+
+done:
+	while ((job = jobs)) {
+		jobs = job->next;
+		free(job);
+	}
+	resetJSONDocument(&loop->doc);
+	free(text);
+}
+
+// A number from the query string; 0 if it's there but isn't one
+static char queryNumber(struct connection *conn, char const *name, char *has, double *value) {
+	char text[MAX_QUERY_VALUE], *end;
+	int found = httpQueryValue(conn->in, conn->req.target, name, text, sizeof text);
+
+	*has = found == 1;
+	if (found != 1)
+		return found == 0;
+
+	*value = strtod(text, &end);
+	return *text && !*end;
+}
+
+// GET /analyze/stream?fen=...&depth=...&movetime=...
+static void analyzeStream(struct connection *conn) {
+	char fen[MAX_QUERY_VALUE], hasDepth, hasMovetime;
+	double depth = 0, movetime = 0;
+	SearchLimits limits;
+	AnalysisJob *job;
+
+	if (httpQueryValue(conn->in, conn->req.target, "fen", fen, sizeof fen) != 1)
+		respondError(conn, 400, "fen is missing");
+	else if (!queryNumber(conn, "depth", &hasDepth, &depth) || !queryNumber(conn, "movetime", &hasMovetime, &movetime) || !setAnalysisLimits(&limits, hasDepth, depth, hasMovetime, movetime))
+		respondError(conn, 400, "depth must be 1-" STR(ANALYSIS_MAX_DEPTH) " and movetime 1-" STR(ANALYSIS_MAX_MS));
+	else if (!(job = newAnalysisJob(fen, &limits, 0)))
+		respondError(conn, 400, "fen is not a valid position");
+	else {
+		startStream(conn, "text/event-stream");
+		conn->eventStream = 1;
+		submitAnalysis(conn, job);
+	}
+}
+
+// GET /metrics
+static void metrics(struct connection *conn) {
+	unsigned long requests = 0, analyses = 0, nodes = 0, us = 0, open = 0;
+	MetricsText *text = malloc(sizeof *text);
+
+	if (!text) {
+		respondError(conn, 503, "Out of memory");
+		return;
+	}
+
+	for (unsigned int i = 0; i < workers; i++) {
+		requests += statGet(&loops[i].requests);
+		analyses += statGet(&loops[i].analyses);
+		nodes += statGet(&loops[i].analysisNodes);
+		us += statGet(&loops[i].analysisUs);
+		open += statGet(&loops[i].open);
+	}
+
+	text->len = 0;
+	writeMetric(text, "cosmo_server_requests_total", "counter", "Requests answered", requests);
+	writeMetric(text, "cosmo_server_open_connections", "gauge", "Connections open", open);
+	writeMetric(text, "cosmo_server_analyses_total", "counter", "Positions analysed", analyses);
+	writeMetric(text, "cosmo_server_analysis_nodes_total", "counter", "Nodes searched by those analyses", nodes);
+	writeMetric(text, "cosmo_server_analysis_seconds_total", "counter", "Time spent on those analyses", us / 1e6);
+	writeMetric(text, "cosmo_server_resident_memory_bytes", "gauge", "Resident set of the server", processResidentBytes(0));
+	writeBotMetrics(text, botStatsName());
+
+	respond(conn, 200, "text/plain; version=0.0.4", text->text, text->len);
+	free(text);
+}
+
+void handleRequest(struct connection *conn) {
+	static char const hello[] = "Hello World!";
+	char const *buf = conn->in;
+	HTTPSlice path = httpPath(buf, conn->req.target);
+
+	if (logEnabled(LEVEL_DEBUG))
+		myprint(conn->in, conn->req.headLen);
+	statAdd(&conn->loop->requests, 1);
+
+	if (httpSliceIs(buf, path, "/analyze") || httpSliceIs(buf, path, "/analyze/batch")) {
+		if (httpSliceIs(buf, conn->req.method, "POST"))
+			analyze(conn, httpSliceIs(buf, path, "/analyze/batch"));
+		else
+			respondError(conn, 405, "Analyses are POSTed");
+	} else if (httpSliceIs(buf, path, "/analyze/stream")) {
+		if (httpSliceIs(buf, conn->req.method, "GET"))
+			analyzeStream(conn);
+		else
+			respondError(conn, 405, "Streamed analyses are GETs");
+	} else if (httpSliceIs(buf, path, "/metrics")) {
+		if (httpSliceIs(buf, conn->req.method, "GET") || httpSliceIs(buf, conn->req.method, "HEAD"))
+			metrics(conn);
+		else
+			respondError(conn, 405, "Metrics are GETs");
+	} else if (httpSliceIs(buf, path, "/"))
+		respond(conn, 200, "text/plain", hello, sizeof hello - 1);
+	else
+		respondError(conn, 404, "No such endpoint");
+}
+
+// Answers the complete requests in the buffer, in order, as long as the
+// answers waiting to go out stay under MAX_OUT. Returns 1 if it stopped
+// because of that.
+static int processInput(struct connection *conn) {
+	while (!conn->closing) {
+		// The answer is still being worked out
+		if (conn->jobs)
+			return 0;
+		if (conn->outLen - conn->outSent >= MAX_OUT)
+			return 1;
+
+		enum httpParseState state = parseHTTPRequest(&conn->req, conn->in, conn->inLen);
+
+		if (state == HTTP_ERROR) {
+			conn->closing = 1;
+			respond(conn, conn->req.status, "text/plain", statusText(conn->req.status), strlen(statusText(conn->req.status)));
+			break;
+		}
+		if (state != HTTP_DONE)
+			break;
+
+		handleRequest(conn);
+		if (!conn->jobs)
+			finishRequest(conn);
+	}
+
+	return 0;
+}
+
+// Sends what it can; returns 0 if the connection was closed
+int flushConnection(struct connection *conn) {
+	while (conn->outSent < conn->outLen) {
+		ssize_t n = send(conn->fd, conn->out + conn->outSent, conn->outLen - conn->outSent, MSG_NOSIGNAL);
+
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 && errno == EAGAIN)
+			return 1; // EPOLLOUT will tell us when there's room
+		if (n == -1) {
+			closeConnection(conn);
+			return 0;
+		}
+
+		conn->outSent += n;
+	}
+
+	conn->outLen = conn->outSent = 0;
+
+	// A stream that ends the connection isn't over until its last chunk
+	if (conn->closing && !conn->jobs) {
+		closeConnection(conn);
+		return 0;
+	}
+
+	return 1;
+}
+
+// Answers what came in and sends it, then puts the connection on the
+// timeout list for what it's waiting for. Returns 0 if it was closed.
+static int advanceConnection(struct connection *conn) {
+	int heldBack;
+
+	// Requests held back by MAX_OUT go once the answers before them are out
+	do {
+		heldBack = processInput(conn);
+
+		if (!flushConnection(conn))
+			return 0;
+	} while (heldBack && !conn->outLen);
+
+	// Waiting on a search isn't the client's fault, so no timeout runs then
+	if (conn->jobs && !conn->outLen)
+		unlinkTimeout(conn);
+	else
+		touchConnection(conn, conn->inLen || conn->outLen ? &conn->loop->active : &conn->loop->idle);
+
+	// Edge-triggered, so bytes left in the socket won't be announced again
+	if (conn->readPaused && conn->inLen < MAX_IN) {
+		conn->readPaused = 0;
+		return readConnection(conn);
+	}
+
+	return 1;
+}
+
+// Returns 0 if the connection was closed
+int readConnection(struct connection *conn) {
+	// Edge-triggered: read until the socket is drained
+	while (conn->inLen < MAX_IN) {
+		if (!reserve(&conn->in, &conn->inCap, conn->inLen + MAXLINE > MAX_IN ? MAX_IN : conn->inLen + MAXLINE)) {
+			closeConnection(conn);
+			return 0;
+		}
+
+		ssize_t n = recv(conn->fd, conn->in + conn->inLen, conn->inCap - conn->inLen, 0);
+
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 && errno == EAGAIN)
+			break;
+		if (n <= 0) {
+			// The peer is gone or done sending; there's no one to answer
+			closeConnection(conn);
+			return 0;
+		}
+
+		conn->inLen += n;
+	}
+
+	conn->readPaused = conn->inLen >= MAX_IN;
+
+	return advanceConnection(conn);
+}
+
+void acceptConnections(struct eventLoop *loop) {
+	while (1) {
+		int fd = accept4(loop->listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+				// Stop listening until a connection closes instead of spinning
+				struct epoll_event ev = {.events = 0, .data.ptr = NULL};
+				logMessage(LEVEL_WARN, "Cannot accept with %u connections open: %s", loop->connections, strerror(errno));
+				if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, loop->listenfd, &ev) != -1)
+					loop->accepting = 0;
+			} else if (errno != EAGAIN)
+				logMessage(LEVEL_ERROR, "Accept failed: %s", strerror(errno));
+
+			return;
+		}
+
+		struct connection *conn = calloc(1, sizeof *conn);
+		if (!conn) {
+			close(fd);
+			continue;
+		}
+
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+		conn->fd = fd;
+		conn->loop = loop;
+		initHTTPRequest(&conn->req);
+
+		struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = conn};
+		if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			close(fd);
+			free(conn);
+			continue;
+		}
+
+		loop->connections++;
+		statSet(&loop->open, loop->connections);
+		touchConnection(conn, &loop->active);
+	}
+}
+
+// Closes the connections whose deadline passed. Returns the ms until the
+// next deadline, or -1 for none.
+int expireConnections(struct eventLoop *loop) {
+	uint64_t now = monotonicMs();
+	struct timeoutList *lists[2] = {&loop->active, &loop->idle};
+	int64_t wait = -1;
+
+	for (int i = 0; i < 2; i++) {
+		while (lists[i]->head && lists[i]->head->deadline <= now) {
+			struct connection *conn = lists[i]->head;
+
+			// A request that stalled partway gets told why before we hang up
+			if (lists[i] == &loop->active && conn->inLen && !conn->outLen) {
+				conn->closing = 1;
+				respond(conn, 408, "text/plain", statusText(408), strlen(statusText(408)));
+				send(conn->fd, conn->out, conn->outLen, MSG_NOSIGNAL | MSG_DONTWAIT);
+			}
+
+			closeConnection(conn);
+		}
+
+		if (lists[i]->head && (wait < 0 || (int64_t) (lists[i]->head->deadline - now) < wait))
+			wait = lists[i]->head->deadline - now;
+	}
+
+	return wait;
+}
+
+void runEventLoop(struct eventLoop *loop) {
+	struct epoll_event events[MAX_EVENTS];
+
+	for (;;) {
+		int n = epoll_wait(loop->epfd, events, MAX_EVENTS, expireConnections(loop));
+
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			realerr("epoll_wait failed");
+		}
+
+		for (int i = 0; i < n; i++) {
+			struct connection *conn = events[i].data.ptr;
+
+			if (!conn) {
+				acceptConnections(loop);
+				continue;
+			}
+			if (events[i].data.ptr == loop) {
+				collectAnalyses(loop);
+				continue;
+			}
+			// Closed by an earlier event of this batch
+			if (conn->closed)
+				continue;
+
+			if (events[i].events & EPOLLERR) {
+				closeConnection(conn);
+				continue;
+			}
+
+			// A write may be waiting on room in the socket, a read on new bytes
+			// or the peer hanging up; reading handles the latter two
+			if (events[i].events & EPOLLOUT && conn->outLen && !advanceConnection(conn))
+				continue;
+			if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+				readConnection(conn);
+		}
+
+		freeClosedConnections(loop);
+	}
+}
+
+// A listening socket of its own for every worker, so they never contend on
+// one accept queue
+int openListener(unsigned int port) {
 	struct sockaddr_in servaddr;
-	uint8_t sendline[MAXLINE + 1], recvline[MAXLINE + 1];
+	int listenfd, one = 1;
 
-	if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+	if ((listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
 		realerr("Error while creating the socket");
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+	if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one) == -1)
+		realerr("SO_REUSEPORT failed");
 
 	memset(&servaddr, 0, sizeof servaddr);
 	servaddr.sin_family = AF_INET;
 	servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-	servaddr.sin_port = htons(SERVER_PORT);
+	servaddr.sin_port = htons(port);
 
 	if (bind(listenfd, (struct sockaddr *) &servaddr, sizeof servaddr) == -1)
 		realerr("Bind error");
 
-	if (listen(listenfd, 10) == -1)
+	if (listen(listenfd, SOMAXCONN) == -1)
 		realerr("Listen error");
 
-	for (;;) {
-		struct sockaddr_in addr;
-		socklen_t addr_len;
+	return listenfd;
+}
 
-		printf("Waiting for connection on port %d\n", SERVER_PORT);
-		fflush(stdout);
+void initEventLoop(struct eventLoop *loop, unsigned int worker, int cpu, unsigned int port) {
+	memset(loop, 0, sizeof *loop);
+	loop->worker = worker;
+	loop->cpu = cpu;
+	loop->accepting = 1;
+	loop->active.timeoutMs = REQUEST_TIMEOUT_MS;
+	loop->idle.timeoutMs = IDLE_TIMEOUT_MS;
+	loop->listenfd = openListener(port);
 
-		if ((connfd = accept(listenfd, NULL, NULL)) == -1)
-			realerr("Accept failed");
+	if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		realerr("epoll_create1 failed");
 
-		memset(recvline, 0, MAXLINE + 1);
-		while ((n = read(connfd, recvline, MAXLINE)) > 0) {
-			myprint(recvline);
+	// The listening socket stays level-triggered so no pending connection is missed
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->listenfd, &ev) == -1)
+		realerr("epoll_ctl failed");
 
-			if (n > 4 && recvline[n - 1] == '\n' && recvline[n - 2] == '\r' && recvline[n - 3] == '\n' && recvline[n - 4] == '\r')
-				break;
+	if ((loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+		realerr("eventfd failed");
+	ev.data.ptr = loop;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev) == -1)
+		realerr("epoll_ctl failed");
 
-			memset(recvline, 0, MAXLINE + 1);
-		}
+	atomic_init(&loop->finished, NULL);
+	atomic_init(&loop->events, NULL);
+	initJSONDocument(&loop->doc);
+}
 
-		if (n == -1)
-			realerr("Read error");
+void *runWorker(void *loopPtr) {
+	struct eventLoop *loop = loopPtr;
 
-		sprintf(sendline, "HTTP/1.0 200 OK\r\n\r\nHello World!");
+	if (loop->cpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(loop->cpu, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus))
+			logMessage(LEVEL_WARN, "Worker %u cannot be pinned to cpu %d", loop->worker, loop->cpu);
+	}
 
-		if (write(connfd, sendline, strlen(sendline)) == -1)
-			realerr("Write error");
+	runEventLoop(loop);
 
-		if (close(connfd) == -1)
-			realerr("Close failed");
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	unsigned int SERVER_PORT = getenv("PORT") ? Atoui(getenv("PORT")) : DEFAULT_PORT;
+	int cpuList[CPU_SETSIZE];
+	unsigned int cpuCount = 0, searchers;
+	cpu_set_t cpus;
+	struct rlimit files;
+
+	initLogger(stdout, logLevelFromName(getenv("LOG_LEVEL"), LEVEL_INFO), LOG_RECORDS);
+	signal(SIGPIPE, SIG_IGN);
+
+	// Every connection is a descriptor; take as many as we're allowed
+	if (!getrlimit(RLIMIT_NOFILE, &files) && files.rlim_cur < files.rlim_max) {
+		files.rlim_cur = files.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &files);
 	}
 
+	// The cores we may run on, in order; workers take one each, wrapping around
+	if (!sched_getaffinity(0, sizeof cpus, &cpus))
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &cpus))
+				cpuList[cpuCount++] = cpu;
+
+	// WORKERS threads, one per core by default
+	workers = getenv("WORKERS") ? Atoui(getenv("WORKERS")) : cpuCount;
+	if (!workers)
+		workers = 1;
+	if (workers > MAX_WORKERS)
+		workers = MAX_WORKERS;
+
+	// SEARCH_THREADS analyses at a time, one per core by default
+	searchers = getenv("SEARCH_THREADS") ? Atoui(getenv("SEARCH_THREADS")) : cpuCount;
+	if (!initThreadPool(&searchPool, searchers, SEARCH_QUEUE))
+		errout("Cannot start the search threads");
+
+	// All listeners are bound before any worker starts, so a port in use
+	// fails here and not halfway through
+	for (unsigned int i = 0; i < workers; i++)
+		initEventLoop(loops + i, i, cpuCount ? cpuList[i % cpuCount] : -1, SERVER_PORT);
+
+	logMessage(LEVEL_INFO, "Listening on port %u with %u worker%s and %u search thread%s", SERVER_PORT, workers, workers == 1 ? "" : "s", searchPool.threads, searchPool.threads == 1 ? "" : "s");
+
+	for (unsigned int i = 1; i < workers; i++)
+		if (pthread_create(&loops[i].thread, NULL, runWorker, loops + i))
+			realerr("Cannot start worker %u", i);
+
+	runWorker(loops);
+
 	return 0;
 }
 
-void myprint(char const *str) {
-	while (*str) {
-		if (*str == '\r')
-			printf("\\r");
-		else if (*str == '\n')
-			printf("\\n");
-		else if (*str == '\v')
-			printf("\\v");
-		else if (*str == '\a')
-			printf("\\b");
-		else if (*str == '\b')
-			printf("\\b");
-		else
-			printf("%c", *str);
+// Logs the len bytes of str as one record, with line breaks and other
+// control characters escaped so a request stays on one line
+void myprint(char const *str, size_t len) {
+	char line[LOG_RECORD_SIZE];
+	size_t n = 0;
 
-		str++;
+	for (char const *end = str + len; str < end && n + 2 <= sizeof line; str++) {
+		char escape = *str == '\r' ? 'r' : *str == '\n' ? 'n' : *str == '\v' ? 'v' : *str == '\a' || *str == '\b' ? 'b' : 0;
+
+		if (escape) {
+			line[n++] = '\\';
+			line[n++] = escape;
+		} else
+			line[n++] = *str;
 	}
 
-	printf("\n");
+	logRecord(LEVEL_DEBUG, line, n);
 }
 
 unsigned int Atoui(char const *str) {
@@ -114,4 +1000,4 @@ unsigned int Atoui(char const *str) {
 	}
 
 	return retval;
-}
\ No newline at end of file
+}
@@ -1,33 +1,72 @@
 #include <stdio.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <curl/curl.h>
 #include "JSON Parser/JSON.h"
+#include "JSON Parser/stream.h"
+#include "Lichess/events.h"
 #include "Chess/basics.h"
+#include "Chess/game.h"
+#include "Chess/bench.h"
+#include "Util/loop.h"
+#include "Util/pool.h"
+#include "Util/histogram.h"
+#include "Util/log.h"
+#include "Util/stats.h"
 
 #define DEPTH 4
+#define IDLE_HANDLES 16
+#define SEARCH_QUEUE 1024
+#define LOG_RECORDS 1024
+#define GAME_ARENA_BLOCK 4096
 #define AUTHORIZATION "Authorization: Bearer KOdnd7Ny0eMQWWyx"
+#define LICHESS_URL "https://lichess.org"
+
+// All networking runs on the main thread in one curl_multi loop: the account
+// request, the event stream, every game stream and every move POST. Searches
+// run on worker threads and their results come back through the loop's wake
+// callback, so a search never holds up a transfer and vice versa. The worker
+// threads are shared between games: every search splits its root moves into
+// as many parts as there are workers per running search.
 
-static char myColor = 0; // white = 0, black = 1
-static char setMyColor = 0;
-static uint64_t *board;
-static uint64_t *prevBoard;
-static char brkrwr00 = 0xfc;
 static char *myLichessId;
+static char const *lichessUrl = LICHESS_URL; // LICHESS_URL in the environment points the bot elsewhere, e.g. Web/lichess-mock
+static JSONDocument eventDocument; // reused for every event of /api/stream/event
+static CurlLoop loop;
+static struct curl_slist *authorization; // header list shared by every request
+static BotStats *stats; // read by Web/server for /metrics
+
+// Field names looked up on every event, hashed once in main
+enum lichessKey {KEY_TYPE, KEY_ID, KEY_CHALLENGE, KEY_GAME, KEY_COUNT};
+static JSONKey lichessKeys[KEY_COUNT] = {{"type"}, {"id"}, {"challenge"}, {"game"}};
+#define KEY(k) (lichessKeys + KEY_##k)
+
+// lichessUrl followed by the formatted path, malloc'd
+char *apiUrl(char const *fmt, ...) {
+	va_list args;
+	size_t base = strlen(lichessUrl);
+
+	va_start(args, fmt);
+	int len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+
+	char *url = malloc(base + len + 1);
+	memcpy(url, lichessUrl, base);
+
+	va_start(args, fmt);
+	vsnprintf(url + base, len + 1, fmt, args);
+	va_end(args);
+
+	return url;
+}
 
 size_t emptycallback(char *t, size_t u, size_t v, void *w) {
 	return v;
 }
 
-unsigned int spaces(char const *str) {
-	unsigned int i = 0;
-
-	while (*str != 0)
-		i += *(str++) == ' ';
-
-	return i;
-}
-
 unsigned int intlen(int i) {
 	if (!i) return 1;
 	unsigned int n = 0;
@@ -41,244 +80,754 @@ unsigned int intlen(int i) {
 	return n - 1;
 };
 
-size_t playGame(char *gameState, size_t size, size_t nmemb, void *gameId) {
-	if (nmemb > 1) {
-		char *str = malloc(nmemb + 1);
-		unsigned int ndone;
-		for (ndone = 0; ndone < nmemb; ndone++)
-			str[ndone] = gameState[ndone];
-		str[ndone] = 0;
-		JSON *json = NULL;
-		parseJSON(str, &json);
-		// printJSON(json, 4, 0);
-		free(str);
-		// printf("\n");
-		// fflush(stdout);
-		str = JSONGetValueForKey("type", json).str;
-		char gameFull = !strcmp(str, "gameFull");
-		char gameState = !strcmp(str, "gameState");
-		if (!gameFull && !gameState) {
-			freeJSON(json);
-			return nmemb;
+// Where the time goes between the opponent's move reaching us and ours
+// landing on lichess. Histograms are in microseconds, recorded on the loop
+// thread and printed on SIGUSR1.
+enum latencyPhase {PHASE_PARSE, PHASE_QUEUE, PHASE_SEARCH, PHASE_HANDOFF, PHASE_POST, PHASE_TOTAL, PHASE_COUNT};
+static char const *phaseNames[PHASE_COUNT] = {"parse", "queue", "search", "handoff", "post", "total"};
+static Histogram latency[PHASE_COUNT];
+static volatile sig_atomic_t dumpLatency;
+
+// monotonicNs timestamps of one of our moves
+struct moveTiming {
+	uint64_t received; // curl handed us the chunk with the opponent's move
+	uint64_t parsed; // the event was decoded and applied
+	uint64_t searchStart;
+	uint64_t searchEnd;
+	uint64_t posted; // our move was handed to curl
+	uint64_t done; // lichess answered
+};
+
+struct phaseSummary {
+	uint64_t count, sum, max;
+};
+
+// Live bytes by subsystem. Everything a game allocates lives in its arena
+// and everything a search allocates in its parts' arenas, so these (and the
+// RSS) should come back down after every game.
+static ArenaCounter gameMemory = {"games"}, searchMemory = {"search"}, eventMemory = {"events"};
+static ArenaCounter *memoryCounters[] = {&gameMemory, &searchMemory, &eventMemory};
+
+// Everything a game needs. Only the loop thread touches it; workers get a
+// copy of the position in a searchJob.
+struct gameConnection {
+	Arena arena; // holds the connection itself, its searches and move POSTs
+	char *gameId;
+	JSONStream stream;
+	GameTracker game;
+	char myColor; // white = 1, black = 0
+	char colorKnown;
+	char streaming; // the game stream is still open
+	char searching; // a search for this game is queued or running
+	long clock[2], increment[2]; // ms, by colour (black, white); -1 until known
+	unsigned int refs; // the stream, a search and move POSTs in flight
+	uint64_t chunkReceived; // when the chunk being parsed arrived
+	uint64_t received, parsed; // timing of the event that last changed the position
+	struct phaseSummary summary[PHASE_COUNT];
+	CurlTransfer transfer;
+	struct gameConnection *next;
+};
+
+// Games being played, so a repeated gameStart doesn't open a second stream
+static struct gameConnection *games;
+
+struct searchJob;
+
+// A share of a search's root moves: every partCount-th one from first
+struct searchPart {
+	ThreadPoolTask task;
+	struct searchJob *job;
+	unsigned int first;
+	int weight;
+	long best; // index of the best root move of the part, -1 for none yet
+	Arena nodes; // search trees, one root move at a time
+};
+
+// A position handed to the search workers and, once searched, its result.
+// The worker that finishes the last part picks the move and hands the job
+// back to the loop thread.
+struct searchJob {
+	ThreadPoolTask split; // generates the root moves and queues the parts
+	Arena arena; // the parts and the result; only one worker at a time uses it
+	struct gameConnection *conn;
+	uint64_t board[4];
+	uint64_t prevBoard[4];
+	char brkrwr00;
+	char color;
+	int depth;
+	long budget; // ms the clock allows, -1 if unknown
+	atomic_ulong nodes;
+	unsigned int plies, resyncs; // tell whether the game moved on meanwhile
+	char *rootMoves;
+	unsigned long rootLen;
+	struct searchPart *parts;
+	unsigned int partCount;
+	atomic_uint pending; // parts not finished yet
+	char *move; // NULL when there is no move
+	struct moveTiming timing;
+};
+
+static ThreadPool searchPool;
+static unsigned int searchThreads;
+static atomic_uint activeSearches;
+static MPMCQueue doneQueue; // searched jobs waiting for the loop thread
+
+void completeSearch(struct searchJob *job) {
+	while (!pushMPMCQueue(&doneQueue, job))
+		sched_yield();
+	wakeCurlLoop(&loop);
+}
+
+void runSearchPart(ThreadPoolTask *task) {
+	struct searchPart *part = (struct searchPart *) task;
+	struct searchJob *job = part->job;
+
+	for (unsigned long i = part->first; i < job->rootLen / 3; i += job->partCount) {
+		int weight = evaluateRootMove(job->board, job->brkrwr00, job->color, job->rootMoves + i * 3, job->depth, &part->nodes);
+		arenaReset(&part->nodes);
+		if (part->best < 0 || (job->color ? weight > part->weight : weight < part->weight)) {
+			part->weight = weight;
+			part->best = i;
 		}
-		char *movesTmp = gameFull ? JSONGetValueForKey("moves", JSONGetValueForKey("state", json).json).str : JSONGetValueForKey("moves", json).str;
-		if (!movesTmp)
-			movesTmp = " ";
-		// printf("Moves: %s\n", movesTmp);
-		char *moves = strcpy(malloc(strlen(movesTmp) + 1), movesTmp);
-		// fflush(stdout);
-
-		if (!setMyColor && gameFull) {
-			setMyColor = 1;
-			myColor = !strcmp(JSONGetValueForKey("id", JSONGetValueForKey("white", json).json).str, myLichessId);
+	}
+	arenaFree(&part->nodes);
+
+	unsigned long nodes = takeSearchNodes();
+	atomic_fetch_add_explicit(&job->nodes, nodes, memory_order_relaxed);
+	statAdd(&stats->searchNodes, nodes);
+
+	if (atomic_fetch_sub(&job->pending, 1) != 1)
+		return;
+
+	// Like theBestMove, the first of equally good moves wins
+	struct searchPart *best = job->parts;
+	for (unsigned int i = 1; i < job->partCount; i++) {
+		struct searchPart *p = job->parts + i;
+		if (job->color ? p->weight > best->weight : p->weight < best->weight)
+			best = p;
+		else if (p->weight == best->weight && p->best < best->best)
+			best = p;
+	}
+	job->move = memcpy(arenaAlloc(&job->arena, 3), job->rootMoves + best->best * 3, 3);
+	job->timing.searchEnd = monotonicNs();
+
+	completeSearch(job);
+}
+
+void splitSearch(ThreadPoolTask *task) {
+	struct searchJob *job = (struct searchJob *) task;
+
+	job->timing.searchStart = monotonicNs();
+	job->rootLen = validMoves(job->board, job->prevBoard, job->brkrwr00, job->color, &job->rootMoves);
+	if (!job->rootLen) {
+		job->timing.searchEnd = monotonicNs();
+		completeSearch(job);
+		return;
+	}
+
+	// Workers are shared out evenly between the searches running now
+	unsigned int searches = atomic_load(&activeSearches);
+	unsigned int parts = searchThreads / (searches ? searches : 1);
+	if (parts < 1)
+		parts = 1;
+	if (parts > job->rootLen / 3)
+		parts = job->rootLen / 3;
+
+	job->parts = arenaAlloc(&job->arena, parts * sizeof *job->parts);
+	job->partCount = parts;
+	atomic_init(&job->pending, parts);
+
+	for (unsigned int i = 0; i < parts; i++) {
+		job->parts[i].task.run = runSearchPart;
+		job->parts[i].job = job;
+		job->parts[i].first = i;
+		job->parts[i].weight = 0;
+		job->parts[i].best = -1;
+		arenaInit(&job->parts[i].nodes, SEARCH_ARENA_BLOCK);
+		arenaCount(&job->parts[i].nodes, &searchMemory);
+	}
+
+	for (unsigned int i = 1; i < parts; i++)
+		submitThreadPool(&searchPool, &job->parts[i].task);
+	runSearchPart(&job->parts[0].task);
+}
+
+// Time to spend on a move in ms, -1 while the clock isn't known
+long searchBudget(long timeLeft, long increment) {
+	if (timeLeft < 0)
+		return -1;
+
+	return timeLeft / 40 + (increment > 0 ? increment : 0);
+}
+
+// Plies to search within budget. Depth 4 takes about a second and a half on
+// one core in the middlegame, depth 3 tens of milliseconds.
+int searchDepth(long budget) {
+	if (budget < 0)
+		return DEPTH;
+
+	return budget >= 1000 ? DEPTH : budget >= 50 ? DEPTH - 1 : DEPTH - 2;
+}
+
+// Finished handles are kept for later requests. Connections, DNS and TLS
+// sessions are cached by the multi handle and shared by every transfer on
+// it, and all requests ask for HTTP/2 and wait to multiplex over an open
+// connection, so a move POST goes out on the connection the game stream
+// already uses instead of paying for a new TCP and TLS handshake.
+static CURL *idleHandles[IDLE_HANDLES];
+static unsigned int idleCount;
+
+CURL *newRequest(char const *url, curl_write_callback write, void *data) {
+	CURL *curl = idleCount ? idleHandles[--idleCount] : curl_easy_init();
+	if (!curl)
+		return NULL;
+
+	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+	curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, authorization);
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write ? write : emptycallback);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, data);
+
+	#ifdef SKIP_PEER_VERIFICATION
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+	#endif
+
+	#ifdef SKIP_HOSTNAME_VERIFICATION
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+	#endif
+
+	return curl;
+}
+
+void releaseRequest(CURL *curl) {
+	if (idleCount < IDLE_HANDLES) {
+		curl_easy_reset(curl);
+		idleHandles[idleCount++] = curl;
+	} else
+		curl_easy_cleanup(curl);
+}
+
+void recordMoveTiming(struct gameConnection *conn, struct moveTiming const *t) {
+	uint64_t phases[PHASE_COUNT] = {
+		t->parsed - t->received,
+		t->searchStart - t->parsed,
+		t->searchEnd - t->searchStart,
+		t->posted - t->searchEnd,
+		t->done - t->posted,
+		t->done - t->received
+	};
+
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		uint64_t us = phases[i] / 1000;
+		recordHistogram(latency + i, us);
+		conn->summary[i].count++;
+		conn->summary[i].sum += us;
+		if (us > conn->summary[i].max)
+			conn->summary[i].max = us;
+	}
+}
+
+// "name live/peak ..." for every counter, then the RSS
+int formatMemory(char *out, size_t size) {
+	int len = 0;
+
+	for (size_t i = 0; i < sizeof memoryCounters / sizeof *memoryCounters && len < (int) size; i++)
+		len += snprintf(out + len, size - len, "%s %zu/%zu ", memoryCounters[i]->name, atomic_load(&memoryCounters[i]->live), atomic_load(&memoryCounters[i]->peak));
+	if (len < (int) size)
+		len += snprintf(out + len, size - len, "rss %ld", processResidentBytes(0));
+
+	return len < (int) size ? len : (int) size - 1;
+}
+
+void printLatency(void) {
+	char memory[256];
+
+	fprintf(stderr, "Move latency (us):\n");
+	for (int i = 0; i < PHASE_COUNT; i++)
+		printHistogram(stderr, phaseNames[i], latency + i);
+
+	formatMemory(memory, sizeof memory);
+	fprintf(stderr, "Memory (live/peak bytes): %s\n", memory);
+}
+
+void requestLatencyDump(int sig) {
+	dumpLatency = 1;
+	wakeCurlLoop(&loop);
+}
+
+void releaseGameConnection(struct gameConnection *conn) {
+	if (--conn->refs)
+		return;
+
+	if (conn->summary[PHASE_TOTAL].count && logEnabled(LEVEL_INFO)) {
+		char line[LOG_RECORD_SIZE];
+		int len = snprintf(line, sizeof line, "Game %s: %llu moves, mean/max us", conn->gameId, (unsigned long long) conn->summary[PHASE_TOTAL].count);
+		for (int i = 0; i < PHASE_COUNT && len < (int) sizeof line; i++)
+			len += snprintf(line + len, sizeof line - len, " %s %llu/%llu", phaseNames[i], (unsigned long long) (conn->summary[i].sum / conn->summary[i].count), (unsigned long long) conn->summary[i].max);
+		logRecord(LEVEL_INFO, line, len < (int) sizeof line ? len : sizeof line - 1);
+	}
+
+	freeJSONStream(&conn->stream);
+	freeGameTracker(&conn->game);
+
+	// The connection is in its own arena
+	Arena arena = conn->arena;
+	arenaFree(&arena);
+
+	if (logEnabled(LEVEL_DEBUG)) {
+		char memory[256];
+		formatMemory(memory, sizeof memory);
+		logMessage(LEVEL_DEBUG, "Memory (live/peak bytes): %s", memory);
+	}
+}
+
+// A POST whose answer we only log; move POSTs also close their timing
+struct postRequest {
+	CurlTransfer transfer;
+	char *url;
+	struct gameConnection *conn; // NULL unless it's a move
+	struct moveTiming timing;
+};
+
+void postDone(CurlTransfer *transfer, CURLcode res) {
+	struct postRequest *post = transfer->data;
+	long status = 0;
+
+	curl_easy_getinfo(transfer->easy, CURLINFO_RESPONSE_CODE, &status);
+	if (res != CURLE_OK || status >= 400) {
+		statAdd(res != CURLE_OK ? &stats->curlErrors : &stats->httpErrors, 1);
+		logMessage(LEVEL_ERROR, "POST %s failed: %s (HTTP %ld)", post->url, res != CURLE_OK ? curl_easy_strerror(res) : "rejected", status);
+	}
+
+	releaseRequest(transfer->easy);
+	free(post->url);
+
+	// A move POST lives in its game's arena
+	if (post->conn) {
+		post->timing.done = monotonicNs();
+		recordMoveTiming(post->conn, &post->timing);
+		releaseGameConnection(post->conn);
+	} else
+		free(post);
+}
+
+// Takes url. For a move, conn and timing are given.
+void postRequest(char *url, struct gameConnection *conn, struct moveTiming const *timing) {
+	struct postRequest *post = conn ? arenaAlloc(&conn->arena, sizeof *post) : malloc(sizeof *post);
+
+	if (!post || !(post->transfer.easy = newRequest(url, NULL, NULL))) {
+		free(url);
+		if (!conn)
+			free(post);
+		return;
+	}
+
+	curl_easy_setopt(post->transfer.easy, CURLOPT_POSTFIELDS, "");
+	post->transfer.done = postDone;
+	post->transfer.data = post;
+	post->url = url;
+	post->conn = conn;
+	if (conn) {
+		conn->refs++;
+		post->timing = *timing;
+		post->timing.posted = monotonicNs();
+	}
+
+	addCurlTransfer(&loop, &post->transfer);
+}
+
+// Queues a search if it's our move and none is running. A search that is
+// running already will notice the position changed when it comes back.
+void searchIfOurMove(struct gameConnection *conn) {
+	if (conn->searching || !conn->streaming || !conn->colorKnown || conn->game.whiteToMove != conn->myColor)
+		return;
+
+	struct searchJob *job = arenaAlloc(&conn->arena, sizeof *job);
+	if (!job)
+		return;
+
+	memset(job, 0, sizeof *job);
+	arenaInit(&job->arena, 1024);
+	arenaCount(&job->arena, &searchMemory);
+	job->split.run = splitSearch;
+	job->conn = conn;
+	memcpy(job->board, conn->game.board, sizeof job->board);
+	memcpy(job->prevBoard, conn->game.prevBoard, sizeof job->prevBoard);
+	job->brkrwr00 = conn->game.brkrwr00;
+	job->color = conn->myColor;
+	job->budget = searchBudget(conn->clock[(int) conn->myColor], conn->increment[(int) conn->myColor]);
+	job->depth = searchDepth(job->budget);
+	job->plies = conn->game.plies;
+	job->resyncs = conn->game.resyncs;
+	job->timing.received = conn->received;
+	job->timing.parsed = conn->parsed;
+
+	conn->searching = 1;
+	conn->refs++;
+	atomic_fetch_add(&activeSearches, 1);
+
+	submitThreadPool(&searchPool, &job->split);
+}
+
+void finishSearch(struct searchJob *job) {
+	struct gameConnection *conn = job->conn;
+
+	conn->searching = 0;
+	atomic_fetch_sub(&activeSearches, 1);
+
+	uint64_t searchUs = (job->timing.searchEnd - job->timing.searchStart) / 1000;
+	unsigned long nodes = atomic_load_explicit(&job->nodes, memory_order_relaxed);
+	statAdd(&stats->searches, 1);
+	statAdd(&stats->searchUs, searchUs);
+	if (job->budget >= 0) {
+		statAdd(&stats->searchBudgetUs, job->budget * 1000);
+		if (searchUs > (uint64_t) job->budget * 1000)
+			statAdd(&stats->searchesOverBudget, 1);
+	}
+	if (searchUs)
+		statSet(&stats->lastSearchNps, nodes * 1000000 / searchUs);
+
+	if (conn->streaming && job->plies == conn->game.plies && job->resyncs == conn->game.resyncs) {
+		if (job->move) {
+			char *bestmove = indicesToUci(job->move);
+			char *q = apiUrl("/api/bot/game/%s/move/%s", conn->gameId, bestmove);
+			if (logEnabled(LEVEL_DEBUG)) {
+				char board[73];
+				formatBoard(board, conn->game.board);
+				logMessage(LEVEL_DEBUG, "Game %s:\n%.71s", conn->gameId, board);
+			}
+			logMessage(LEVEL_INFO, "Bestmove (%s, depth %d): %s", conn->gameId, job->depth, bestmove);
+			free(bestmove);
+
+			postRequest(q, conn, &job->timing);
+			statAdd(&stats->movesPlayed, 1);
 		}
+	} else
+		searchIfOurMove(conn); // the game moved on while we were thinking
+
+	// The job itself stays in the game's arena until the game ends
+	free(job->rootMoves);
+	arenaFree(&job->arena);
+	releaseGameConnection(conn);
+}
+
+// Wake-ups come from search workers and from SIGUSR1
+void loopWoken(CurlLoop *l) {
+	struct searchJob *job;
+
+	while ((job = popMPMCQueue(&doneQueue)))
+		finishSearch(job);
+
+	if (dumpLatency) {
+		dumpLatency = 0;
+		printLatency();
+	}
+}
 
-		if (*moves != ' ') {
-			size_t strlenn = strlen(moves);
-			char beforaf = strlenn < 5 || moves[strlenn - 5] == ' ';
-			char *indicess = uciToIndices(board, (char [6]) {moves[strlenn - (5 - beforaf)], moves[strlenn - 4 + beforaf], moves[strlenn - 3 + beforaf], moves[strlenn - 2 + beforaf], moves[strlenn - (!beforaf)], 0});
-			memcpy(prevBoard, board, 32);
-			makeForcedMove(board, &brkrwr00, indicess);
-			free(indicess);
+void playGameEvent(char const *event, size_t len, struct gameConnection *conn) {
+	GameEvent ev;
+	if (!decodeGameEvent(event, len, &ev) || ev.type == GAME_EVENT_OTHER)
+		return;
+	char gameFull = ev.type == GAME_EVENT_FULL;
+	unsigned int resyncs = conn->game.resyncs;
+
+	long clocks[4] = {ev.btime, ev.wtime, ev.binc, ev.winc};
+	for (int i = 0; i < 2; i++) {
+		if (clocks[i] >= 0)
+			conn->clock[i] = clocks[i];
+		if (clocks[i + 2] >= 0)
+			conn->increment[i] = clocks[i + 2];
+	}
+
+	if (gameFull) {
+		resetGameTracker(&conn->game, ev.initialFen.str, ev.initialFen.len);
+
+		if (!conn->colorKnown) {
+			conn->colorKnown = 1;
+			conn->myColor = ev.whiteId.len == strlen(myLichessId) && !memcmp(ev.whiteId.str, myLichessId, ev.whiteId.len);
 		}
+	}
 
-		freeJSON(json);
+	int played = updateGameTracker(&conn->game, ev.moves.str, ev.moves.len);
+	if (played < 0) {
+		logMessage(LEVEL_ERROR, "Cannot apply moves of game %s", conn->gameId);
+		return;
+	}
 
-		if (spaces(moves) % 2 == !!myColor) {
-			char *q;
-			char *indicess = theBestMove(board, prevBoard, brkrwr00, myColor, DEPTH);
+	// Clock updates, draw offers and the like leave the position as it was
+	if (!gameFull && !played && resyncs == conn->game.resyncs)
+		return;
 
-			if (!indicess)
-				return nmemb;
-			
-			q = malloc(45 + strlen((char *) gameId));
+	conn->received = conn->chunkReceived;
+	conn->parsed = monotonicNs();
+	searchIfOurMove(conn);
+}
 
-			char *bestmove = indicesToUci(indicess);
-			sprintf(q, "https://lichess.org/api/bot/game/%s/move/%s", (char *) gameId, bestmove);
-			printBoard(board);
-			printf("Bestmove: %s\n", bestmove);
-			fflush(stdout);
-			free(bestmove);
-			free(indicess);
+size_t playGame(char *chunk, size_t size, size_t nmemb, void *connection) {
+	struct gameConnection *conn = connection;
+	char *event;
+	size_t len;
 
-			CURL *curl = curl_easy_init();
-			CURLcode res;
+	conn->chunkReceived = monotonicNs();
+	statAdd(&stats->jsonBytes, size * nmemb);
+	if (!feedJSONStream(&conn->stream, chunk, size * nmemb))
+		return 0;
 
-			struct curl_slist *chunk = NULL;
-			chunk = curl_slist_append(chunk, AUTHORIZATION);
-			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
+	while ((event = nextJSONEvent(&conn->stream, &len))) {
+		statAdd(&stats->jsonEvents, 1);
+		playGameEvent(event, len, conn);
+	}
 
-			#ifdef SKIP_PEER_VERIFICATION
-				curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-			#endif
+	return size * nmemb;
+}
 
-			#ifdef SKIP_HOSTNAME_VERIFICATION
-				curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-			#endif
+void gameStreamDone(CurlTransfer *transfer, CURLcode res) {
+	struct gameConnection *conn = transfer->data;
 
-			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, emptycallback);
-			curl_easy_setopt(curl, CURLOPT_URL, q);
-			curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
-			free(q);
+	if (res != CURLE_OK) {
+		statAdd(&stats->curlErrors, 1);
+		logMessage(LEVEL_ERROR, "Game stream %s failed: %s", conn->gameId, curl_easy_strerror(res));
+	}
 
-			res = curl_easy_perform(curl);
-			if(res != CURLE_OK)
-				fprintf(stderr, "curl_easy_perform() failed (in playgame): %s\n", curl_easy_strerror(res));
+	releaseRequest(transfer->easy);
 
-			curl_easy_cleanup(curl);
-			curl_slist_free_all(chunk);
+	for (struct gameConnection **p = &games; *p; p = &(*p)->next)
+		if (*p == conn) {
+			*p = conn->next;
+			break;
 		}
 
-		free(moves);
+	conn->streaming = 0;
+	statSub(&stats->activeGames, 1);
+	releaseGameConnection(conn);
+}
+
+void startGame(char const *gameId) {
+	struct gameConnection *conn;
+
+	for (conn = games; conn; conn = conn->next)
+		if (!strcmp(conn->gameId, gameId))
+			return;
+
+	Arena arena;
+	arenaInit(&arena, GAME_ARENA_BLOCK);
+	arenaCount(&arena, &gameMemory);
+	if (!(conn = arenaAlloc(&arena, sizeof *conn))) {
+		arenaFree(&arena);
+		return;
+	}
+
+	memset(conn, 0, sizeof *conn);
+	conn->arena = arena;
+	conn->gameId = arenaStrndup(&conn->arena, gameId, strlen(gameId));
+	initJSONStream(&conn->stream, 0);
+	initGameTracker(&conn->game);
+	conn->clock[0] = conn->clock[1] = conn->increment[0] = conn->increment[1] = -1;
+
+	char *s = apiUrl("/api/bot/game/stream/%s", gameId);
+	conn->transfer.easy = newRequest(s, playGame, conn);
+	free(s);
+
+	if (!conn->transfer.easy) {
+		conn->refs = 1;
+		releaseGameConnection(conn);
+		return;
 	}
 
-	return nmemb;
+	conn->transfer.done = gameStreamDone;
+	conn->transfer.data = conn;
+	conn->streaming = 1;
+	conn->refs = 1;
+	conn->next = games;
+	games = conn;
+	statAdd(&stats->activeGames, 1);
+	statAdd(&stats->gamesStarted, 1);
+
+	addCurlTransfer(&loop, &conn->transfer);
 }
 
-size_t callback(char *actualStr, size_t size, size_t nmemb, void *usrdata) {
-	if (nmemb > 1) {
-		char *str = malloc(nmemb + 1);
-		unsigned int ndone;
-		for (ndone = 0; ndone < nmemb; ndone++)
-			str[ndone] = actualStr[ndone];
-		str[ndone] = 0;
-		JSON *json = NULL;
-		parseJSON(str, &json);
-		// printJSON(json, 4, 0);
-		// printf("\n");
-		// fflush(stdout);
-		free(str);
-		int ind = JSONIndexOf("type", json);
-		if (ind == -1) {
-			freeJSON(json);
-			return nmemb;
-		} else {
-			CURL *curl = curl_easy_init();
-			CURLcode res;
-			if (curl) {
-				struct curl_slist *chunk = NULL;
-				chunk = curl_slist_append(chunk, AUTHORIZATION);
-				curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
-
-				#ifdef SKIP_PEER_VERIFICATION
-					curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-				#endif
-
-				#ifdef SKIP_HOSTNAME_VERIFICATION
-					curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-				#endif
-
-				char *type = json->contents[ind].str;
-				char challenge = !strcmp(type, "challenge");
-				char gameStart = !strcmp(type, "gameStart");
-
-				if (challenge) {
-					curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, emptycallback);
-					curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
-
-					setMyColor = 0;
-					free(board);
-					char *gameId = JSONGetValueForKey("id", JSONGetValueForKey("challenge", json).json).str;
-					char *s = malloc(42 + strlen(gameId));
-					sprintf(s, "https://lichess.org/api/challenge/%s/accept", gameId);
-					curl_easy_setopt(curl, CURLOPT_URL, s);
-					free(s);
-					res = curl_easy_perform(curl);
-					if(res != CURLE_OK)
-						fprintf(stderr, "curl_easy_perform() failed (in callback[0]): %s\n", curl_easy_strerror(res));
-				} else if (gameStart) {
-					char *gameId = JSONGetValueForKey("id", JSONGetValueForKey("game", json).json).str;
-
-					curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, playGame);
-					curl_easy_setopt(curl, CURLOPT_WRITEDATA, strcpy(malloc(strlen(gameId) + 1), gameId));
-
-					board = newChessBoard();
-
-					char *s = malloc(41 + strlen(gameId));
-					sprintf(s, "https://lichess.org/api/bot/game/stream/%s", gameId);
-					
-					curl_easy_setopt(curl, CURLOPT_URL, s);
-					free(s);
-
-					res = curl_easy_perform(curl);
-					if(res != CURLE_OK)
-						fprintf(stderr, "curl_easy_perform() failed (in callback[1]): %s\n", curl_easy_strerror(res));
-				}
-
-				curl_easy_cleanup(curl);
-				curl_slist_free_all(chunk);
-			}
+// The "id" of the object under key, or NULL if either isn't what it should be
+char *eventObjectId(JSONKey const *key, JSON const *json) {
+	JSONContent object = JSONGetValueForJSONKey(key, json);
+	JSONContent id = object.type == OBJECT ? JSONGetValueForJSONKey(KEY(ID), object.json) : (JSONContent) {.type = NONE};
+
+	return id.type == STRING ? id.str : NULL;
+}
+
+void handleEvent(char *event) {
+	JSON *json = parseJSONDocument(&eventDocument, event);
+	// printJSON(json, 4, 0);
+	// printf("\n");
+	// fflush(stdout);
+	int ind = JSONIndexOfKey(KEY(TYPE), json);
+	if (ind == -1 || json->contents[ind].type != STRING) {
+		resetJSONDocument(&eventDocument);
+		return;
+	} else {
+		char *type = json->contents[ind].str;
+		char challenge = !strcmp(type, "challenge");
+		char gameStart = !strcmp(type, "gameStart");
+
+		if (challenge) {
+			char *gameId = eventObjectId(KEY(CHALLENGE), json);
+			if (gameId)
+				postRequest(apiUrl("/api/challenge/%s/accept", gameId), NULL, NULL);
+		} else if (gameStart) {
+			char *gameId = eventObjectId(KEY(GAME), json);
+			if (gameId)
+				startGame(gameId);
 		}
-		freeJSON(json);
 	}
+	resetJSONDocument(&eventDocument);
+}
+
+size_t callback(char *chunk, size_t size, size_t nmemb, void *stream) {
+	char *event;
+
+	statAdd(&stats->jsonBytes, size * nmemb);
+	if (!feedJSONStream(stream, chunk, size * nmemb))
+		return 0;
 
-	return nmemb;
+	while ((event = nextJSONEvent(stream, NULL))) {
+		statAdd(&stats->jsonEvents, 1);
+		handleEvent(event);
+	}
+
+	return size * nmemb;
 }
 
-size_t setMyLichessId(char *actualStr, size_t size, size_t nmemb, void *usrdata) {
+size_t bufferResponse(char *chunk, size_t size, size_t nmemb, void *stream) {
+	return feedJSONStream(stream, chunk, size * nmemb) ? size * nmemb : 0;
+}
+
+void setMyLichessId(char *response) {
 	JSON *json = NULL;
-	char *str = malloc(nmemb + 1);
-	unsigned int ndone;
-	for (ndone = 0; ndone < nmemb; ndone++)
-		str[ndone] = actualStr[ndone];
-	str[ndone] = 0;
-	parseJSON(str, &json);
-	char *tmpPointer = JSONGetValueForKey("id", json).str;
+	parseJSON(response, &json);
+	char *tmpPointer = JSONGetValueForJSONKey(KEY(ID), json).str;
+	if (!tmpPointer)
+		tmpPointer = "";
 	myLichessId = malloc(strlen(tmpPointer) + 1);
 	strcpy(myLichessId, tmpPointer);
 	freeJSON(json);
-	return nmemb;
 }
 
-int main(void) {
+void eventStreamDone(CurlTransfer *transfer, CURLcode res) {
+	if (res != CURLE_OK) {
+		statAdd(&stats->curlErrors, 1);
+		logMessage(LEVEL_ERROR, "curl_easy_perform() failed (in main 2nd part): %s", curl_easy_strerror(res));
+	}
+
+	releaseRequest(transfer->easy);
+	transfer->data = (void *) (intptr_t) (res == CURLE_OK);
+	loop.stop = 1;
+}
+
+void accountDone(CurlTransfer *transfer, CURLcode res) {
+	JSONStream *stream = transfer->data;
+
+	if (res != CURLE_OK) {
+		fprintf(stderr, "curl_easy_perform() failed (in main): %s\n", curl_easy_strerror(res));
+		exit(-1);
+	}
+
+	char *account = finishJSONStream(stream, NULL);
+	setMyLichessId(account ? account : "{}");
+
+	// Same handle and stream, reused for the event stream
+	char *url = apiUrl("/api/stream/event");
+	curl_easy_setopt(transfer->easy, CURLOPT_URL, url);
+	free(url);
+	curl_easy_setopt(transfer->easy, CURLOPT_WRITEFUNCTION, callback);
+	transfer->done = eventStreamDone;
+	addCurlTransfer(&loop, transfer);
+}
+
+int main(int argc, char **argv) {
+	// Bot bench [minimax depth] [alpha-beta depth]: the fixed search workload
+	// of Chess/bench.h, with no lichess involved
+	if (argc > 1 && !strcmp(argv[1], "bench"))
+		return benchMain(argc - 2, argv + 2);
+
 	srand(time(0));
 
-	board = newChessBoard();
-	prevBoard = malloc(4 * sizeof(uint64_t));
+	if (getenv("LICHESS_URL"))
+		lichessUrl = getenv("LICHESS_URL");
 
-	CURL *curl = curl_easy_init();
-	CURLcode res;
+	// LOG_LEVEL is debug (boards too), info (moves and game summaries), warn or error
+	initLogger(stdout, logLevelFromName(getenv("LOG_LEVEL"), LEVEL_INFO), LOG_RECORDS);
 
-	if (!curl) {
-		fprintf(stderr, "curl_easy_init failed\n");
+	curl_global_init(CURL_GLOBAL_ALL);
+
+	stats = createBotStats(botStatsName());
+	statSet(&stats->startedMs, time(NULL) * 1000UL);
+
+	for (unsigned int i = 0; i < KEY_COUNT; i++)
+		JSONInitKey(lichessKeys + i);
+
+	initJSONDocument(&eventDocument);
+	arenaCount(&eventDocument.arena, &eventMemory);
+
+	if (!initCurlLoop(&loop)) {
+		fprintf(stderr, "Cannot set up the event loop\n");
 		return -1;
 	}
+	loop.wake = loopWoken;
+	curl_multi_setopt(loop.multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
 
-	struct curl_slist *chunk = NULL;
+	// SEARCH_THREADS overrides one search worker per core
+	char const *threads = getenv("SEARCH_THREADS");
+	long cores = threads ? atol(threads) : sysconf(_SC_NPROCESSORS_ONLN);
+	searchThreads = cores > 0 ? cores : 1;
 
-	chunk = curl_slist_append(chunk, AUTHORIZATION);
+	if (!initMPMCQueue(&doneQueue, SEARCH_QUEUE) || !initThreadPool(&searchPool, searchThreads, SEARCH_QUEUE)) {
+		fprintf(stderr, "Cannot start search workers\n");
+		return -1;
+	}
 
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
-	curl_easy_setopt(curl, CURLOPT_URL, "https://lichess.org/api/account");
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, setMyLichessId);
+	for (int i = 0; i < PHASE_COUNT; i++)
+		initHistogram(latency + i);
 
-	#ifdef SKIP_PEER_VERIFICATION
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-	#endif
+	struct sigaction sa;
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = requestLatencyDump;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &sa, NULL);
 
-	#ifdef SKIP_HOSTNAME_VERIFICATION
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-	#endif
+	authorization = curl_slist_append(NULL, AUTHORIZATION);
 
-	res = curl_easy_perform(curl);
+	JSONStream stream;
+	initJSONStream(&stream, 0);
 
-	if(res != CURLE_OK) {
-		fprintf(stderr, "curl_easy_perform() failed (in main): %s\n", curl_easy_strerror(res));
-		exit(-1);
+	CurlTransfer account;
+	char *url = apiUrl("/api/account");
+	account.easy = newRequest(url, bufferResponse, &stream);
+	free(url);
+	account.done = accountDone;
+	account.data = &stream;
+
+	if (!account.easy) {
+		fprintf(stderr, "curl_easy_init failed\n");
+		return -1;
 	}
 
-	curl_easy_setopt(curl, CURLOPT_URL, "https://lichess.org/api/stream/event");
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, callback);
+	addCurlTransfer(&loop, &account);
+	runCurlLoop(&loop);
 
-	res = curl_easy_perform(curl);
+	// Searches still running finish before the loop they report to goes
+	freeThreadPool(&searchPool);
 
-	if(res != CURLE_OK) {
-		fprintf(stderr, "curl_easy_perform() failed (in main 2nd part): %s\n", curl_easy_strerror(res));
-		exit(-1);
-	}
+	while (idleCount)
+		curl_easy_cleanup(idleHandles[--idleCount]);
+	freeCurlLoop(&loop);
+	curl_slist_free_all(authorization);
 
-	curl_easy_cleanup(curl);
-	curl_slist_free_all(chunk);
+	freeJSONStream(&stream);
+	freeJSONDocument(&eventDocument);
+	removeBotStats(stats, botStatsName());
+	freeLogger();
 
-	return 0;
-}
\ No newline at end of file
+	// Like before, the bot stops with the event stream
+	return account.data ? 0 : -1;
+}
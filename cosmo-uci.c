@@ -0,0 +1,404 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "Chess/basics.h"
+#include "Chess/game.h"
+#include "Chess/search.h"
+
+// The engine behind the Universal Chess Interface, for GUIs, match runners
+// and testing tools, with no lichess in between. Commands come in on stdin.
+// The main thread reads them and stays free to answer while searchPosition
+// runs on a thread of its own. The main thread also keeps the hard deadline
+// of a timed search and stops it there; searchPosition itself only winds
+// down at the soft one.
+//
+// Supported: uci, isready, ucinewgame, setoption, position startpos|fen ...
+// [moves ...], go [depth N] [movetime ms] [wtime ms] [btime ms] [winc ms]
+// [binc ms] [movestogo N] [infinite] [ponder], stop, ponderhit and quit.
+// Hash and Threads are accepted, as tools set them, but searchPosition keeps
+// no table and runs on one thread, so they change nothing yet.
+
+#define UCI_NAME "Cosmo"
+#define UCI_AUTHOR "the Cosmo authors"
+#define LOG_RECORDS 64
+#define MAX_LINE (1 << 16) // a position command lists every move of the game
+#define MOVE_OVERHEAD_MS 30 // lost between the GUI's clock and ours
+#define DEFAULT_HASH_MB 16
+#define MAX_HASH_MB 4096
+#define MAX_THREADS 256
+
+typedef struct UciSearch {
+	pthread_t thread;
+	char running; // started and not joined yet
+	atomic_int stop;
+	SearchLimits limits;
+	SearchInfo info;
+	uint64_t board[4];
+	uint64_t prevBoard[4];
+	char brkrwr00;
+	char whiteToMove;
+	uint64_t startNs;
+
+	// Under lock
+	char hold; // infinite or pondering: bestmove waits for stop or ponderhit
+	uint64_t deadlineNs; // 0 for none
+	unsigned int budgetMs; // deadline to set on ponderhit
+} UciSearch;
+
+static pthread_mutex_t outputLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t searchLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t searchReleased = PTHREAD_COND_INITIALIZER;
+static GameTracker game;
+static char *gameFen; // the position command's, NULL for startpos
+static UciSearch search;
+static unsigned int hashMb = DEFAULT_HASH_MB, threads = 1; // as set, see above
+
+// One line to the GUI; the search thread writes too
+static void uciPrintf(char const *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void uciPrintf(char const *fmt, ...) {
+	va_list args;
+
+	pthread_mutex_lock(&outputLock);
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	putchar('\n');
+	fflush(stdout);
+	pthread_mutex_unlock(&outputLock);
+}
+
+static void uciMove(char *out, char const *move) {
+	char *uci = indicesToUci(move);
+	strcpy(out, uci);
+	free(uci);
+}
+
+static void printSearchInfo(SearchInfo const *info, void *data) {
+	char line[SEARCH_MAX_PLY * 6 + 256], move[6];
+	int mate = searchScoreMate(info->score);
+	size_t len;
+
+	(void) data;
+
+	// Mated shows as mate 0, stalemate as a draw
+	if (mate || (!info->pvLen && info->score))
+		len = sprintf(line, "info depth %d score mate %d", info->depth, mate);
+	else
+		len = sprintf(line, "info depth %d score cp %d", info->depth, searchScoreCp(info->score));
+
+	len += sprintf(line + len, " nodes %llu nps %llu time %llu pv", (unsigned long long) info->nodes,
+		(unsigned long long) (info->timeUs ? info->nodes * 1000000 / info->timeUs : 0), (unsigned long long) (info->timeUs / 1000));
+	for (int i = 0; i < info->pvLen; i++) {
+		uciMove(move, info->pv[i]);
+		len += sprintf(line + len, " %s", move);
+	}
+
+	uciPrintf("%s", line);
+}
+
+static void *runSearch(void *data) {
+	UciSearch *s = data;
+	char best[6] = "0000", ponder[6] = "";
+
+	searchPosition(s->board, s->prevBoard, s->brkrwr00, s->whiteToMove, &s->limits, &s->info);
+
+	pthread_mutex_lock(&searchLock);
+	while (s->hold)
+		pthread_cond_wait(&searchReleased, &searchLock);
+	pthread_mutex_unlock(&searchLock);
+
+	if (s->info.pvLen) {
+		uciMove(best, s->info.pv[0]);
+		if (s->info.pvLen > 1)
+			uciMove(ponder, s->info.pv[1]);
+	} else {
+		// Stopped before the first iteration finished: any legal move will do
+		char *moves = NULL;
+		if (validMoves(s->board, s->prevBoard, s->brkrwr00, s->whiteToMove, &moves))
+			uciMove(best, moves);
+		free(moves);
+	}
+
+	if (*ponder)
+		uciPrintf("bestmove %s ponder %s", best, ponder);
+	else
+		uciPrintf("bestmove %s", best);
+
+	return NULL;
+}
+
+// Lets a held bestmove out and ends the search, if there is one
+static void stopSearch(void) {
+	if (!search.running)
+		return;
+
+	atomic_store(&search.stop, 1);
+	pthread_mutex_lock(&searchLock);
+	search.hold = 0;
+	search.deadlineNs = 0;
+	pthread_cond_signal(&searchReleased);
+	pthread_mutex_unlock(&searchLock);
+
+	pthread_join(search.thread, NULL);
+	search.running = 0;
+}
+
+// Value of the number after name in args, if it's there
+static char goValue(char const *args, char const *name, long *value) {
+	size_t len = strlen(name);
+
+	for (char const *p = args; (p = strstr(p, name)); p += len)
+		if ((p == args || p[-1] == ' ') && (p[len] == ' ' || !p[len])) {
+			*value = atol(p + len);
+			return 1;
+		}
+
+	return 0;
+}
+
+// Time to spend on the move from the clock, in ms: an even share of what
+// is left plus most of the increment, never near the whole of it
+static long clockBudget(long timeLeft, long increment, long movesToGo) {
+	long budget = timeLeft / (movesToGo > 0 && movesToGo < 40 ? movesToGo + 1 : 40) + increment * 3 / 4;
+	long most = timeLeft / 2 - MOVE_OVERHEAD_MS;
+
+	if (budget > most)
+		budget = most;
+	return budget > 1 ? budget : 1;
+}
+
+static void go(char const *args) {
+	long depth = 0, movetime = 0, timeLeft = -1, increment = 0, movesToGo = 0, value;
+	char infinite = goValue(args, "infinite", &value), ponder = goValue(args, "ponder", &value);
+	unsigned int budget = 0;
+
+	stopSearch();
+
+	goValue(args, "depth", &depth);
+	goValue(args, "movetime", &movetime);
+	goValue(args, game.whiteToMove ? "wtime" : "btime", &timeLeft);
+	goValue(args, game.whiteToMove ? "winc" : "binc", &increment);
+	goValue(args, "movestogo", &movesToGo);
+
+	if (movetime > 0)
+		budget = movetime > MOVE_OVERHEAD_MS * 2 ? movetime - MOVE_OVERHEAD_MS : movetime / 2 + 1;
+	else if (timeLeft >= 0)
+		budget = clockBudget(timeLeft, increment, movesToGo);
+
+	// A bare go searches until stopped
+	if (!depth && !budget)
+		infinite = 1;
+
+	if (!validSearchPosition(game.board, game.whiteToMove)) {
+		uciPrintf("info string not a position to search");
+		uciPrintf("bestmove 0000");
+		return;
+	}
+
+	memset(&search.limits, 0, sizeof search.limits);
+	memcpy(search.board, game.board, sizeof search.board);
+	memcpy(search.prevBoard, game.prevBoard, sizeof search.prevBoard);
+	search.brkrwr00 = game.brkrwr00;
+	search.whiteToMove = game.whiteToMove;
+	atomic_store(&search.stop, 0);
+
+	search.limits.depth = depth > 0 && depth < SEARCH_MAX_PLY ? depth : 0;
+	search.limits.stop = &search.stop;
+	search.limits.onIteration = printSearchInfo;
+	search.startNs = searchClockNs();
+
+	// A ponder search gets its clock only on ponderhit
+	search.hold = infinite || ponder;
+	search.budgetMs = budget;
+	search.deadlineNs = 0;
+	if (!infinite && !ponder && budget) {
+		search.limits.timeMs = budget;
+		search.deadlineNs = search.startNs + (uint64_t) budget * 1000000;
+	}
+
+	if (pthread_create(&search.thread, NULL, runSearch, &search)) {
+		uciPrintf("info string cannot start the search");
+		uciPrintf("bestmove 0000");
+		return;
+	}
+	search.running = 1;
+}
+
+static void ponderhit(void) {
+	pthread_mutex_lock(&searchLock);
+	if (search.running && search.hold) {
+		search.hold = 0;
+		if (search.budgetMs)
+			search.deadlineNs = searchClockNs() + (uint64_t) search.budgetMs * 1000000;
+		else
+			atomic_store(&search.stop, 1);
+		pthread_cond_signal(&searchReleased);
+	}
+	pthread_mutex_unlock(&searchLock);
+}
+
+// position startpos|fen <fen> [moves <uci> ...]. The move list is applied
+// with the GameTracker, so a GUI repeating the game so far with one move
+// more costs one move. Unlike lichess's, these moves are checked.
+static void position(char *args) {
+	char *moves = strstr(args, "moves"), *fen = NULL;
+
+	if (moves) {
+		moves[-1 * (moves > args)] = 0;
+		moves += 5;
+	}
+
+	if (!strncmp(args, "fen ", 4))
+		fen = args + 4;
+	else if (strncmp(args, "startpos", 8)) {
+		uciPrintf("info string position wants startpos or fen");
+		return;
+	}
+
+	if (!gameFen != !fen || (fen && strcmp(fen, gameFen))) {
+		free(gameFen);
+		gameFen = fen ? strdup(fen) : NULL;
+		freeGameTracker(&game);
+		if (!resetGameTracker(&game, fen, fen ? strlen(fen) : 0))
+			uciPrintf("info string bad fen, using the standard position");
+	}
+
+	// The position stops before the first bad move
+	if (updateGameTracker(&game, moves ? moves : "", moves ? strlen(moves) : 0) < 0) {
+		char const *bad = moves + game.movesLen + strspn(moves + game.movesLen, " ");
+		uciPrintf("info string illegal move %.*s in the move list", (int) strcspn(bad, " "), bad);
+	}
+}
+
+static void setoption(char const *args) {
+	char const *name = strstr(args, "name "), *value = strstr(args, " value ");
+
+	if (!name || !value)
+		return;
+	name += 5;
+
+	if (!strncasecmp(name, "Hash ", 5)) {
+		long mb = atol(value + 7);
+		hashMb = mb < 1 ? 1 : mb > MAX_HASH_MB ? MAX_HASH_MB : mb;
+	} else if (!strncasecmp(name, "Threads ", 8)) {
+		long n = atol(value + 7);
+		threads = n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : n;
+	} else
+		uciPrintf("info string no such option");
+}
+
+// Returns 0 on quit
+static int command(char *line) {
+	char *args = line + strcspn(line, " ");
+
+	if (*args)
+		*args++ = 0;
+
+	if (!strcmp(line, "uci")) {
+		uciPrintf("id name " UCI_NAME);
+		uciPrintf("id author " UCI_AUTHOR);
+		uciPrintf("option name Hash type spin default %d min 1 max %d", DEFAULT_HASH_MB, MAX_HASH_MB);
+		uciPrintf("option name Threads type spin default 1 min 1 max %d", MAX_THREADS);
+		uciPrintf("option name Ponder type check default false");
+		uciPrintf("uciok");
+	} else if (!strcmp(line, "isready"))
+		uciPrintf("readyok");
+	else if (!strcmp(line, "ucinewgame")) {
+		stopSearch();
+		free(gameFen);
+		gameFen = NULL;
+		freeGameTracker(&game);
+		initGameTracker(&game);
+		game.checkMoves = 1;
+	} else if (!strcmp(line, "setoption"))
+		setoption(args);
+	else if (!strcmp(line, "position")) {
+		stopSearch();
+		position(args);
+	} else if (!strcmp(line, "go"))
+		go(args);
+	else if (!strcmp(line, "stop"))
+		stopSearch();
+	else if (!strcmp(line, "ponderhit"))
+		ponderhit();
+	else if (!strcmp(line, "quit"))
+		return 0;
+	else if (*line)
+		uciPrintf("info string unknown command %s", line);
+
+	return 1;
+}
+
+// ms until the running search's deadline, -1 for none; stops it once it's there
+static int checkDeadline(void) {
+	int wait = -1;
+
+	pthread_mutex_lock(&searchLock);
+	if (search.running && search.deadlineNs) {
+		uint64_t now = searchClockNs();
+
+		if (now >= search.deadlineNs) {
+			atomic_store(&search.stop, 1);
+			search.deadlineNs = 0;
+		} else
+			wait = (search.deadlineNs - now + 999999) / 1000000;
+	}
+	pthread_mutex_unlock(&searchLock);
+
+	return wait;
+}
+
+int main(void) {
+	char *buf = malloc(MAX_LINE);
+	size_t len = 0;
+	int running = 1;
+
+	// stdout belongs to the protocol
+	initLogger(stderr, logLevelFromName(getenv("LOG_LEVEL"), LEVEL_WARN), LOG_RECORDS);
+	initGameTracker(&game);
+	game.checkMoves = 1;
+
+	while (running) {
+		struct pollfd in = {.fd = STDIN_FILENO, .events = POLLIN};
+		int ready = poll(&in, 1, checkDeadline());
+
+		if (ready <= 0)
+			continue;
+
+		ssize_t got = read(STDIN_FILENO, buf + len, MAX_LINE - 1 - len);
+		if (got <= 0)
+			break;
+		len += got;
+
+		char *start = buf, *end;
+		while (running && (end = memchr(start, '\n', buf + len - start))) {
+			*end = 0;
+			if (end > start && end[-1] == '\r')
+				end[-1] = 0;
+			running = command(start);
+			start = end + 1;
+		}
+
+		len -= start - buf;
+		memmove(buf, start, len);
+
+		// A line too long to be a command
+		if (len == MAX_LINE - 1)
+			len = 0;
+	}
+
+	stopSearch();
+	freeGameTracker(&game);
+	free(gameFen);
+	free(buf);
+	freeLogger();
+
+	return 0;
+}